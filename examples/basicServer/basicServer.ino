@@ -11,7 +11,8 @@
  * This library is licensed under the MIT License. See the LICENSE file for more information.
  *
  * This example covers the addition of a simple web server to the basicUsage, which allows
- * the user to explore the log and configuration files remotely.
+ * the user to explore the log and configuration files remotely, and of a TCP console
+ * (e.g. `nc <ip> 23`) streaming the records live to several clients at once.
  * 
  * All the other advanced usage features are reported in the basicUsage example.
  */
@@ -34,6 +35,13 @@ AdvancedLogger logger(
 
 AsyncWebServer server(80);
 
+// Each console client only needs its own cursor in the live buffer of the logger
+const int consolePort = 23;
+const int maxConsoleClients = 4;
+WiFiServer consoleServer(consolePort);
+WiFiClient consoleClients[maxConsoleClients];
+LogLiveCursor consoleCursors[maxConsoleClients];
+
 const int timeZone = 0; // UTC. In milliseconds
 const int daylightOffset = 0; // No daylight saving time. In milliseconds
 const char *ntpServer1 = "pool.ntp.org";
@@ -82,7 +90,18 @@ void setup()
     server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
               { request->send(200, "text/html", "<button onclick=\"window.location.href='/log'\">Explore the logs</button><br><br><button onclick=\"window.location.href='/config'\">Explore the configuration</button>"); });
     
-    server.serveStatic("/log", SPIFFS, customLogPath);
+    // The log is stored as checksummed binary records, so it is rendered as text by dump()
+    server.on("/log", HTTP_GET, [](AsyncWebServerRequest *request)
+              {
+                  AsyncResponseStream *response = request->beginResponseStream("text/plain");
+                  logger.dump(*response);
+                  request->send(response); });
+    // The same records as JSON lines, with the fields of logger.record() as members
+    server.on("/log.json", HTTP_GET, [](AsyncWebServerRequest *request)
+              {
+                  AsyncResponseStream *response = request->beginResponseStream("application/x-ndjson");
+                  logger.dump(*response, 0, 0, LogDumpFormat::JSON);
+                  request->send(response); });
     server.serveStatic("/config", SPIFFS, customConfigPath);
     
     server.onNotFound([](AsyncWebServerRequest *request)
@@ -91,9 +110,47 @@ void setup()
     
     logger.info("Server started!", "basicServer::setup");
 
+    // Stream the records live to the TCP console clients
+    // --------------------
+    logger.startLive();
+    consoleServer.begin();
+    xTaskCreate(consoleTask, "console", 4096, nullptr, 1, nullptr);
+
     logger.info("Setup done!", "basicServer::setup");
 }
 
+void consoleTask(void *parameter)
+{
+    char line[MAX_LOG_LENGTH];
+    while (true)
+    {
+        WiFiClient newClient = consoleServer.available();
+        if (newClient)
+        {
+            for (int i = 0; i < maxConsoleClients; i++)
+            {
+                if (consoleClients[i].connected()) continue;
+                consoleClients[i] = newClient;
+                consoleCursors[i] = logger.subscribeLive(true); // Start with the records still in the buffer
+                break;
+            }
+        }
+
+        // A slow client only delays this task: the logging never waits, and the client gets a gap line instead
+        for (int i = 0; i < maxConsoleClients; i++)
+        {
+            if (!consoleClients[i].connected()) continue;
+            size_t length;
+            while ((length = logger.readLive(consoleCursors[i], line, sizeof(line))) > 0)
+            {
+                consoleClients[i].write((const uint8_t *)line, length);
+                consoleClients[i].write("\r\n");
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(50));
+    }
+}
+
 void loop()
 {
     logger.debug("This is a debug message!", "basicServer::loop");
@@ -0,0 +1,116 @@
+/*
+ * File: benchmark.ino
+ * -------------------
+ * This file provides a benchmark of the throughput of the AdvancedLogger library.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * This example measures how many INFO records per second can be saved:
+ * - With every record written to the filesystem as soon as it is logged (sync level set to VERBOSE)
+ * - With the default durability tiers, where INFO records are buffered and written in batches
+ * It also measures the latency of a single ERROR record, which is always written before the call returns,
+ * and the cost of a log call whose level is neither printed nor saved, which is only a level check
+ * inlined in the caller.
+ *
+ * Only the saving is measured: the print level is set to FATAL so that the Serial does not
+ * dominate the results.
+ */
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+
+#include "AdvancedLogger.h"
+
+AdvancedLogger logger;
+
+const int recordCount = 2000;
+const int filteredCallCount = 100000;
+
+/**
+ * @brief Logs recordCount INFO records and prints the throughput.
+ *
+ * @param name Name of the run.
+*/
+void runBenchmark(const char *name)
+{
+    logger.clearLog();
+
+    unsigned long start = micros();
+    for (int i = 0; i < recordCount; i++)
+    {
+        logger.info("Benchmark record %d with some payload: %f", "benchmark::runBenchmark", i, i * 0.5);
+    }
+    logger.flush();
+    unsigned long elapsed = micros() - start;
+
+    start = micros();
+    logger.error("Benchmark error record", "benchmark::runBenchmark");
+    unsigned long errorLatency = micros() - start;
+
+    Serial.printf(
+        "%-22s %6d records in %7lu ms: %7.1f records/s, %5lu us/record, ERROR latency %lu us\n",
+        name,
+        recordCount,
+        elapsed / 1000,
+        recordCount * 1000000.0 / elapsed,
+        elapsed / recordCount,
+        errorLatency);
+}
+
+/**
+ * @brief Logs filteredCallCount VERBOSE records, below both the print and the save level, and prints the cost per call.
+*/
+void runFilteredBenchmark()
+{
+    unsigned long start = micros();
+    for (int i = 0; i < filteredCallCount; i++)
+    {
+        logger.verbose("Filtered record %d with some payload: %f", "benchmark::runFilteredBenchmark", i, i * 0.5);
+    }
+    unsigned long elapsed = micros() - start;
+
+    Serial.printf(
+        "%-22s %6d calls in %7lu ms: %7.1f ns/call\n",
+        "Filtered out",
+        filteredCallCount,
+        elapsed / 1000,
+        elapsed * 1000.0 / filteredCallCount);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    if (!SPIFFS.begin(true))
+    {
+        Serial.println("An Error has occurred while mounting SPIFFS");
+    }
+
+    logger.begin();
+    logger.setPrintLevel(LogLevel::FATAL);
+    logger.setSaveLevel(LogLevel::INFO);
+    logger.setMaxLogBytes(DEFAULT_MAX_LOG_BYTES);
+
+    Serial.println("AdvancedLogger benchmark");
+
+    // Every record is written as soon as it is logged, as in a logger without a write buffer
+    logger.setSyncLevel(LogLevel::VERBOSE);
+    runBenchmark("Flush every record");
+
+    // INFO records are buffered and written when the buffer is full or the flush interval expires
+    logger.setSyncLevel(DEFAULT_SYNC_LEVEL);
+    runBenchmark("Durability tiers");
+
+    runFilteredBenchmark();
+
+    logger.setDefaultConfig();
+    logger.clearLog();
+}
+
+void loop()
+{
+    delay(1000);
+}
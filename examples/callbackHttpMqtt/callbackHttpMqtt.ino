@@ -90,6 +90,10 @@ In this example, the function will:
 
 The function will also measure the time taken to format the JSON,
 send the HTTP request, and publish the MQTT message.
+
+The callback runs on a dedicated task of the logger, so a slow HTTP
+request never delays the log calls: if the callback cannot keep up,
+the records are dropped and counted in getCallbackStats().
 */
 void callback(
     const char* timestamp,
@@ -177,6 +181,7 @@ void setup()
     logger.begin();
     logger.setMaxLogLines(maxLogLines);
     logger.setCallback(callback);
+    logger.setCallbackDeadline(2000); // Invocations longer than this are counted as overruns
 
     logger.debug("AdvancedLogger setup done!", "basicServer::setup");
     
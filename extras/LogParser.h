@@ -0,0 +1,771 @@
+/*
+ * File: LogParser.h
+ * -----------------
+ * This file defines the host-side parsing of downloaded logs, either the text lines printed
+ * by dump() or the binary segment files of the SPIFFS, into the columns of LOG_FORMAT.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header is only meant for host tools on Linux or macOS (see extras/logAnalyzer.cpp), and
+ * is not part of the Arduino library build.
+ *
+ * The files are memory-mapped, and the parsed records only point into the mapping, so that no
+ * line is copied or allocated while parsing. The lines of a text file are split with a SIMD
+ * search for the newlines (AVX2 or SSE2 when the compiler targets them, memchr() otherwise).
+ * A binary file is walked frame by frame as dump() does: frames failing their CRC are skipped
+ * by searching for the next sync byte, and the records are dated and given their task name
+ * from the .time and .tasks files found next to the segment, if any.
+ */
+
+#ifndef LOGPARSER_H
+#define LOGPARSER_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "../src/LogFrame.h"
+
+constexpr int LOG_PARSER_LEVEL_COUNT = 6;
+constexpr int LOG_PARSER_UNKNOWN_LEVEL = -1;
+constexpr size_t LOG_PARSER_TIMESTAMP_LENGTH = 19; // "%Y-%m-%d %H:%M:%S", DEFAULT_TIMESTAMP_FORMAT
+constexpr const char *LOG_PARSER_UNKNOWN_TASK = "unknown";
+constexpr const char *LOG_PARSER_TIME_SUFFIX = ".time";
+constexpr const char *LOG_PARSER_TASK_SUFFIX = ".tasks";
+
+static const char *const LOG_PARSER_LEVELS[LOG_PARSER_LEVEL_COUNT] = {"VERBOSE", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL"};
+
+/**
+ * @brief A record split into the columns of LOG_FORMAT.
+ *
+ * The strings are not null-terminated, and point either into the mapped
+ * file or into the reader which parsed the record, so they are only valid
+ * until the next record is parsed or the file is unmapped.
+ */
+struct LogParsedRecord {
+    int64_t timeUs = -1; // Unix time in microseconds, -1 if the timestamp could not be parsed
+    const char *timestamp = "";
+    size_t timestampLength = 0;
+    uint64_t millis = 0; // Uptime
+    const char *task = "";
+    size_t taskLength = 0;
+    int level = LOG_PARSER_UNKNOWN_LEVEL;
+    unsigned int core = 0;
+    const char *function = "";
+    size_t functionLength = 0;
+    const char *message = ""; // Of a text line, it ends with the fields as key=value
+    size_t messageLength = 0;
+    const uint8_t *fields = nullptr; // Encoded fields of a FIELDS frame
+    size_t fieldsLength = 0;
+    const uint8_t *bytes = nullptr; // Raw bytes of a BYTES frame, which has no message
+    size_t bytesLength = 0;
+};
+
+/**
+ * @brief Gets the level named by a string.
+ *
+ * @param name Name of the level, in any case, possibly padded with spaces.
+ * @param length Length of the name.
+ * @return int Level, or LOG_PARSER_UNKNOWN_LEVEL.
+ */
+inline int logParserLevel(const char *name, size_t length)
+{
+    while (length > 0 && name[length - 1] == ' ') length--;
+    if (length == 0) return LOG_PARSER_UNKNOWN_LEVEL;
+
+    // The first letters of the levels all differ
+    int level;
+    switch (name[0] & ~0x20)
+    {
+    case 'V': level = 0; break;
+    case 'D': level = 1; break;
+    case 'I': level = 2; break;
+    case 'W': level = 3; break;
+    case 'E': level = 4; break;
+    case 'F': level = 5; break;
+    default: return LOG_PARSER_UNKNOWN_LEVEL;
+    }
+    const char *expected = LOG_PARSER_LEVELS[level];
+    return strlen(expected) == length && strncasecmp(name, expected, length) == 0 ? level : LOG_PARSER_UNKNOWN_LEVEL;
+}
+
+/**
+ * @brief Finds the next newline.
+ *
+ * @param cursor First character to search.
+ * @param end End of the text.
+ * @return const char* Position of the newline, or end if there is none.
+ */
+inline const char *logParserFindNewline(const char *cursor, const char *end)
+{
+#if defined(__AVX2__)
+    const __m256i newline = _mm256_set1_epi8('\n');
+    while (end - cursor >= 32)
+    {
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)cursor), newline));
+        if (mask != 0) return cursor + __builtin_ctz(mask);
+        cursor += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - cursor >= 16)
+    {
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)cursor), newline));
+        if (mask != 0) return cursor + __builtin_ctz(mask);
+        cursor += 16;
+    }
+#endif
+    const char *found = (const char *)memchr(cursor, '\n', end - cursor);
+    return found != nullptr ? found : end;
+}
+
+/**
+ * @brief Parses a timestamp in DEFAULT_TIMESTAMP_FORMAT.
+ *
+ * The timestamp is taken as UTC, as the time zone of the device is not
+ * stored in a text log.
+ *
+ * @param text Timestamp, "YYYY-MM-DD HH:MM:SS".
+ * @param length Length of the timestamp.
+ * @return int64_t Unix time in seconds, -1 if the timestamp is in another format.
+ */
+inline int64_t logParserParseTimestamp(const char *text, size_t length)
+{
+    if (length != LOG_PARSER_TIMESTAMP_LENGTH) return -1;
+    static const char layout[] = "dddd-dd-dd dd:dd:dd";
+    int value[6] = {};
+    int part = 0;
+    for (size_t i = 0; i < LOG_PARSER_TIMESTAMP_LENGTH; i++)
+    {
+        if (layout[i] != 'd')
+        {
+            if (text[i] != layout[i]) return -1;
+            part++;
+            continue;
+        }
+        if (text[i] < '0' || text[i] > '9') return -1;
+        value[part] = value[part] * 10 + (text[i] - '0');
+    }
+    int year = value[0];
+    int month = value[1];
+    if (month < 1 || month > 12 || value[2] < 1 || value[2] > 31) return -1;
+
+    // Days since 1970-01-01 of the proleptic Gregorian calendar, with the years starting in March
+    year -= month <= 2;
+    int era = year / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + value[2] - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    int64_t days = (int64_t)era * 146097 + dayOfEra - 719468;
+    return days * 86400 + value[3] * 3600 + value[4] * 60 + value[5];
+}
+
+/**
+ * @brief Parses the part of a line stored in the log, as in LOG_BODY_FORMAT.
+ *
+ * The line is "[LEVEL   ] [Core N] [function] message". Function names may
+ * contain brackets, but not "] " followed by the message, as in dump().
+ *
+ * @param cursor Start of the line.
+ * @param end End of the line.
+ * @param record Set to the level, core, function and message of the line.
+ * @return bool Whether the level and core were found.
+ */
+inline bool logParserParseBody(const char *cursor, const char *end, LogParsedRecord &record)
+{
+    bool parsed = false;
+    if (cursor < end && *cursor == '[')
+    {
+        const char *close = (const char *)memchr(cursor, ']', end - cursor);
+        if (close != nullptr && end - close > 7 && memcmp(close, "] [Core ", 8) == 0)
+        {
+            record.level = logParserLevel(cursor + 1, close - cursor - 1);
+            cursor = close + 8;
+            record.core = 0;
+            while (cursor < end && *cursor >= '0' && *cursor <= '9') record.core = record.core * 10 + (*cursor++ - '0');
+            parsed = record.level != LOG_PARSER_UNKNOWN_LEVEL;
+            if (end - cursor >= 3 && memcmp(cursor, "] [", 3) == 0)
+            {
+                cursor += 3;
+                close = cursor;
+                while (close < end && !(*close == ']' && (close + 1 == end || close[1] == ' '))) close++;
+                record.function = cursor;
+                record.functionLength = close - cursor;
+                cursor = close < end ? close + 1 : end;
+                if (cursor < end && *cursor == ' ') cursor++;
+            }
+        }
+    }
+    record.message = cursor;
+    record.messageLength = end - cursor;
+    return parsed;
+}
+
+/**
+ * @brief Parses a line in LOG_FORMAT, as printed to the Serial or by dump().
+ *
+ * The task is the last " task=NAME" of the line, after the fields. The lines
+ * of the logs written before the task was added to LOG_FORMAT are also
+ * parsed, with an empty task.
+ *
+ * @param line Start of the line.
+ * @param length Length of the line, without its terminator.
+ * @param record Set to the columns of the line.
+ * @return bool Whether the line is a record, rather than a continuation of a multi-line message.
+ */
+inline bool logParserParseLine(const char *line, size_t length, LogParsedRecord &record)
+{
+    const char *end = line + length;
+    if (end > line && end[-1] == '\r') end--;
+    record = LogParsedRecord();
+    if (end - line < 2 || line[0] != '[') return false;
+
+    const char *close = (const char *)memchr(line, ']', end - line);
+    if (close == nullptr || end - close < 3 || memcmp(close, "] [", 3) != 0) return false;
+    record.timestamp = line + 1;
+    record.timestampLength = close - line - 1;
+    int64_t seconds = logParserParseTimestamp(record.timestamp, record.timestampLength);
+    record.timeUs = seconds >= 0 ? seconds * 1000000 : -1;
+
+    // The uptime is grouped by thousands with spaces, "1 450 ms"
+    const char *cursor = close + 3;
+    while (cursor < end && ((*cursor >= '0' && *cursor <= '9') || *cursor == ' '))
+    {
+        if (*cursor != ' ') record.millis = record.millis * 10 + (*cursor - '0');
+        cursor++;
+    }
+    if (end - cursor < 5 || memcmp(cursor, "ms] ", 4) != 0) return false;
+    cursor += 4;
+
+    if (cursor >= end || *cursor != '[') return false;
+    bool parsed = logParserParseBody(cursor, end, record);
+
+    static const char taskKey[] = " task=";
+    constexpr size_t taskKeyLength = sizeof(taskKey) - 1;
+    for (size_t i = record.messageLength; i >= taskKeyLength; i--)
+    {
+        const char *key = record.message + i - taskKeyLength;
+        if (memcmp(key, taskKey, taskKeyLength) != 0) continue;
+        record.task = key + taskKeyLength;
+        record.taskLength = end - record.task;
+        record.messageLength = key - record.message;
+        break;
+    }
+    return parsed;
+}
+
+/**
+ * @brief Reads the span of a record, as rendered by logFrameFormatSpan().
+ *
+ * The message of the record, either parsed from a text line or rendered
+ * from a SPAN frame, is "span begin id=12 parent=3" or
+ * "span end id=12 parent=3 us=7312", and the name of the span is the
+ * function of the record.
+ *
+ * @param record Parsed record.
+ * @param span Set to the span of the record.
+ * @return bool Whether the record is a span.
+ */
+inline bool logParserReadSpan(const LogParsedRecord &record, LogFrameSpan &span)
+{
+    const char *cursor = record.message;
+    const char *end = cursor + record.messageLength;
+    auto skip = [&](const char *expected) {
+        size_t length = strlen(expected);
+        if ((size_t)(end - cursor) < length || memcmp(cursor, expected, length) != 0) return false;
+        cursor += length;
+        return true;
+    };
+    auto number = [&](uint64_t &value) {
+        const char *start = cursor;
+        value = 0;
+        while (cursor < end && *cursor >= '0' && *cursor <= '9') value = value * 10 + (uint64_t)(*cursor++ - '0');
+        return cursor > start;
+    };
+
+    if (!skip("span ")) return false;
+    if (skip("begin")) span.phase = LogSpanPhase::BEGIN;
+    else if (skip("end")) span.phase = LogSpanPhase::END;
+    else return false;
+    uint64_t id;
+    uint64_t parent;
+    span.durationUs = 0;
+    if (!skip(" id=") || !number(id) || !skip(" parent=") || !number(parent)) return false;
+    if (span.phase == LogSpanPhase::END && (!skip(" us=") || !number(span.durationUs))) return false;
+    span.id = (uint32_t)id;
+    span.parent = (uint32_t)parent;
+    return cursor == end;
+}
+
+/**
+ * @brief Renders the fields of a FIELDS frame as " key=value" pairs, as in the text of dump().
+ *
+ * @param output String to append to.
+ * @param fields Encoded fields.
+ * @param length Length of the fields.
+ */
+inline void logParserAppendFields(std::string &output, const uint8_t *fields, size_t length)
+{
+    size_t offset = 0;
+    size_t fieldSize;
+    LogFrameField field;
+    while ((fieldSize = logFrameReadField(fields + offset, length - offset, field)) > 0)
+    {
+        offset += fieldSize;
+        output += ' ';
+        output.append(field.key, field.keyLength);
+        output += '=';
+
+        char value[32];
+        switch (field.type)
+        {
+        case LogFieldType::INT:
+            snprintf(value, sizeof(value), "%lld", (long long)(int64_t)field.bits);
+            break;
+        case LogFieldType::UINT:
+            snprintf(value, sizeof(value), "%llu", (unsigned long long)field.bits);
+            break;
+        case LogFieldType::FLOAT:
+        {
+            double number;
+            memcpy(&number, &field.bits, sizeof(number));
+            snprintf(value, sizeof(value), "%.10g", number);
+            break;
+        }
+        case LogFieldType::BOOL:
+            snprintf(value, sizeof(value), "%s", field.bits ? "true" : "false");
+            break;
+        default:
+        {
+            bool quoted = field.stringLength == 0;
+            for (size_t i = 0; i < field.stringLength && !quoted; i++)
+            {
+                char c = field.string[i];
+                quoted = c == ' ' || c == '"' || c == '=' || c == '\\' || (uint8_t)c < 0x20;
+            }
+            if (!quoted)
+            {
+                output.append(field.string, field.stringLength);
+                continue;
+            }
+            output += '"';
+            for (size_t i = 0; i < field.stringLength; i++)
+            {
+                char c = field.string[i];
+                if (c == '"' || c == '\\') output += '\\';
+                output += (uint8_t)c < 0x20 ? ' ' : c;
+            }
+            output += '"';
+            continue;
+        }
+        }
+        output += value;
+    }
+}
+
+/**
+ * @brief Renders raw bytes as space-separated hex, as in the text of dump().
+ *
+ * @param output String to append to.
+ * @param bytes Raw bytes.
+ * @param length Number of bytes.
+ */
+inline void logParserAppendHex(std::string &output, const uint8_t *bytes, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++)
+    {
+        if (i > 0) output += ' ';
+        output += digits[bytes[i] >> 4];
+        output += digits[bytes[i] & 0x0F];
+    }
+}
+
+/**
+ * @brief Renders the task of a record as " task=NAME", which ends its line in the text of dump().
+ *
+ * Nothing is rendered for the records parsed from logs without the task.
+ *
+ * @param output String to append to.
+ * @param record Record whose task is rendered.
+ */
+inline void logParserAppendTask(std::string &output, const LogParsedRecord &record)
+{
+    if (record.taskLength == 0) return;
+    output += " task=";
+    output.append(record.task, record.taskLength);
+}
+
+/**
+ * @brief Renders a record as a line of the text of dump(), in LOG_FORMAT.
+ *
+ * The block of a BYTES record is rendered as its first line followed by
+ * its hexdump, as AdvancedLogger::_printBytes() does.
+ *
+ * @param output String to append to, ending with a newline.
+ * @param record Record to render.
+ */
+inline void logParserAppendLine(std::string &output, const LogParsedRecord &record)
+{
+    // The uptime is grouped by thousands with spaces, "1 450 ms"
+    char millis[32];
+    int digits = snprintf(millis, sizeof(millis), "%llu", (unsigned long long)record.millis);
+    output += '[';
+    output.append(record.timestamp, record.timestampLength);
+    output += "] [";
+    for (int i = 0; i < digits; i++)
+    {
+        if (i > 0 && (digits - i) % 3 == 0) output += ' ';
+        output += millis[i];
+    }
+    output += " ms] [";
+    const char *level = record.level != LOG_PARSER_UNKNOWN_LEVEL ? LOG_PARSER_LEVELS[record.level] : "UNKNOWN";
+    output += level;
+    output.append(8 - strlen(level), ' ');
+    output += "] [Core ";
+    output += std::to_string(record.core);
+    output += "] [";
+    output.append(record.function, record.functionLength);
+    output += "] ";
+    if (record.bytes == nullptr)
+    {
+        output.append(record.message, record.messageLength);
+        if (record.fields != nullptr) logParserAppendFields(output, record.fields, record.fieldsLength);
+        logParserAppendTask(output, record);
+        output += '\n';
+        return;
+    }
+
+    output += std::to_string(record.bytesLength);
+    output += " bytes";
+    logParserAppendTask(output, record);
+    output += '\n';
+    constexpr size_t bytesPerLine = 16;
+    for (size_t offset = 0; offset < record.bytesLength; offset += bytesPerLine)
+    {
+        size_t count = std::min(record.bytesLength - offset, bytesPerLine);
+        char line[128];
+        int position = snprintf(line, sizeof(line), "    %04x ", (unsigned int)offset);
+        for (size_t i = 0; i < bytesPerLine; i++)
+        {
+            if (i < count) position += snprintf(line + position, sizeof(line) - position, " %02x", record.bytes[offset + i]);
+            else position += snprintf(line + position, sizeof(line) - position, "   ");
+        }
+        output.append(line, position);
+        output += "  |";
+        for (size_t i = 0; i < count; i++)
+        {
+            uint8_t byte = record.bytes[offset + i];
+            output += (byte >= 0x20 && byte < 0x7F) ? (char)byte : '.';
+        }
+        output += "|\n";
+    }
+}
+
+/**
+ * @brief A file mapped read-only in memory.
+ */
+class LogMappedFile
+{
+public:
+    LogMappedFile() {}
+    ~LogMappedFile() { close(); }
+
+    LogMappedFile(const LogMappedFile &) = delete;
+    LogMappedFile &operator=(const LogMappedFile &) = delete;
+
+    /**
+     * @brief Maps a file.
+     *
+     * @param path Path of the file.
+     * @return bool Whether the file was mapped. An empty file is mapped with a null data.
+     */
+    bool open(const char *path)
+    {
+        close();
+        int descriptor = ::open(path, O_RDONLY);
+        if (descriptor < 0) return false;
+        struct stat status;
+        bool mapped = fstat(descriptor, &status) == 0;
+        if (mapped && status.st_size > 0)
+        {
+            void *data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            mapped = data != MAP_FAILED;
+            if (mapped)
+            {
+                _data = (const char *)data;
+                _size = (size_t)status.st_size;
+                madvise(data, _size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(descriptor);
+        return mapped;
+    }
+
+    void close()
+    {
+        if (_data != nullptr) munmap((void *)_data, _size);
+        _data = nullptr;
+        _size = 0;
+    }
+
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const char *_data = nullptr;
+    size_t _size = 0;
+};
+
+/**
+ * @brief Reads the records of a binary segment file.
+ */
+class LogBinaryReader
+{
+public:
+    /**
+     * @brief Checks whether a file is a segment file, which starts with a valid SEGMENT frame.
+     *
+     * @param data Content of the file.
+     * @param size Size of the file.
+     * @return bool Whether the file is binary.
+     */
+    static bool isBinary(const char *data, size_t size)
+    {
+        const uint8_t *frame = (const uint8_t *)data;
+        return size >= LOG_SEGMENT_FRAME_SIZE && frame[1] == (uint8_t)LogFrameType::SEGMENT && logFrameValidate(frame, size) == LOG_SEGMENT_FRAME_SIZE;
+    }
+
+    /**
+     * @brief Loads the boot times and task names of a log.
+     *
+     * They are read from the .time and .tasks files next to the segment
+     * files, "log.txt.time" for "log.txt.00". Without them, the records keep
+     * their saved unix time and have no task name.
+     *
+     * @param segmentPath Path of a segment file of the log.
+     */
+    void loadLog(const std::string &segmentPath)
+    {
+        _bootTimes.clear();
+        _taskNames.clear();
+        size_t length = segmentPath.size();
+        if (length < 3 || segmentPath[length - 3] != '.' || !isdigit((uint8_t)segmentPath[length - 2]) || !isdigit((uint8_t)segmentPath[length - 1])) return;
+        std::string logPath = segmentPath.substr(0, length - 3);
+
+        LogMappedFile file;
+        if (file.open((logPath + LOG_PARSER_TIME_SUFFIX).c_str()))
+        {
+            size_t offset = 0;
+            const uint8_t *frame;
+            size_t frameSize;
+            while ((frameSize = _nextFrame((const uint8_t *)file.data(), file.size(), offset, frame)) > 0)
+            {
+                if (frame[1] != (uint8_t)LogFrameType::TIME || frameSize != LOG_TIME_FRAME_SIZE) continue;
+                BootTime bootTime;
+                bootTime.bootId = logFrameGetU32(frame + LOG_FRAME_HEADER_SIZE);
+                bootTime.monotonicUs = logFrameGetU64(frame + LOG_FRAME_HEADER_SIZE + 4);
+                bootTime.unixUs = logFrameGetU64(frame + LOG_FRAME_HEADER_SIZE + 12);
+                if (bootTime.unixUs > 0) _bootTimes.push_back(bootTime);
+            }
+        }
+        if (file.open((logPath + LOG_PARSER_TASK_SUFFIX).c_str()))
+        {
+            size_t offset = 0;
+            const uint8_t *frame;
+            size_t frameSize;
+            while ((frameSize = _nextFrame((const uint8_t *)file.data(), file.size(), offset, frame)) > 0)
+            {
+                if (frame[1] != (uint8_t)LogFrameType::TASK || frameSize < LOG_FRAME_OVERHEAD + LOG_TASK_PAYLOAD_HEADER_SIZE) continue;
+                TaskName taskName;
+                taskName.key = _taskKey(logFrameGetU32(frame + LOG_FRAME_HEADER_SIZE), frame[LOG_FRAME_HEADER_SIZE + 4]);
+                taskName.name.assign((const char *)frame + LOG_FRAME_HEADER_SIZE + LOG_TASK_PAYLOAD_HEADER_SIZE, frameSize - LOG_FRAME_OVERHEAD - LOG_TASK_PAYLOAD_HEADER_SIZE);
+                _taskNames.push_back(taskName);
+            }
+            std::stable_sort(_taskNames.begin(), _taskNames.end(), [](const TaskName &a, const TaskName &b) { return a.key < b.key; });
+        }
+    }
+
+    /**
+     * @brief Starts reading a segment file.
+     *
+     * @param data Content of the file, which must stay mapped while reading.
+     * @param size Size of the file.
+     */
+    void begin(const char *data, size_t size)
+    {
+        _data = (const uint8_t *)data;
+        _size = size;
+        _offset = 0;
+        _corrupted = 0;
+    }
+
+    /**
+     * @brief Parses the next record.
+     *
+     * The timestamp is rendered in UTC, and the record is dated as in dump():
+     * from its saved unix time if valid, else from the time at which the
+     * clock of its boot was set if known, else from its monotonic time.
+     *
+     * @param record Set to the columns of the record.
+     * @return bool Whether a record was found before the end of the file.
+     */
+    bool next(LogParsedRecord &record)
+    {
+        const uint8_t *frame;
+        size_t frameSize;
+        while ((frameSize = _nextFrame(_data, _size, _offset, frame, &_corrupted)) > 0)
+        {
+            if (logFrameIsRecord(frame[1]) && frameSize >= LOG_FRAME_OVERHEAD + LOG_TEXT_PREFIX_SIZE)
+            {
+                _decode(frame, frameSize, record);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t corrupted() const { return _corrupted; } // Frames skipped as invalid
+
+private:
+    struct BootTime {
+        uint32_t bootId;
+        uint64_t monotonicUs;
+        uint64_t unixUs;
+    };
+
+    struct TaskName {
+        uint64_t key;
+        std::string name;
+    };
+
+    std::vector<BootTime> _bootTimes;
+    std::vector<TaskName> _taskNames; // Sorted by key
+    const uint8_t *_data = nullptr;
+    size_t _size = 0;
+    size_t _offset = 0;
+    size_t _corrupted = 0;
+    int64_t _timestampSecond = -1;
+    char _timestamp[32] = "";
+    char _spanMessage[LOG_SPAN_MESSAGE_SIZE] = "";
+
+    static uint64_t _taskKey(uint32_t bootId, uint8_t taskId) { return ((uint64_t)bootId << 8) | taskId; }
+
+    // Gets the next valid frame, skipping to the next sync byte after an invalid one
+    static size_t _nextFrame(const uint8_t *data, size_t size, size_t &offset, const uint8_t *&frame, size_t *corrupted = nullptr)
+    {
+        while (offset < size)
+        {
+            frame = data + offset;
+            size_t frameSize = logFrameValidate(frame, size - offset);
+            if (frameSize > 0)
+            {
+                offset += frameSize;
+                return frameSize;
+            }
+            if (corrupted != nullptr) (*corrupted)++;
+            const uint8_t *sync = (const uint8_t *)memchr(frame + 1, LOG_FRAME_SYNC, size - offset - 1);
+            offset = sync != nullptr ? sync - data : size;
+        }
+        return 0;
+    }
+
+    void _decode(const uint8_t *frame, size_t frameSize, LogParsedRecord &record)
+    {
+        record = LogParsedRecord();
+        const uint8_t *prefix = frame + LOG_FRAME_HEADER_SIZE;
+        uint32_t unixTime = logFrameGetU32(prefix);
+        uint32_t bootId = logFrameGetU32(prefix + 4);
+        uint64_t monotonicUs = logFrameGetU64(prefix + 8);
+
+        uint64_t bootUs = 0;
+        for (const BootTime &bootTime : _bootTimes)
+        {
+            if (bootTime.bootId == bootId) bootUs = bootTime.unixUs - bootTime.monotonicUs + monotonicUs;
+        }
+
+        // The saved second wins over the clock of the boot, which may have been adjusted since it was set
+        uint64_t timeUs = bootUs > 0 ? bootUs : monotonicUs;
+        if (unixTime >= LOG_MIN_VALID_TIME && bootUs / 1000000 != unixTime) timeUs = (uint64_t)unixTime * 1000000;
+        record.timeUs = (int64_t)timeUs;
+        record.millis = monotonicUs / 1000;
+
+        int64_t second = (int64_t)(timeUs / 1000000);
+        if (second != _timestampSecond)
+        {
+            time_t seconds = (time_t)second;
+            struct tm timeinfo;
+            gmtime_r(&seconds, &timeinfo);
+            if (strftime(_timestamp, sizeof(_timestamp), "%Y-%m-%d %H:%M:%S", &timeinfo) == 0) _timestamp[0] = '\0';
+            _timestampSecond = second;
+        }
+        record.timestamp = _timestamp;
+        record.timestampLength = strlen(_timestamp);
+
+        record.task = LOG_PARSER_UNKNOWN_TASK;
+        record.taskLength = strlen(LOG_PARSER_UNKNOWN_TASK);
+        TaskName key;
+        key.key = _taskKey(bootId, prefix[16]);
+        auto name = std::lower_bound(_taskNames.begin(), _taskNames.end(), key, [](const TaskName &a, const TaskName &b) { return a.key < b.key; });
+        if (name != _taskNames.end() && name->key == key.key)
+        {
+            record.task = name->name.data();
+            record.taskLength = name->name.size();
+        }
+
+        // Same layouts as in AdvancedLogger::_printRecord()
+        const uint8_t *body = prefix + LOG_TEXT_PREFIX_SIZE;
+        size_t bodyLength = frameSize - LOG_FRAME_OVERHEAD - LOG_TEXT_PREFIX_SIZE;
+        if (frame[1] == (uint8_t)LogFrameType::FIELDS && bodyLength >= LOG_FIELDS_HEADER_SIZE)
+        {
+            record.fieldsLength = std::min((size_t)logFrameGetU16(body), bodyLength - LOG_FIELDS_HEADER_SIZE);
+            record.fields = body + LOG_FIELDS_HEADER_SIZE;
+            body += LOG_FIELDS_HEADER_SIZE + record.fieldsLength;
+            bodyLength -= LOG_FIELDS_HEADER_SIZE + record.fieldsLength;
+        }
+        if (frame[1] == (uint8_t)LogFrameType::BYTES || frame[1] == (uint8_t)LogFrameType::SPAN)
+        {
+            size_t headerLength = bodyLength >= LOG_BYTES_HEADER_SIZE ? std::min(LOG_BYTES_HEADER_SIZE + body[2], bodyLength) : bodyLength;
+            if (headerLength >= LOG_BYTES_HEADER_SIZE)
+            {
+                record.level = body[0] < LOG_PARSER_LEVEL_COUNT ? body[0] : LOG_PARSER_UNKNOWN_LEVEL;
+                record.core = body[1];
+                record.function = (const char *)body + LOG_BYTES_HEADER_SIZE;
+                record.functionLength = headerLength - LOG_BYTES_HEADER_SIZE;
+            }
+            if (frame[1] == (uint8_t)LogFrameType::SPAN)
+            {
+                // Rendered as by dump(), so that the spans are read back the same way from a text log
+                LogFrameSpan span;
+                int length = 0;
+                if (logFrameReadSpan(body + headerLength, bodyLength - headerLength, span)) length = logFrameFormatSpan(_spanMessage, sizeof(_spanMessage), span);
+                record.message = _spanMessage;
+                record.messageLength = (size_t)std::max(0, std::min(length, (int)sizeof(_spanMessage) - 1));
+                return;
+            }
+            record.bytes = body + headerLength;
+            record.bytesLength = bodyLength - headerLength;
+            return;
+        }
+        logParserParseBody((const char *)body, (const char *)body + bodyLength, record);
+    }
+};
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * File: backtraceTest.cpp
+ * -----------------------
+ * Host test of the LogBacktraceRing (see src/LogBacktrace.h) and of the way AdvancedLogger saves
+ * the records it keeps in it, which must never put a tier of the log out of chronological order.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build and run on the host (not part of the Arduino library build):
+ *   g++ -O2 -std=c++17 -o backtraceTest extras/backtraceTest.cpp && ./backtraceTest
+ *
+ * The ring is filled with frames of random sizes from a few tasks, wrapping many times, while
+ * take() is called for random tasks: every frame handed over must be intact, oldest first, and
+ * handed over only once. Then random records of several tasks are logged, as the frames
+ * AdvancedLogger saves, into a log of two tiers. As in AdvancedLogger::_save(), the records below
+ * the save level are kept in the ring, and a record at or above the trigger level first saves the
+ * last ones with LogBacktraceRing::takeInOrder(), the code run by AdvancedLogger::_saveBacktrace().
+ * Each tier must stay in chronological order, each record must be saved at most once, and a record
+ * kept right before a trigger must be saved with it.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "../src/LogBacktrace.h"
+#include "../src/LogFrame.h"
+
+constexpr int ROUNDS = 300;
+constexpr int OPERATIONS = 5000;
+constexpr int TASK_COUNT = 3;
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                          \
+    do                                                 \
+    {                                                  \
+        if (!(condition))                              \
+        {                                              \
+            failures++;                                \
+            fprintf(stderr, __VA_ARGS__);              \
+            fprintf(stderr, " (line %d)\n", __LINE__); \
+        }                                              \
+    } while (0)
+
+static void testRing(std::mt19937 &random)
+{
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        LogBacktraceRing ring;
+        size_t capacity = 64 + random() % 4096;
+        CHECK(ring.begin(capacity), "round %d: ring of %zu bytes not allocated", round, capacity);
+        uint32_t next = 0;
+        std::set<uint32_t> taken;
+
+        for (int operation = 0; operation < OPERATIONS; operation++)
+        {
+            if (random() % 16 == 0)
+            {
+                int task = random() % 4 == 0 ? LOG_BACKTRACE_ALL_TASKS : (int)(random() % TASK_COUNT);
+                size_t maxRecords = random() % 8;
+                uint32_t previous = 0;
+                bool first = true;
+                size_t visited = 0;
+                size_t count = ring.take(task, maxRecords, [&](uint8_t, uint8_t taskId, const uint8_t *frame, size_t frameSize) {
+                    uint32_t id = logFrameGetU32(frame);
+                    for (size_t i = 4; i < frameSize; i++) CHECK(frame[i] == (uint8_t)id, "round %d: frame %u corrupted", round, id);
+                    CHECK(task == LOG_BACKTRACE_ALL_TASKS || taskId == task, "round %d: frame %u of the wrong task", round, id);
+                    CHECK(first || id > previous, "round %d: frame %u handed over before %u", round, id, previous);
+                    CHECK(taken.insert(id).second, "round %d: frame %u handed over twice", round, id);
+                    first = false;
+                    previous = id;
+                    visited++;
+                });
+                CHECK(count == visited && count <= maxRecords, "round %d: %zu records taken, %zu visited", round, count, visited);
+                continue;
+            }
+
+            size_t frameSize = 4 + random() % (capacity / 3);
+            uint8_t *frame = ring.reserve(frameSize, 1, (uint8_t)(random() % TASK_COUNT));
+            if (frame == nullptr)
+            {
+                CHECK(LOG_BACKTRACE_HEADER_SIZE + frameSize > capacity / 4, "round %d: frame of %zu bytes refused", round, frameSize);
+                continue;
+            }
+            logFramePutU32(frame, next);
+            memset(frame + 4, (uint8_t)next, frameSize - 4);
+            next++;
+        }
+    }
+}
+
+struct Record {
+    uint32_t id;
+    uint64_t monotonicUs;
+    int level;
+    uint8_t task;
+};
+
+// Encodes a record as the TEXT frame AdvancedLogger saves, whose message is the id of the record
+static std::vector<uint8_t> encodeRecord(const Record &record)
+{
+    uint8_t payload[LOG_TEXT_PREFIX_SIZE + 4] = {};
+    logFramePutU64(payload + 8, record.monotonicUs);
+    payload[16] = record.task;
+    logFramePutU32(payload + LOG_TEXT_PREFIX_SIZE, record.id);
+    std::vector<uint8_t> frame(sizeof(payload) + LOG_FRAME_OVERHEAD);
+    logFrameEncode(frame.data(), LogFrameType::TEXT, payload, sizeof(payload));
+    return frame;
+}
+
+// A log of two tiers, in which the records are saved as AdvancedLogger::_save() saves them
+struct TieredLog {
+    LogBacktraceRing ring;
+    std::vector<uint32_t> tiers[2]; // Ids of the records saved
+    uint64_t lastMonotonicUs[2] = {0, 0};
+    int saveLevel = 3;
+    int triggerLevel = 4;
+    int criticalLevel = 4;
+    size_t maxRecords = 6;
+    bool allTasks = false;
+    int corrupted = 0;
+
+    int tierOf(int level) const { return level >= criticalLevel ? 1 : 0; }
+
+    void saveRecord(const Record &record)
+    {
+        std::vector<uint8_t> frame = encodeRecord(record);
+        if (record.level < saveLevel)
+        {
+            uint8_t *destination = ring.reserve(frame.size(), (uint8_t)record.level, record.task);
+            if (destination != nullptr) memcpy(destination, frame.data(), frame.size());
+            return;
+        }
+        if (record.level >= triggerLevel && ring.count() > 0)
+        {
+            ring.takeInOrder(
+                allTasks ? LOG_BACKTRACE_ALL_TASKS : record.task,
+                maxRecords,
+                [this](uint8_t level) { return tierOf(level); },
+                [this](int tier) -> uint64_t & { return lastMonotonicUs[tier]; },
+                [this](int tier, uint8_t, const uint8_t *saved, size_t frameSize) {
+                    if (logFrameValidate(saved, frameSize) != frameSize) corrupted++;
+                    tiers[tier].push_back(logFrameGetU32(saved + LOG_FRAME_HEADER_SIZE + LOG_TEXT_PREFIX_SIZE));
+                    return true;
+                });
+        }
+        int tier = tierOf(record.level);
+        tiers[tier].push_back(record.id);
+        if (record.monotonicUs > lastMonotonicUs[tier]) lastMonotonicUs[tier] = record.monotonicUs;
+    }
+};
+
+static void testOrder(std::mt19937 &random)
+{
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        TieredLog log;
+        log.ring.begin(256 + random() % 4096);
+        log.allTasks = random() % 2;
+        log.maxRecords = 1 + random() % 10;
+
+        std::vector<Record> logged;
+        uint64_t monotonicUs = 0;
+        for (uint32_t id = 0; id < OPERATIONS; id++)
+        {
+            int draw = random() % 100;
+            Record record = {id, monotonicUs += 1 + random() % 1000, draw < 80 ? 1 : draw < 95 ? 3 : 4, (uint8_t)(random() % TASK_COUNT)};
+            logged.push_back(record);
+            log.saveRecord(record);
+        }
+
+        CHECK(log.corrupted == 0, "round %d: %d frames corrupted in the ring", round, log.corrupted);
+        std::set<uint32_t> saved;
+        for (int tier = 0; tier < 2; tier++)
+        {
+            for (size_t i = 0; i < log.tiers[tier].size(); i++)
+            {
+                const Record &record = logged[log.tiers[tier][i]];
+                CHECK(i == 0 || record.monotonicUs >= logged[log.tiers[tier][i - 1]].monotonicUs,
+                      "round %d: record %u saved after a newer one in tier %d", round, record.id, tier);
+                CHECK(saved.insert(record.id).second, "round %d: record %u saved twice", round, record.id);
+            }
+        }
+
+        // A trigger following a record kept in RAM, with nothing saved in between, saves it
+        for (size_t i = 1; i < logged.size(); i++)
+        {
+            const Record &trigger = logged[i];
+            const Record &kept = logged[i - 1];
+            if (trigger.level < log.triggerLevel || kept.level >= log.saveLevel) continue;
+            if (!log.allTasks && kept.task != trigger.task) continue;
+            CHECK(saved.count(kept.id) == 1, "round %d: record %u kept right before trigger %u not saved", round, kept.id, trigger.id);
+        }
+    }
+}
+
+int main()
+{
+    std::mt19937 random(7);
+    testRing(random);
+    testOrder(random);
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed: %d rings, %d tiered logs\n", ROUNDS, ROUNDS);
+    return 0;
+}
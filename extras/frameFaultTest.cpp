@@ -0,0 +1,431 @@
+/*
+ * File: frameFaultTest.cpp
+ * ------------------------
+ * Host fault-injection test of the log files (see src/LogFile.h) and of the recovery done at
+ * begin(): the power is lost at random points of the writes and of the rotations, and the
+ * recovery must keep every complete record and drop the torn one.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build and run on the host (not part of the Arduino library build):
+ *   g++ -O2 -std=c++17 -o frameFaultTest extras/frameFaultTest.cpp && ./frameFaultTest
+ *
+ * The functions of LogFile.h used by AdvancedLogger on SPIFFS run here on MemoryFs, a filesystem
+ * in memory with the same semantics (rename() fails if the destination exists), which can lose
+ * the power after a given number of bytes written and of files created, removed or renamed.
+ * After the loss nothing else reaches the files, and the bytes of the write in progress may also
+ * read back as erased flash (0xFF), zeros, random bytes, or end with two bytes which read as a
+ * trailer pointing back to the last complete record, which must not make the torn bytes valid. The files are then recovered as at
+ * begin(), by logFileRecoverRotation() and logFileRecoverTail().
+ *
+ * Each round writes a segment (its header, then one record per write, as a flush of a single
+ * record does), loses the power in the middle, and checks that the recovered segment holds exactly
+ * the complete records, that a recovery itself cut by a power loss is finished by the next one,
+ * that a record corrupted in the middle of the segment is skipped by the readers, and that the
+ * records appended after the recovery are read back. Then segments are trimmed through a temporary
+ * file as _trimSegment() does, closed ones keeping a summary of the records left, losing the power
+ * after each possible step: the recovered segment must always be either the complete original or
+ * the complete trimmed one.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/LogFile.h"
+
+constexpr int ROUNDS = 20000;
+constexpr int TRIM_ROUNDS = 300;
+constexpr int MAX_RECORDS = 40;
+constexpr const char *SEGMENT_PATH = "/AdvancedLogger/log.txt.00";
+
+using Bytes = std::vector<uint8_t>;
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                          \
+    do                                                 \
+    {                                                  \
+        if (!(condition))                              \
+        {                                              \
+            failures++;                                \
+            fprintf(stderr, __VA_ARGS__);              \
+            fprintf(stderr, " (line %d)\n", __LINE__); \
+        }                                              \
+    } while (0)
+
+enum class TornFill {
+    WRITTEN, // The bytes of the torn write read back as they were written
+    ERASED,  // As erased flash
+    ZEROS,
+    RANDOM,
+    POINTING // Cut right after two bytes which read as the length of the frame ending before the write
+};
+
+struct MemoryFs;
+
+// A file of MemoryFs, with the methods of the Arduino File used by LogFile.h
+struct MemoryFile {
+    MemoryFs *fileSystem = nullptr;
+    std::string path;
+    size_t offset = 0;
+
+    explicit operator bool() const { return fileSystem != nullptr; }
+    Bytes &content() const;
+    size_t size() const { return content().size(); }
+    size_t position() const { return offset; }
+    int available() const { return (int)(size() - offset); }
+    void close() { fileSystem = nullptr; }
+
+    bool seek(size_t position)
+    {
+        if (position > size()) return false;
+        offset = position;
+        return true;
+    }
+
+    size_t read(uint8_t *buffer, size_t length)
+    {
+        size_t count = std::min(length, size() - offset);
+        memcpy(buffer, content().data() + offset, count);
+        offset += count;
+        return count;
+    }
+
+    size_t write(const uint8_t *buffer, size_t length);
+};
+
+// A filesystem in memory, with the methods of the Arduino FS used by LogFile.h
+struct MemoryFs {
+    std::map<std::string, Bytes> files;
+    long budget = -1; // Bytes and operations left before the power is lost, -1 if it is never lost
+    TornFill fill = TornFill::WRITTEN;
+    std::mt19937 *random = nullptr;
+
+    bool powered() const { return budget != 0; }
+
+    // Spends the budget of an operation, returning whether it happens
+    bool operation()
+    {
+        if (budget == 0) return false;
+        if (budget > 0) budget--;
+        return true;
+    }
+
+    bool exists(const std::string &path) const { return files.count(path) > 0; }
+
+    MemoryFile open(const std::string &path, const char *mode)
+    {
+        MemoryFile file;
+        if (mode[0] == 'r')
+        {
+            if (!exists(path)) return file;
+        }
+        else if (mode[0] == 'w' || !exists(path))
+        {
+            if (!operation()) return file;
+            files[path].clear();
+        }
+        file.fileSystem = this;
+        file.path = path;
+        if (mode[0] == 'a') file.offset = files[path].size();
+        return file;
+    }
+
+    bool remove(const std::string &path)
+    {
+        if (!exists(path) || !operation()) return false;
+        files.erase(path);
+        return true;
+    }
+
+    bool rename(const std::string &from, const std::string &to)
+    {
+        if (!exists(from) || exists(to) || !operation()) return false;
+        files[to] = files[from];
+        files.erase(from);
+        return true;
+    }
+};
+
+Bytes &MemoryFile::content() const { return fileSystem->files[path]; }
+
+size_t MemoryFile::write(const uint8_t *buffer, size_t length)
+{
+    if (!fileSystem->powered()) return 0;
+    size_t count = length;
+    bool torn = fileSystem->budget > 0 && (long)length > fileSystem->budget;
+    if (torn) count = (size_t)fileSystem->budget;
+    if (fileSystem->budget > 0) fileSystem->budget -= count;
+
+    Bytes &bytes = content();
+    if (offset + count > bytes.size()) bytes.resize(offset + count);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t byte = buffer[i];
+        if (torn && fileSystem->fill == TornFill::ERASED) byte = 0xFF;
+        if (torn && fileSystem->fill == TornFill::ZEROS) byte = 0x00;
+        if (torn && fileSystem->fill == TornFill::RANDOM) byte = (uint8_t)(*fileSystem->random)();
+        bytes[offset + i] = byte;
+    }
+    if (torn && fileSystem->fill == TornFill::POINTING && count >= LOG_FRAME_TRAILER_SIZE && offset >= LOG_FRAME_OVERHEAD)
+    {
+        size_t previousLength = logFrameGetU16(&bytes[offset - LOG_FRAME_TRAILER_SIZE]);
+        logFramePutU16(&bytes[offset + count - LOG_FRAME_TRAILER_SIZE], (uint16_t)(previousLength + count));
+    }
+    offset += count;
+    return count;
+}
+
+// Recovers a segment as _loadSegments() does at begin()
+static LogTailRecovery recover(MemoryFs &fileSystem)
+{
+    size_t droppedBytes;
+    logFileRecoverRotation(fileSystem, std::string(SEGMENT_PATH));
+    return logFileRecoverTail(fileSystem, std::string(SEGMENT_PATH), droppedBytes);
+}
+
+static Bytes encodeFrame(LogFrameType type, const Bytes &payload)
+{
+    Bytes frame(payload.size() + LOG_FRAME_OVERHEAD);
+    frame.resize(logFrameEncode(frame.data(), type, payload.data(), payload.size()));
+    return frame;
+}
+
+static Bytes randomRecord(std::mt19937 &random)
+{
+    size_t length = LOG_TEXT_PREFIX_SIZE + random() % (random() % 8 == 0 ? LOG_FRAME_MAX_PAYLOAD - LOG_TEXT_PREFIX_SIZE : 200);
+    Bytes payload(length);
+    // Payloads full of sync bytes make the resynchronization try many false starts
+    bool syncs = random() % 4 == 0;
+    for (uint8_t &byte : payload) byte = syncs && random() % 2 ? LOG_FRAME_SYNC : (uint8_t)random();
+    LogFrameType types[] = {LogFrameType::TEXT, LogFrameType::BYTES, LogFrameType::FIELDS, LogFrameType::SPAN};
+    return encodeFrame(types[random() % 4], payload);
+}
+
+// Reads all the frames of the segment with logFileReadFrame(), as dump() does
+static std::vector<Bytes> readFrames(MemoryFs &fileSystem)
+{
+    std::vector<Bytes> frames;
+    MemoryFile file = fileSystem.open(SEGMENT_PATH, "r");
+    if (!file) return frames;
+    uint8_t frame[LOG_FRAME_MAX_SIZE];
+    size_t frameSize;
+    while ((frameSize = logFileReadFrame(file, frame)) > 0) frames.emplace_back(frame, frame + frameSize);
+    return frames;
+}
+
+// Checks that the segment holds its header followed by the expected records
+static void checkSegment(MemoryFs &fileSystem, const Bytes &header, const std::vector<Bytes> &records, const char *what, int round)
+{
+    std::vector<Bytes> frames = readFrames(fileSystem);
+    CHECK(frames.size() == records.size() + 1, "round %d: %s holds %zu frames instead of %zu", round, what, frames.size(), records.size() + 1);
+    CHECK(!frames.empty() && frames[0] == header, "round %d: %s lost its header", round, what);
+    for (size_t i = 1; i < frames.size() && i <= records.size(); i++)
+    {
+        CHECK(frames[i] == records[i - 1], "round %d: %s record %zu differs", round, what, i - 1);
+    }
+
+    MemoryFile file = fileSystem.open(SEGMENT_PATH, "r");
+    CHECK(file && logFileFindValidEnd(file) == file.size(), "round %d: %s does not end with a valid record", round, what);
+    CHECK(!fileSystem.exists(std::string(SEGMENT_PATH) + LOG_TEMP_FILE_SUFFIX), "round %d: %s left its temporary file", round, what);
+}
+
+static void testTornWrites(std::mt19937 &random)
+{
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        MemoryFs fileSystem;
+        fileSystem.random = &random;
+
+        MemoryFile file = fileSystem.open(SEGMENT_PATH, "w");
+        logFileWriteSegmentHeader(file, (uint32_t)round);
+        Bytes header = fileSystem.files[SEGMENT_PATH];
+
+        std::vector<Bytes> records;
+        size_t total = 0;
+        for (int i = random() % MAX_RECORDS; i > 0; i--)
+        {
+            records.push_back(randomRecord(random));
+            total += records.back().size();
+        }
+
+        // The power is lost somewhere in the writes, the records before that being complete
+        fileSystem.budget = total > 0 ? 1 + random() % total : -1;
+        fileSystem.fill = (TornFill)(random() % 5);
+        std::vector<Bytes> complete;
+        bool torn = false;
+        for (const Bytes &record : records)
+        {
+            size_t written = file.write(record.data(), record.size());
+            if (written == record.size()) complete.push_back(record);
+            else torn = torn || written > 0;
+        }
+        file.close();
+
+        // The recovery itself may be cut by another power loss, and is then done again
+        fileSystem.budget = random() % 2 ? (long)(random() % (fileSystem.files[SEGMENT_PATH].size() + 4)) : -1;
+        LogTailRecovery result = recover(fileSystem);
+        if (fileSystem.budget < 0)
+        {
+            CHECK(result == (torn ? LogTailRecovery::RECOVERED : LogTailRecovery::INTACT),
+                  "round %d: recovery returned %d with%s torn bytes", round, (int)result, torn ? "" : "out");
+        }
+        fileSystem.budget = -1;
+        recover(fileSystem);
+        checkSegment(fileSystem, header, complete, "recovered segment", round);
+        if (!fileSystem.exists(SEGMENT_PATH)) continue;
+
+        // A record corrupted in the middle of the segment is skipped, the others are still read
+        if (complete.size() > 1)
+        {
+            size_t index = random() % (complete.size() - 1);
+            size_t offset = header.size();
+            for (size_t i = 0; i < index; i++) offset += complete[i].size();
+            Bytes &bytes = fileSystem.files[SEGMENT_PATH];
+            bytes[offset + random() % complete[index].size()] ^= (uint8_t)(1 + random() % 255);
+
+            std::vector<Bytes> expected = complete;
+            expected.erase(expected.begin() + index);
+            std::vector<Bytes> frames = readFrames(fileSystem);
+            CHECK(frames.size() == expected.size() + 1 && std::equal(expected.begin(), expected.end(), frames.begin() + 1),
+                  "round %d: corrupted record %zu not skipped", round, index);
+
+            // The corrupted record is then removed, so that the appends below start from a valid end
+            complete = expected;
+            bytes = header;
+            for (const Bytes &record : complete) bytes.insert(bytes.end(), record.begin(), record.end());
+        }
+
+        // The records saved after the recovery follow the ones kept
+        file = fileSystem.open(SEGMENT_PATH, "a");
+        for (int i = random() % 4; i > 0; i--)
+        {
+            complete.push_back(randomRecord(random));
+            file.write(complete.back().data(), complete.back().size());
+        }
+        file.close();
+        checkSegment(fileSystem, header, complete, "appended segment", round);
+    }
+}
+
+// Trims the segment to its last records, as _trimSegment() does
+static void trimSegment(MemoryFs &fileSystem, uint32_t sequence, size_t linesToKeep)
+{
+    std::string path = SEGMENT_PATH;
+    MemoryFile sourceFile = fileSystem.open(path, "r");
+    LogSegmentSummary summary;
+    bool closed = logFileReadSegmentSummary(sourceFile, summary);
+    size_t recordsEnd = sourceFile.size() - (closed ? LOG_SUMMARY_FRAME_SIZE : 0);
+
+    size_t linesKept = 0;
+    size_t cutOffset = logFileFindCutOffset(sourceFile, recordsEnd, linesToKeep, LOG_SEGMENT_FRAME_SIZE, linesKept);
+    logFileScanRecords(sourceFile, cutOffset, recordsEnd, summary);
+
+    MemoryFile tempFile = fileSystem.open(path + LOG_TEMP_FILE_SUFFIX, "w");
+    if (!tempFile) return;
+    bool copied = logFileWriteSegmentHeader(tempFile, sequence) &&
+                  logFileCopyRange(sourceFile, tempFile, cutOffset, recordsEnd) &&
+                  (!closed || logFileWriteSegmentSummary(tempFile, summary));
+    sourceFile.close();
+    tempFile.close();
+
+    if (!copied)
+    {
+        fileSystem.remove(path + LOG_TEMP_FILE_SUFFIX);
+        return;
+    }
+    logFileCommitTemp(fileSystem, path);
+}
+
+static int testTrims(std::mt19937 &random)
+{
+    int interrupted = 0;
+    for (int round = 0; round < TRIM_ROUNDS; round++)
+    {
+        MemoryFs original;
+        MemoryFile file = original.open(SEGMENT_PATH, "w");
+        logFileWriteSegmentHeader(file, (uint32_t)round);
+        std::vector<Bytes> records;
+        for (int i = 1 + random() % 12; i > 0; i--)
+        {
+            records.push_back(randomRecord(random));
+            file.write(records.back().data(), records.back().size());
+        }
+        file.close();
+
+        // Half of the segments are closed, as the ones no longer written to
+        bool closed = random() % 2 == 0;
+        LogSegmentSummary summary;
+        if (closed)
+        {
+            file = original.open(SEGMENT_PATH, "r");
+            logFileScanRecords(file, LOG_SEGMENT_FRAME_SIZE, file.size(), summary);
+            file.close();
+            CHECK(summary.lines == records.size(), "round %d: scan counted %u records instead of %zu", round, summary.lines, records.size());
+            file = original.open(SEGMENT_PATH, "a");
+            logFileWriteSegmentSummary(file, summary);
+            file.close();
+        }
+        size_t linesToKeep = random() % 12;
+
+        MemoryFs trimmed = original;
+        trimSegment(trimmed, (uint32_t)round, linesToKeep);
+        const Bytes &before = original.files[SEGMENT_PATH];
+        const Bytes &after = trimmed.files[SEGMENT_PATH];
+
+        // The latest records are kept, followed by a summary of them if the segment was closed
+        std::vector<Bytes> kept(records.end() - std::min(linesToKeep, records.size()), records.end());
+        std::vector<Bytes> frames = readFrames(trimmed);
+        if (closed && !frames.empty() && frames.back()[1] == (uint8_t)LogFrameType::SUMMARY) frames.pop_back();
+        CHECK(frames.size() == kept.size() + 1 && std::equal(kept.begin(), kept.end(), frames.begin() + 1),
+              "round %d: trim kept %zu frames instead of %zu records", round, frames.size() - 1, kept.size());
+        file = trimmed.open(SEGMENT_PATH, "r");
+        LogSegmentSummary trimmedSummary;
+        bool trimmedClosed = logFileReadSegmentSummary(file, trimmedSummary);
+        CHECK(trimmedClosed == closed, "round %d: trim %s the summary", round, closed ? "dropped" : "added");
+        CHECK(!closed || trimmedSummary.lines == kept.size(), "round %d: summary counts %u records instead of %zu", round, trimmedSummary.lines, kept.size());
+        file.close();
+
+        // Every byte and operation of the trim is a point where the power can be lost
+        for (long budget = 0; budget <= (long)(after.size() + 4); budget++)
+        {
+            MemoryFs fileSystem = original;
+            fileSystem.random = &random;
+            fileSystem.fill = (TornFill)(random() % 5);
+            fileSystem.budget = budget;
+            trimSegment(fileSystem, (uint32_t)round, linesToKeep);
+            fileSystem.budget = -1;
+            recover(fileSystem);
+            interrupted++;
+
+            CHECK(fileSystem.exists(SEGMENT_PATH), "round %d: trim stopped after %ld units left no segment", round, budget);
+            const Bytes &content = fileSystem.files[SEGMENT_PATH];
+            CHECK(content == before || content == after, "round %d: trim stopped after %ld units left a partial segment", round, budget);
+            CHECK(!fileSystem.exists(std::string(SEGMENT_PATH) + LOG_TEMP_FILE_SUFFIX), "round %d: trim stopped after %ld units left its temporary file", round, budget);
+        }
+    }
+    return interrupted;
+}
+
+int main()
+{
+    std::mt19937 random(42);
+    testTornWrites(random);
+    int interrupted = testTrims(random);
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed: %d torn writes, %d interrupted trims\n", ROUNDS, interrupted);
+    return 0;
+}
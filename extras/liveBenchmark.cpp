@@ -0,0 +1,161 @@
+/*
+ * File: liveBenchmark.cpp
+ * -----------------------
+ * Host benchmark of the LogLiveRing fanning out records to local socket clients, one of them slow.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build and run on Linux (not part of the Arduino library build):
+ *   g++ -O2 -std=c++17 -pthread -o liveBenchmark extras/liveBenchmark.cpp && ./liveBenchmark
+ *
+ * A producer writes numbered records to the ring in bursts, while each subscriber reads the
+ * ring through its own cursor and sends the lines to its client over a socket pair, as a TCP
+ * console would. One client reads slowly, so that its subscriber falls behind and is skipped
+ * forward with gap lines. Every client must then see the records in order, and account for
+ * all of them, either received or reported as skipped.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/LogLiveRing.h"
+
+constexpr int RECORD_COUNT = 200000;
+constexpr int BURST_SIZE = 20; // Records written between two pauses of 1 ms, about 20000 records per second
+constexpr size_t RING_SIZE = 8192;
+constexpr int CLIENT_COUNT = 4;
+constexpr int SLOW_CLIENT = CLIENT_COUNT - 1;
+constexpr const char *GAP_FORMAT = "[... %u records skipped ...]";
+
+struct ClientResult {
+    long received = 0;
+    long skipped = 0;
+    long gaps = 0;
+    bool ordered = true;
+};
+
+int main()
+{
+    LogLiveRing ring;
+    if (!ring.begin(RING_SIZE))
+    {
+        printf("Failed to allocate the ring\n");
+        return 1;
+    }
+
+    std::atomic<bool> producing{true};
+    std::vector<std::thread> threads;
+    ClientResult results[CLIENT_COUNT];
+
+    for (int client = 0; client < CLIENT_COUNT; client++)
+    {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+        {
+            printf("Failed to create a socket pair\n");
+            return 1;
+        }
+        LogLiveCursor cursor = ring.subscribe(false);
+
+        // Subscriber: reads the ring and writes the lines to its socket
+        threads.emplace_back([&ring, &producing, cursor, socket = sockets[0]]() mutable {
+            char line[256];
+            while (true)
+            {
+                bool done = !producing.load();
+                uint32_t skipped;
+                size_t length = ring.read(cursor, line, sizeof(line) - 1, skipped);
+                if (skipped > 0) length = snprintf(line, sizeof(line) - 1, GAP_FORMAT, skipped);
+                if (length == 0)
+                {
+                    if (done) break;
+                    std::this_thread::yield();
+                    continue;
+                }
+                line[length++] = '\n';
+                if (write(socket, line, length) != (ssize_t)length) break;
+            }
+            close(socket);
+        });
+
+        // Client: parses the lines, checking that the records come in order
+        threads.emplace_back([client, &results, socket = sockets[1]]() {
+            ClientResult &result = results[client];
+            std::string pending;
+            char chunk[4096];
+            long expected = 0;
+            ssize_t received;
+            while ((received = read(socket, chunk, client == SLOW_CLIENT ? 64 : sizeof(chunk))) > 0)
+            {
+                if (client == SLOW_CLIENT) std::this_thread::sleep_for(std::chrono::microseconds(50));
+                pending.append(chunk, received);
+                size_t newline;
+                while ((newline = pending.find('\n')) != std::string::npos)
+                {
+                    std::string line = pending.substr(0, newline);
+                    pending.erase(0, newline + 1);
+                    unsigned int value;
+                    if (sscanf(line.c_str(), "[... %u records skipped ...]", &value) == 1)
+                    {
+                        result.gaps++;
+                        result.skipped += value;
+                        expected += value;
+                    }
+                    else if (sscanf(line.c_str(), "record %u", &value) == 1)
+                    {
+                        if ((long)value != expected) result.ordered = false;
+                        result.received++;
+                        expected = value + 1;
+                    }
+                }
+            }
+            close(socket);
+        });
+    }
+
+    // The writes are serialized by a mutex, as AdvancedLogger does with its lock
+    std::mutex writeMutex;
+    std::chrono::duration<double, std::nano> elapsed{0};
+    for (int i = 0; i < RECORD_COUNT; i++)
+    {
+        char record[128];
+        int length = snprintf(record, sizeof(record), "record %d [2024-03-23 09:44:10] [1 450 ms] [INFO    ] [Core 1] [main::loop] message task=loopTask", i);
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            ring.write(record, length);
+        }
+        elapsed += std::chrono::steady_clock::now() - start;
+        if (i % BURST_SIZE == BURST_SIZE - 1) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    producing.store(false);
+    for (std::thread &thread : threads) thread.join();
+
+    printf("producer: %.1f ns per write, %d records\n", elapsed.count() / RECORD_COUNT, RECORD_COUNT);
+    printf("%-8s %10s %10s %8s %8s\n", "client", "received", "skipped", "gaps", "ordered");
+    bool valid = true;
+    for (int client = 0; client < CLIENT_COUNT; client++)
+    {
+        const ClientResult &result = results[client];
+        printf("%-8s %10ld %10ld %8ld %8s\n", client == SLOW_CLIENT ? "slow" : std::to_string(client).c_str(), result.received, result.skipped, result.gaps, result.ordered ? "yes" : "no");
+        valid = valid && result.ordered && result.received + result.skipped == RECORD_COUNT;
+    }
+    if (!valid)
+    {
+        printf("Some records were lost without a gap, or came out of order\n");
+        return 1;
+    }
+    return 0;
+}
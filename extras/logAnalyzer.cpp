@@ -0,0 +1,391 @@
+/*
+ * File: logAnalyzer.cpp
+ * ---------------------
+ * Host tool parsing downloaded logs, text or binary, into the columns of LOG_FORMAT, with filters
+ * on the level, the function and the time, and parsing the files in parallel.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build on Linux or macOS (not part of the Arduino library build):
+ *   g++ -O2 -march=native -std=c++17 -pthread -o logAnalyzer extras/logAnalyzer.cpp
+ *
+ * Usage:
+ *   logAnalyzer [--level LEVEL] [--function TEXT] [--from TIME] [--to TIME] [--count] [--threads N] [--stats] FILE...
+ *
+ *   --level LEVEL     only keep the records at or above the level (e.g. WARNING)
+ *   --function TEXT   only keep the records whose function contains the text
+ *   --from, --to TIME only keep the records dated within the range, inclusive, given either as
+ *                     unix seconds or as "YYYY-MM-DD HH:MM:SS"
+ *   --count           print the number of records per level and the 20 busiest (function, level)
+ *                     pairs, instead of the records
+ *   --threads N       number of parsing threads, all the cores by default
+ *   --stats           print the number of bytes and records parsed, and the throughput, to stderr
+ *
+ * Each FILE is either a text log, as printed by dump() or captured from the Serial, or a binary
+ * segment file copied from the SPIFFS ("log.txt.00"), whose .time and .tasks files are read too
+ * if they are next to it. The records are printed as tab-separated columns: file, timestamp,
+ * uptime in ms, task, level, core, function and message, in the order of the files. The
+ * timestamps of the text logs are compared to --from and --to as written, that is in the time
+ * zone of the device, while the binary records are dated and printed in UTC.
+ *
+ * The files are split into chunks of about CHUNK_SIZE bytes at line boundaries, which a pool of
+ * threads parses in any order, while the output of the chunks is written in order.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "LogParser.h"
+
+constexpr size_t CHUNK_SIZE = 8 * 1024 * 1024;
+constexpr size_t CHUNKS_AHEAD_PER_THREAD = 4; // Chunks parsed ahead of the output, bounding the memory used
+constexpr size_t TOP_FUNCTION_COUNT = 20;
+
+struct Options {
+    int minLevel = LOG_PARSER_UNKNOWN_LEVEL;
+    std::string function;
+    int64_t fromUs = -1;
+    int64_t toUs = -1;
+    bool count = false;
+    bool stats = false;
+    unsigned int threads = 0;
+};
+
+struct Chunk {
+    size_t file;
+    size_t begin;
+    size_t end;
+};
+
+// The functions point into the mapped files, which stay mapped until the end
+struct FunctionKey {
+    std::string_view function;
+    int level;
+
+    bool operator==(const FunctionKey &other) const { return level == other.level && function == other.function; }
+};
+
+struct FunctionKeyHash {
+    size_t operator()(const FunctionKey &key) const { return std::hash<std::string_view>()(key.function) * 8 + key.level; }
+};
+
+struct Counts {
+    uint64_t records = 0;
+    uint64_t unparsed = 0; // Text lines which are not records, such as the continuations of multi-line messages
+    uint64_t corrupted = 0; // Invalid binary frames skipped
+    uint64_t levels[LOG_PARSER_LEVEL_COUNT + 1] = {}; // The last one counts the unknown levels
+    std::unordered_map<FunctionKey, uint64_t, FunctionKeyHash> functions;
+
+    void merge(const Counts &other)
+    {
+        records += other.records;
+        unparsed += other.unparsed;
+        corrupted += other.corrupted;
+        for (int i = 0; i <= LOG_PARSER_LEVEL_COUNT; i++) levels[i] += other.levels[i];
+        for (const auto &function : other.functions) functions[function.first] += function.second;
+    }
+};
+
+static int64_t parseTime(const char *text)
+{
+    char *end;
+    long long seconds = strtoll(text, &end, 10);
+    if (*end != '\0') seconds = logParserParseTimestamp(text, strlen(text));
+    return seconds >= 0 ? seconds * 1000000 : -1;
+}
+
+static bool keep(const LogParsedRecord &record, const Options &options)
+{
+    if (record.level < options.minLevel) return false;
+    if ((options.fromUs >= 0 || options.toUs >= 0) && record.timeUs < 0) return false;
+    if (options.fromUs >= 0 && record.timeUs < options.fromUs) return false;
+    if (options.toUs >= 0 && record.timeUs >= options.toUs + 1000000) return false;
+    if (!options.function.empty() && memmem(record.function, record.functionLength, options.function.data(), options.function.size()) == nullptr) return false;
+    return true;
+}
+
+// Appends a number without going through a temporary string
+static void appendNumber(std::string &output, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) output += digits[--count];
+}
+
+// Appends a column, replacing the tabs and newlines which would break the row
+static void appendColumn(std::string &output, const char *text, size_t length)
+{
+    size_t start = output.size();
+    output.append(text, length);
+    if (memchr(text, '\t', length) == nullptr && memchr(text, '\n', length) == nullptr) return;
+    for (size_t i = start; i < output.size(); i++)
+    {
+        if (output[i] == '\t' || output[i] == '\n') output[i] = ' ';
+    }
+}
+
+static void appendRecord(std::string &output, const std::string &path, const LogParsedRecord &record)
+{
+    output += path;
+    output += '\t';
+    appendColumn(output, record.timestamp, record.timestampLength);
+    output += '\t';
+    appendNumber(output, record.millis);
+    output += '\t';
+    appendColumn(output, record.task, record.taskLength);
+    output += '\t';
+    output += record.level != LOG_PARSER_UNKNOWN_LEVEL ? LOG_PARSER_LEVELS[record.level] : "UNKNOWN";
+    output += '\t';
+    appendNumber(output, record.core);
+    output += '\t';
+    appendColumn(output, record.function, record.functionLength);
+    output += '\t';
+    if (record.bytes != nullptr)
+    {
+        logParserAppendHex(output, record.bytes, record.bytesLength);
+    }
+    else
+    {
+        appendColumn(output, record.message, record.messageLength);
+    }
+    if (record.fields != nullptr)
+    {
+        size_t start = output.size();
+        logParserAppendFields(output, record.fields, record.fieldsLength);
+        for (size_t i = start; i < output.size(); i++)
+        {
+            if (output[i] == '\t') output[i] = ' ';
+        }
+    }
+    output += '\n';
+}
+
+static void handleRecord(const LogParsedRecord &record, const Options &options, const std::string &path, std::string &output, Counts &counts)
+{
+    if (!keep(record, options)) return;
+    counts.records++;
+    if (!options.count)
+    {
+        appendRecord(output, path, record);
+        return;
+    }
+    counts.levels[record.level != LOG_PARSER_UNKNOWN_LEVEL ? record.level : LOG_PARSER_LEVEL_COUNT]++;
+    counts.functions[FunctionKey{std::string_view(record.function, record.functionLength), record.level}]++;
+}
+
+static void parseChunk(const LogMappedFile &file, const std::string &path, const Chunk &chunk, const Options &options, std::string &output, Counts &counts)
+{
+    LogParsedRecord record;
+    if (LogBinaryReader::isBinary(file.data(), file.size()))
+    {
+        LogBinaryReader reader;
+        reader.loadLog(path);
+        reader.begin(file.data(), file.size());
+        while (reader.next(record)) handleRecord(record, options, path, output, counts);
+        counts.corrupted += reader.corrupted();
+        return;
+    }
+
+    const char *cursor = file.data() + chunk.begin;
+    const char *end = file.data() + chunk.end;
+    while (cursor < end)
+    {
+        const char *newline = logParserFindNewline(cursor, end);
+        if (logParserParseLine(cursor, newline - cursor, record))
+        {
+            handleRecord(record, options, path, output, counts);
+        }
+        else if (newline > cursor)
+        {
+            counts.unparsed++;
+        }
+        cursor = newline + 1;
+    }
+}
+
+static void printUsage()
+{
+    fprintf(stderr, "Usage: logAnalyzer [--level LEVEL] [--function TEXT] [--from TIME] [--to TIME] [--count] [--threads N] [--stats] FILE...\n");
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (argument == "--count") options.count = true;
+        else if (argument == "--stats") options.stats = true;
+        else if (argument == "--level" && hasValue)
+        {
+            const char *level = argv[++i];
+            options.minLevel = logParserLevel(level, strlen(level));
+            if (options.minLevel == LOG_PARSER_UNKNOWN_LEVEL)
+            {
+                fprintf(stderr, "Unknown level: %s\n", level);
+                return 1;
+            }
+        }
+        else if (argument == "--function" && hasValue) options.function = argv[++i];
+        else if ((argument == "--from" || argument == "--to") && hasValue)
+        {
+            int64_t timeUs = parseTime(argv[++i]);
+            if (timeUs < 0)
+            {
+                fprintf(stderr, "Invalid time: %s\n", argv[i]);
+                return 1;
+            }
+            (argument == "--from" ? options.fromUs : options.toUs) = timeUs;
+        }
+        else if (argument == "--threads" && hasValue) options.threads = (unsigned int)atoi(argv[++i]);
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            printUsage();
+            return 1;
+        }
+        else paths.push_back(argument);
+    }
+    if (paths.empty())
+    {
+        printUsage();
+        return 1;
+    }
+    if (options.threads == 0) options.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // The files stay mapped until the end, as the parsed records point into them
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<LogMappedFile>> files;
+    std::vector<Chunk> chunks;
+    size_t totalSize = 0;
+    for (size_t index = 0; index < paths.size(); index++)
+    {
+        files.emplace_back(new LogMappedFile());
+        LogMappedFile &file = *files.back();
+        if (!file.open(paths[index].c_str()))
+        {
+            fprintf(stderr, "Failed to open %s\n", paths[index].c_str());
+            continue;
+        }
+        totalSize += file.size();
+        if (file.size() == 0) continue;
+
+        // Binary files are small, and read whole as their frames cannot be split at newlines
+        if (LogBinaryReader::isBinary(file.data(), file.size()))
+        {
+            chunks.push_back({index, 0, file.size()});
+            continue;
+        }
+        const char *end = file.data() + file.size();
+        size_t begin = 0;
+        while (begin < file.size())
+        {
+            size_t chunkEnd = std::min(begin + CHUNK_SIZE, file.size());
+            if (chunkEnd < file.size()) chunkEnd = logParserFindNewline(file.data() + chunkEnd, end) - file.data() + 1;
+            chunkEnd = std::min(chunkEnd, file.size());
+            chunks.push_back({index, begin, chunkEnd});
+            begin = chunkEnd;
+        }
+    }
+
+    std::vector<std::string> outputs(chunks.size());
+    std::vector<bool> done(chunks.size(), false);
+    std::vector<Counts> counts(options.threads);
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t nextChunk = 0;
+    size_t written = 0;
+
+    std::vector<std::thread> threads;
+    for (unsigned int thread = 0; thread < options.threads; thread++)
+    {
+        threads.emplace_back([&, thread]() {
+            while (true)
+            {
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() { return nextChunk >= chunks.size() || nextChunk < written + options.threads * CHUNKS_AHEAD_PER_THREAD; });
+                    if (nextChunk >= chunks.size()) return;
+                    index = nextChunk++;
+                }
+                const Chunk &chunk = chunks[index];
+                std::string output;
+                parseChunk(*files[chunk.file], paths[chunk.file], chunk, options, output, counts[thread]);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    outputs[index] = std::move(output);
+                    done[index] = true;
+                }
+                changed.notify_all();
+            }
+        });
+    }
+
+    // The chunks are written in order as soon as they are parsed
+    while (written < chunks.size())
+    {
+        std::string output;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return done[written]; });
+            output = std::move(outputs[written]);
+            written++;
+        }
+        changed.notify_all();
+        fwrite(output.data(), 1, output.size(), stdout);
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    Counts total;
+    for (const Counts &threadCounts : counts) total.merge(threadCounts);
+    if (options.count)
+    {
+        printf("%-10s %12s\n", "level", "records");
+        for (int level = 0; level <= LOG_PARSER_LEVEL_COUNT; level++)
+        {
+            if (total.levels[level] > 0) printf("%-10s %12llu\n", level < LOG_PARSER_LEVEL_COUNT ? LOG_PARSER_LEVELS[level] : "UNKNOWN", (unsigned long long)total.levels[level]);
+        }
+        std::vector<std::pair<uint64_t, const FunctionKey *>> functions;
+        for (const auto &function : total.functions) functions.push_back({function.second, &function.first});
+        size_t shown = std::min(functions.size(), TOP_FUNCTION_COUNT);
+        std::partial_sort(functions.begin(), functions.begin() + shown, functions.end(), [](const std::pair<uint64_t, const FunctionKey *> &a, const std::pair<uint64_t, const FunctionKey *> &b) { return a.first > b.first; });
+        printf("\n%12s %-10s %s\n", "records", "level", "function");
+        for (size_t i = 0; i < shown; i++)
+        {
+            int level = functions[i].second->level;
+            const std::string_view &function = functions[i].second->function;
+            printf("%12llu %-10s %.*s\n", (unsigned long long)functions[i].first, level != LOG_PARSER_UNKNOWN_LEVEL ? LOG_PARSER_LEVELS[level] : "UNKNOWN", (int)function.size(), function.data());
+        }
+    }
+    fflush(stdout);
+
+    if (options.stats)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "%zu files, %.1f MB, %llu records kept, %llu other lines, %llu corrupted frames, in %.3f s (%.0f MB/s, %u threads)\n",
+                paths.size(), totalSize / 1e6, (unsigned long long)total.records, (unsigned long long)total.unparsed, (unsigned long long)total.corrupted,
+                elapsed.count(), totalSize / 1e6 / elapsed.count(), options.threads);
+    }
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * File: logMerge.cpp
+ * ------------------
+ * Host tool merging several logs, of several devices or the segments and tiers of one device,
+ * into a single chronologically ordered stream in the text format of dump().
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build on Linux or macOS (not part of the Arduino library build):
+ *   g++ -O2 -march=native -std=c++17 -pthread -o logMerge extras/logMerge.cpp
+ *
+ * Usage:
+ *   logMerge [--source] [--threads N] FILE...
+ *
+ *   --source          start each record with the name of its file, "[device1.txt] [2024-...] ..."
+ *   --threads N       number of decoding threads, all the cores by default
+ *
+ * Each FILE is either a text log, as printed by dump() or captured from the Serial, or a binary
+ * segment file copied from the SPIFFS ("log.txt.00"), whose .time and .tasks files are read too
+ * if they are next to it, as in extras/logAnalyzer.cpp. Each file is expected to be in
+ * chronological order, as a dump or a segment is: the records are merged by their timestamp
+ * with a LogMergeHeap, the same heap dump() uses to merge the tiers, and the records with the
+ * same timestamp come out in the order of the files. The lines of a text log which are not
+ * records, such as the continuations of a multi-line message, stay with the record before them,
+ * and the records whose timestamp cannot be parsed keep the time of the record before them.
+ *
+ * The files are decoded by a pool of threads, BLOCK_RECORDS records at a time, into at most
+ * BLOCKS_PER_INPUT blocks per file, which the merge consumes while the next ones are decoded.
+ * The memory is thus bounded per file, whatever its size, and the pool always works on the
+ * blocks the merge is about to need.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/LogMerge.h"
+#include "LogParser.h"
+
+constexpr size_t BLOCK_RECORDS = 256;
+constexpr size_t BLOCKS_PER_INPUT = 3; // One being merged, the others decoded ahead
+constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+struct Block {
+    std::vector<int64_t> keys; // Time of each record in microseconds
+    std::vector<size_t> ends; // End of each record in text
+    std::string text; // Rendered records, each ending with a newline
+};
+
+struct Input {
+    std::string path;
+    LogMappedFile file;
+    bool binary = false;
+    LogBinaryReader reader;
+    size_t offset = 0; // Of the next line of a text log
+    int64_t lastKey = -1;
+    bool finished = false; // Whether the whole file was decoded
+
+    // Guarded by the mutex of the merge
+    std::deque<std::unique_ptr<Block>> ready;
+    std::vector<std::unique_ptr<Block>> spare;
+    size_t requested = 0; // Blocks to decode
+    bool queued = false; // Whether the input is in the work queue or being decoded
+    bool done = false; // Whether the last block was decoded
+};
+
+// Decodes the next block of an input, returning whether the input has more records
+static bool decodeBlock(Input &input, Block &block)
+{
+    block.keys.clear();
+    block.ends.clear();
+    block.text.clear();
+    LogParsedRecord record;
+
+    if (input.binary)
+    {
+        while (block.keys.size() < BLOCK_RECORDS)
+        {
+            if (!input.reader.next(record)) return false;
+            block.keys.push_back(record.timeUs);
+            logParserAppendLine(block.text, record);
+            block.ends.push_back(block.text.size());
+        }
+        return true;
+    }
+
+    const char *data = input.file.data();
+    const char *end = data + input.file.size();
+    while (input.offset < input.file.size())
+    {
+        const char *line = data + input.offset;
+        const char *newline = logParserFindNewline(line, end);
+        bool isRecord = logParserParseLine(line, newline - line, record);
+        if (isRecord && block.keys.size() == BLOCK_RECORDS) return true;
+
+        input.offset = newline - data + 1;
+        if (isRecord || block.keys.empty())
+        {
+            if (isRecord && record.timeUs >= 0) input.lastKey = record.timeUs;
+            block.keys.push_back(input.lastKey);
+            block.ends.push_back(block.text.size());
+        }
+        block.text.append(line, newline - line);
+        block.text += '\n';
+        block.ends.back() = block.text.size();
+    }
+    return false;
+}
+
+static void printUsage()
+{
+    fprintf(stderr, "Usage: logMerge [--source] [--threads N] FILE...\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool source = false;
+    unsigned int threadCount = 0;
+    std::vector<std::unique_ptr<Input>> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--source") source = true;
+        else if (argument == "--threads" && i + 1 < argc) threadCount = (unsigned int)atoi(argv[++i]);
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            printUsage();
+            return 1;
+        }
+        else
+        {
+            inputs.emplace_back(new Input());
+            inputs.back()->path = argument;
+        }
+    }
+    if (inputs.empty())
+    {
+        printUsage();
+        return 1;
+    }
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    std::mutex mutex;
+    std::condition_variable workChanged;
+    std::condition_variable blockReady;
+    std::deque<size_t> work;
+    bool stopping = false;
+
+    for (size_t index = 0; index < inputs.size(); index++)
+    {
+        Input &input = *inputs[index];
+        if (!input.file.open(input.path.c_str()))
+        {
+            fprintf(stderr, "Failed to open %s\n", input.path.c_str());
+            input.done = true;
+            continue;
+        }
+        input.binary = LogBinaryReader::isBinary(input.file.data(), input.file.size());
+        if (input.binary)
+        {
+            input.reader.loadLog(input.path);
+            input.reader.begin(input.file.data(), input.file.size());
+        }
+        for (size_t i = 0; i < BLOCKS_PER_INPUT; i++) input.spare.emplace_back(new Block());
+        input.requested = BLOCKS_PER_INPUT;
+        input.queued = true;
+        work.push_back(index);
+    }
+
+    // The decoding threads take the inputs in the order the merge asked for their blocks
+    std::vector<std::thread> threads;
+    for (unsigned int thread = 0; thread < threadCount; thread++)
+    {
+        threads.emplace_back([&]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                workChanged.wait(lock, [&]() { return stopping || !work.empty(); });
+                if (work.empty()) return;
+                Input &input = *inputs[work.front()];
+                work.pop_front();
+
+                while (input.requested > 0 && !input.finished)
+                {
+                    input.requested--;
+                    std::unique_ptr<Block> block = std::move(input.spare.back());
+                    input.spare.pop_back();
+                    lock.unlock();
+                    input.finished = !decodeBlock(input, *block);
+                    lock.lock();
+                    if (!block->keys.empty()) input.ready.push_back(std::move(block));
+                    else input.spare.push_back(std::move(block));
+                    blockReady.notify_all();
+                }
+                input.done = input.finished || input.done;
+                input.queued = false;
+                blockReady.notify_all();
+            }
+        });
+    }
+
+    // Gets the next block of an input, or nullptr once it has no more records
+    auto nextBlock = [&](size_t index, std::unique_ptr<Block> used) {
+        Input &input = *inputs[index];
+        std::unique_lock<std::mutex> lock(mutex);
+        if (used)
+        {
+            input.spare.push_back(std::move(used));
+            if (!input.done)
+            {
+                input.requested++;
+                if (!input.queued)
+                {
+                    input.queued = true;
+                    work.push_back(index);
+                    workChanged.notify_one();
+                }
+            }
+        }
+        blockReady.wait(lock, [&]() { return !input.ready.empty() || (input.done && !input.queued); });
+        std::unique_ptr<Block> block;
+        if (!input.ready.empty())
+        {
+            block = std::move(input.ready.front());
+            input.ready.pop_front();
+        }
+        return block;
+    };
+
+    std::vector<std::unique_ptr<Block>> blocks(inputs.size());
+    std::vector<size_t> positions(inputs.size(), 0);
+    LogMergeHeap<int64_t> heap;
+    heap.reserve(inputs.size());
+    for (size_t index = 0; index < inputs.size(); index++)
+    {
+        blocks[index] = nextBlock(index, nullptr);
+        if (blocks[index]) heap.push(index, blocks[index]->keys[0]);
+    }
+
+    std::string output;
+    output.reserve(OUTPUT_BUFFER_SIZE + LOG_FRAME_MAX_SIZE * 8);
+    while (!heap.empty())
+    {
+        size_t index = heap.top();
+        Block &block = *blocks[index];
+        size_t &position = positions[index];
+        size_t start = position > 0 ? block.ends[position - 1] : 0;
+        if (source)
+        {
+            output += '[';
+            output += inputs[index]->path;
+            output += "] ";
+        }
+        output.append(block.text, start, block.ends[position] - start);
+        if (output.size() >= OUTPUT_BUFFER_SIZE)
+        {
+            fwrite(output.data(), 1, output.size(), stdout);
+            output.clear();
+        }
+
+        if (++position == block.keys.size())
+        {
+            blocks[index] = nextBlock(index, std::move(blocks[index]));
+            position = 0;
+            if (!blocks[index])
+            {
+                heap.pop();
+                continue;
+            }
+        }
+        heap.replaceTop(blocks[index]->keys[position]);
+    }
+    fwrite(output.data(), 1, output.size(), stdout);
+    fflush(stdout);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workChanged.notify_all();
+    for (std::thread &thread : threads) thread.join();
+    return 0;
+}
@@ -0,0 +1,736 @@
+/*
+ * File: logToArrow.cpp
+ * --------------------
+ * Host tool converting downloaded logs, text or binary, into a columnar Apache Arrow IPC file
+ * (Feather v2), which pandas, Polars, DuckDB, Spark and most analytics engines read directly.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build on Linux or macOS (not part of the Arduino library build, and without any dependency):
+ *   g++ -O2 -march=native -std=c++17 -pthread -o logToArrow extras/logToArrow.cpp
+ *
+ * Usage:
+ *   logToArrow [--threads N] OUTPUT.arrow FILE...
+ *
+ * Each FILE is either a text log or a binary segment file, parsed as in extras/logAnalyzer.cpp.
+ * Each record becomes a row with the columns:
+ *
+ *   file       dictionary<int32, utf8>  path of the file of the record
+ *   timestamp  timestamp[us]            null if the timestamp could not be parsed. As written for
+ *                                       a text log (the time zone of the device), UTC for a binary one
+ *   millis     uint64                   uptime
+ *   task       dictionary<int32, utf8>
+ *   level      dictionary<int8, utf8>   VERBOSE to FATAL, with the index being the LogLevel
+ *   core       uint8
+ *   function   dictionary<int32, utf8>  the index is the id of the function in the file
+ *   message    utf8                     followed by the fields as key=value, or the bytes in hex
+ *
+ * so that a query such as the errors per function per day reads a few small integer columns:
+ *
+ *   import pyarrow.feather as feather
+ *   df = feather.read_table("logs.arrow", columns=["timestamp", "level", "function"]).to_pandas()
+ *   errors = df[df.level == "ERROR"].groupby([df.timestamp.dt.date, "function"]).size()
+ *
+ * The files are parsed by a pool of threads in chunks, as in logAnalyzer, each chunk with its
+ * own dictionaries. The chunks are then written in order as record batches, with their
+ * dictionary indices remapped to the dictionaries of the whole file, so that the conversion
+ * streams with a bounded look-ahead. As the IPC file format lists the dictionaries in its
+ * footer, they are written once at the end, after all the record batches.
+ *
+ * The Arrow metadata is made of FlatBuffers, which are serialized here by a minimal writer
+ * rather than with the FlatBuffers or Arrow libraries, so that the tool builds on its own.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "LogParser.h"
+
+constexpr size_t CHUNK_SIZE = 8 * 1024 * 1024;
+constexpr size_t CHUNKS_AHEAD_PER_THREAD = 4;
+constexpr int64_t NULL_TIMESTAMP = INT64_MIN;
+constexpr int8_t NULL_LEVEL = -1;
+
+// Arrow format constants, from Schema.fbs and Message.fbs
+constexpr int16_t ARROW_METADATA_V5 = 4;
+constexpr uint8_t ARROW_HEADER_SCHEMA = 1;
+constexpr uint8_t ARROW_HEADER_DICTIONARY_BATCH = 2;
+constexpr uint8_t ARROW_HEADER_RECORD_BATCH = 3;
+constexpr uint8_t ARROW_TYPE_INT = 2;
+constexpr uint8_t ARROW_TYPE_UTF8 = 5;
+constexpr uint8_t ARROW_TYPE_TIMESTAMP = 10;
+constexpr int16_t ARROW_MICROSECOND = 2;
+constexpr uint32_t ARROW_CONTINUATION = 0xFFFFFFFF;
+constexpr const char ARROW_MAGIC[] = "ARROW1";
+
+enum Dictionary : int {
+    FILE_DICTIONARY,
+    TASK_DICTIONARY,
+    LEVEL_DICTIONARY,
+    FUNCTION_DICTIONARY,
+    DICTIONARY_COUNT
+};
+
+// ---------------------------------------------------------------------------------------------
+// FlatBuffers serialization
+// ---------------------------------------------------------------------------------------------
+
+struct FlatNode;
+using FlatRef = std::shared_ptr<FlatNode>;
+
+/**
+ * @brief A table, string or vector of a FlatBuffer, serialized with its children by flatFinish().
+ */
+struct FlatNode {
+    enum Kind { TABLE, STRING, TABLES, STRUCTS } kind = TABLE;
+
+    struct Field {
+        bool present = false;
+        uint64_t value = 0; // Scalar, or unused for an offset
+        size_t size = 0; // Of the scalar, 4 for an offset
+        FlatRef child; // Target of an offset
+    };
+
+    std::vector<Field> fields; // Of a table, by id
+    std::string bytes; // Characters of a string, or elements of a vector of structs
+    std::vector<FlatRef> items; // Elements of a vector of tables
+    size_t count = 0; // Elements of a vector of structs
+
+    FlatNode *scalar(size_t id, uint64_t value, size_t size)
+    {
+        if (fields.size() <= id) fields.resize(id + 1);
+        fields[id].present = true;
+        fields[id].value = value;
+        fields[id].size = size;
+        return this;
+    }
+
+    FlatNode *offset(size_t id, FlatRef child)
+    {
+        if (fields.size() <= id) fields.resize(id + 1);
+        fields[id].present = true;
+        fields[id].size = 4;
+        fields[id].child = child;
+        return this;
+    }
+};
+
+static FlatRef flatTable() { return std::make_shared<FlatNode>(); }
+
+static FlatRef flatString(const std::string &text)
+{
+    FlatRef node = std::make_shared<FlatNode>();
+    node->kind = FlatNode::STRING;
+    node->bytes = text;
+    return node;
+}
+
+static FlatRef flatTables(const std::vector<FlatRef> &items)
+{
+    FlatRef node = std::make_shared<FlatNode>();
+    node->kind = FlatNode::TABLES;
+    node->items = items;
+    return node;
+}
+
+static FlatRef flatStructs(const std::string &bytes, size_t count)
+{
+    FlatRef node = std::make_shared<FlatNode>();
+    node->kind = FlatNode::STRUCTS;
+    node->bytes = bytes;
+    node->count = count;
+    return node;
+}
+
+static void appendLittleEndian(std::string &buffer, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) buffer += (char)(value >> (8 * i));
+}
+
+static void patchLittleEndian(std::string &buffer, size_t position, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) buffer[position + i] = (char)(value >> (8 * i));
+}
+
+static void alignTo(std::string &buffer, size_t alignment)
+{
+    while (buffer.size() % alignment != 0) buffer += '\0';
+}
+
+// Writes a node and then its children, as the offsets of FlatBuffers only point forward
+static size_t flatWrite(std::string &buffer, const FlatNode &node)
+{
+    size_t position;
+    switch (node.kind)
+    {
+    case FlatNode::STRING:
+        alignTo(buffer, 4);
+        position = buffer.size();
+        appendLittleEndian(buffer, node.bytes.size(), 4);
+        buffer += node.bytes;
+        buffer += '\0';
+        return position;
+
+    case FlatNode::STRUCTS:
+        // The structs hold 64-bit integers, so the elements after the length must be 8-byte aligned
+        while ((buffer.size() + 4) % 8 != 0) buffer += '\0';
+        position = buffer.size();
+        appendLittleEndian(buffer, node.count, 4);
+        buffer += node.bytes;
+        return position;
+
+    case FlatNode::TABLES:
+        alignTo(buffer, 4);
+        position = buffer.size();
+        appendLittleEndian(buffer, node.items.size(), 4);
+        buffer.append(4 * node.items.size(), '\0');
+        for (size_t i = 0; i < node.items.size(); i++)
+        {
+            size_t slot = position + 4 + 4 * i;
+            patchLittleEndian(buffer, slot, flatWrite(buffer, *node.items[i]) - slot, 4);
+        }
+        return position;
+
+    default:
+        break;
+    }
+
+    // The vtable, then the table pointing back to it, with its fields from the largest
+    alignTo(buffer, 2);
+    size_t vtable = buffer.size();
+    size_t vtableSize = 4 + 2 * node.fields.size();
+    buffer.append(vtableSize, '\0');
+    alignTo(buffer, 8);
+    position = buffer.size();
+    appendLittleEndian(buffer, position - vtable, 4);
+
+    std::vector<size_t> fieldPositions(node.fields.size(), 0);
+    for (size_t size : {8, 4, 2, 1})
+    {
+        for (size_t id = 0; id < node.fields.size(); id++)
+        {
+            const FlatNode::Field &field = node.fields[id];
+            if (!field.present || field.size != size) continue;
+            alignTo(buffer, size);
+            fieldPositions[id] = buffer.size();
+            appendLittleEndian(buffer, field.child ? 0 : field.value, size);
+        }
+    }
+    patchLittleEndian(buffer, vtable, vtableSize, 2);
+    patchLittleEndian(buffer, vtable + 2, buffer.size() - position, 2);
+    for (size_t id = 0; id < node.fields.size(); id++)
+    {
+        if (fieldPositions[id] > 0) patchLittleEndian(buffer, vtable + 4 + 2 * id, fieldPositions[id] - position, 2);
+    }
+
+    for (size_t id = 0; id < node.fields.size(); id++)
+    {
+        const FlatNode::Field &field = node.fields[id];
+        if (field.present && field.child) patchLittleEndian(buffer, fieldPositions[id], flatWrite(buffer, *field.child) - fieldPositions[id], 4);
+    }
+    return position;
+}
+
+// Serializes a FlatBuffer, padded to 8 bytes
+static std::string flatFinish(const FlatRef &root)
+{
+    std::string buffer(4, '\0');
+    patchLittleEndian(buffer, 0, flatWrite(buffer, *root), 4);
+    alignTo(buffer, 8);
+    return buffer;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Arrow metadata
+// ---------------------------------------------------------------------------------------------
+
+static FlatRef arrowInt(int bitWidth, bool isSigned)
+{
+    FlatRef type = flatTable();
+    type->scalar(0, bitWidth, 4)->scalar(1, isSigned, 1);
+    return type;
+}
+
+static FlatRef arrowField(const char *name, bool nullable, uint8_t typeType, FlatRef type, int dictionaryId = -1, FlatRef indexType = nullptr)
+{
+    FlatRef field = flatTable();
+    field->offset(0, flatString(name))->scalar(1, nullable, 1)->scalar(2, typeType, 1)->offset(3, type);
+    if (dictionaryId >= 0)
+    {
+        FlatRef encoding = flatTable();
+        encoding->scalar(0, dictionaryId, 8)->offset(1, indexType)->scalar(2, 0, 1);
+        field->offset(4, encoding);
+    }
+    field->offset(5, flatTables({}));
+    return field;
+}
+
+static FlatRef arrowSchema()
+{
+    FlatRef timestamp = flatTable();
+    timestamp->scalar(0, ARROW_MICROSECOND, 2);
+
+    std::vector<FlatRef> fields = {
+        arrowField("file", false, ARROW_TYPE_UTF8, flatTable(), FILE_DICTIONARY, arrowInt(32, true)),
+        arrowField("timestamp", true, ARROW_TYPE_TIMESTAMP, timestamp),
+        arrowField("millis", false, ARROW_TYPE_INT, arrowInt(64, false)),
+        arrowField("task", false, ARROW_TYPE_UTF8, flatTable(), TASK_DICTIONARY, arrowInt(32, true)),
+        arrowField("level", true, ARROW_TYPE_UTF8, flatTable(), LEVEL_DICTIONARY, arrowInt(8, true)),
+        arrowField("core", false, ARROW_TYPE_INT, arrowInt(8, false)),
+        arrowField("function", false, ARROW_TYPE_UTF8, flatTable(), FUNCTION_DICTIONARY, arrowInt(32, true)),
+        arrowField("message", false, ARROW_TYPE_UTF8, flatTable())};
+
+    FlatRef schema = flatTable();
+    schema->scalar(0, 0, 2)->offset(1, flatTables(fields));
+    return schema;
+}
+
+/**
+ * @brief The body of a record batch, with the field nodes and buffers describing it.
+ */
+struct BatchBody {
+    std::string body;
+    std::string nodes; // FieldNode structs
+    std::string buffers; // Buffer structs
+    size_t nodeCount = 0;
+    size_t bufferCount = 0;
+
+    void node(size_t length, size_t nullCount)
+    {
+        appendLittleEndian(nodes, length, 8);
+        appendLittleEndian(nodes, nullCount, 8);
+        nodeCount++;
+    }
+
+    void buffer(const void *data, size_t length)
+    {
+        appendLittleEndian(buffers, body.size(), 8);
+        appendLittleEndian(buffers, length, 8);
+        bufferCount++;
+        body.append((const char *)data, length);
+        alignTo(body, 8);
+    }
+
+    // Validity bitmap, empty when no value is null
+    template <typename T>
+    size_t validity(const std::vector<T> &values, T null)
+    {
+        size_t nullCount = std::count(values.begin(), values.end(), null);
+        if (nullCount == 0)
+        {
+            buffer(nullptr, 0);
+            return 0;
+        }
+        std::vector<uint8_t> bitmap((values.size() + 7) / 8, 0);
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if (values[i] != null) bitmap[i / 8] |= 1 << (i % 8);
+        }
+        buffer(bitmap.data(), bitmap.size());
+        return nullCount;
+    }
+
+    std::string recordBatch(size_t length) const
+    {
+        FlatRef batch = flatTable();
+        batch->scalar(0, length, 8)->offset(1, flatStructs(nodes, nodeCount))->offset(2, flatStructs(buffers, bufferCount));
+        return _message(ARROW_HEADER_RECORD_BATCH, batch);
+    }
+
+    std::string dictionaryBatch(int id, size_t length) const
+    {
+        FlatRef batch = flatTable();
+        batch->scalar(0, length, 8)->offset(1, flatStructs(nodes, nodeCount))->offset(2, flatStructs(buffers, bufferCount));
+        FlatRef dictionary = flatTable();
+        dictionary->scalar(0, id, 8)->offset(1, batch)->scalar(2, 0, 1);
+        return _message(ARROW_HEADER_DICTIONARY_BATCH, dictionary);
+    }
+
+private:
+    std::string _message(uint8_t headerType, FlatRef header) const
+    {
+        FlatRef message = flatTable();
+        message->scalar(0, ARROW_METADATA_V5, 2)->scalar(1, headerType, 1)->offset(2, header)->scalar(3, body.size(), 8);
+        return flatFinish(message);
+    }
+};
+
+/**
+ * @brief Writes the encapsulated messages of an Arrow IPC file, keeping the blocks of its footer.
+ */
+class ArrowWriter
+{
+public:
+    bool open(const char *path)
+    {
+        _file = fopen(path, "wb");
+        if (_file == nullptr) return false;
+        _write(ARROW_MAGIC, 6);
+        _write("\0\0", 2);
+
+        // The footer holds the same Schema table as the first message
+        _schema = arrowSchema();
+        FlatRef message = flatTable();
+        message->scalar(0, ARROW_METADATA_V5, 2)->scalar(1, ARROW_HEADER_SCHEMA, 1)->offset(2, _schema)->scalar(3, 0, 8);
+        _writeMessage(flatFinish(message), "");
+        return true;
+    }
+
+    void recordBatch(const BatchBody &batch, size_t length)
+    {
+        _recordBatches += _writeMessage(batch.recordBatch(length), batch.body);
+        _recordBatchCount++;
+    }
+
+    void dictionaryBatch(const BatchBody &batch, int id, size_t length)
+    {
+        _dictionaries += _writeMessage(batch.dictionaryBatch(id, length), batch.body);
+        _dictionaryCount++;
+    }
+
+    bool close()
+    {
+        uint32_t endOfStream[2] = {ARROW_CONTINUATION, 0};
+        _write(endOfStream, sizeof(endOfStream));
+
+        FlatRef footer = flatTable();
+        footer->scalar(0, ARROW_METADATA_V5, 2)->offset(1, _schema)->offset(2, flatStructs(_dictionaries, _dictionaryCount))->offset(3, flatStructs(_recordBatches, _recordBatchCount));
+        std::string footerBuffer = flatFinish(footer);
+        _write(footerBuffer.data(), footerBuffer.size());
+        std::string length;
+        appendLittleEndian(length, footerBuffer.size(), 4);
+        _write(length.data(), length.size());
+        _write(ARROW_MAGIC, 6);
+        bool written = !_failed && fclose(_file) == 0;
+        _file = nullptr;
+        return written;
+    }
+
+private:
+    FILE *_file = nullptr;
+    uint64_t _position = 0;
+    bool _failed = false;
+    FlatRef _schema;
+    std::string _dictionaries; // Block structs
+    std::string _recordBatches; // Block structs
+    size_t _dictionaryCount = 0;
+    size_t _recordBatchCount = 0;
+
+    void _write(const void *data, size_t length)
+    {
+        if (length > 0 && fwrite(data, 1, length, _file) != length) _failed = true;
+        _position += length;
+    }
+
+    // Writes a message, returning its Block struct
+    std::string _writeMessage(const std::string &metadata, const std::string &body)
+    {
+        std::string block;
+        appendLittleEndian(block, _position, 8);
+        appendLittleEndian(block, 8 + metadata.size(), 4);
+        appendLittleEndian(block, 0, 4);
+        appendLittleEndian(block, body.size(), 8);
+
+        uint32_t prefix[2] = {ARROW_CONTINUATION, (uint32_t)metadata.size()};
+        _write(prefix, sizeof(prefix));
+        _write(metadata.data(), metadata.size());
+        _write(body.data(), body.size());
+        return block;
+    }
+};
+
+// ---------------------------------------------------------------------------------------------
+// Conversion
+// ---------------------------------------------------------------------------------------------
+
+/**
+ * @brief Strings numbered in the order they are first added.
+ */
+struct StringDictionary {
+    std::deque<std::string> values; // A deque, so that the keys of the index stay valid
+    std::unordered_map<std::string_view, int32_t> index;
+
+    int32_t add(const char *text, size_t length)
+    {
+        auto found = index.find(std::string_view(text, length));
+        if (found != index.end()) return found->second;
+        values.emplace_back(text, length);
+        int32_t id = (int32_t)values.size() - 1;
+        index.emplace(values.back(), id);
+        return id;
+    }
+};
+
+struct Chunk {
+    size_t file;
+    size_t begin;
+    size_t end;
+};
+
+/**
+ * @brief The columns of the records of a chunk, with the dictionaries of the chunk.
+ */
+struct ChunkColumns {
+    std::vector<int64_t> timestamps;
+    std::vector<uint64_t> millis;
+    std::vector<int32_t> tasks;
+    std::vector<int8_t> levels;
+    std::vector<uint8_t> cores;
+    std::vector<int32_t> functions;
+    std::vector<int32_t> messageOffsets{0};
+    std::string messages;
+    StringDictionary taskDictionary;
+    StringDictionary functionDictionary;
+
+    void add(const LogParsedRecord &record)
+    {
+        timestamps.push_back(record.timeUs >= 0 ? record.timeUs : NULL_TIMESTAMP);
+        millis.push_back(record.millis);
+        tasks.push_back(taskDictionary.add(record.task, record.taskLength));
+        levels.push_back(record.level != LOG_PARSER_UNKNOWN_LEVEL ? (int8_t)record.level : NULL_LEVEL);
+        cores.push_back((uint8_t)record.core);
+        functions.push_back(functionDictionary.add(record.function, record.functionLength));
+        if (record.bytes != nullptr) logParserAppendHex(messages, record.bytes, record.bytesLength);
+        else messages.append(record.message, record.messageLength);
+        if (record.fields != nullptr) logParserAppendFields(messages, record.fields, record.fieldsLength);
+        messageOffsets.push_back((int32_t)messages.size());
+    }
+};
+
+static void parseChunk(const LogMappedFile &file, const std::string &path, const Chunk &chunk, ChunkColumns &columns)
+{
+    LogParsedRecord record;
+    if (LogBinaryReader::isBinary(file.data(), file.size()))
+    {
+        LogBinaryReader reader;
+        reader.loadLog(path);
+        reader.begin(file.data(), file.size());
+        while (reader.next(record)) columns.add(record);
+        return;
+    }
+
+    const char *cursor = file.data() + chunk.begin;
+    const char *end = file.data() + chunk.end;
+    while (cursor < end)
+    {
+        const char *newline = logParserFindNewline(cursor, end);
+        if (logParserParseLine(cursor, newline - cursor, record)) columns.add(record);
+        cursor = newline + 1;
+    }
+}
+
+// Writes the records of a chunk as a record batch, with the indices of the dictionaries of the whole file
+static void writeChunk(ArrowWriter &writer, size_t fileIndex, ChunkColumns &columns, StringDictionary &tasks, StringDictionary &functions)
+{
+    size_t rows = columns.millis.size();
+    if (rows == 0) return;
+
+    std::vector<int32_t> remap(columns.taskDictionary.values.size());
+    for (size_t i = 0; i < remap.size(); i++) remap[i] = tasks.add(columns.taskDictionary.values[i].data(), columns.taskDictionary.values[i].size());
+    for (int32_t &task : columns.tasks) task = remap[task];
+    remap.resize(columns.functionDictionary.values.size());
+    for (size_t i = 0; i < remap.size(); i++) remap[i] = functions.add(columns.functionDictionary.values[i].data(), columns.functionDictionary.values[i].size());
+    for (int32_t &function : columns.functions) function = remap[function];
+    std::vector<int32_t> files(rows, (int32_t)fileIndex);
+
+    // The buffers of each column in the order of the schema: validity, then values or offsets and data
+    BatchBody batch;
+    batch.node(rows, 0);
+    batch.buffer(nullptr, 0);
+    batch.buffer(files.data(), rows * sizeof(int32_t));
+
+    batch.node(rows, std::count(columns.timestamps.begin(), columns.timestamps.end(), NULL_TIMESTAMP));
+    batch.validity(columns.timestamps, NULL_TIMESTAMP);
+    batch.buffer(columns.timestamps.data(), rows * sizeof(int64_t));
+
+    batch.node(rows, 0);
+    batch.buffer(nullptr, 0);
+    batch.buffer(columns.millis.data(), rows * sizeof(uint64_t));
+
+    batch.node(rows, 0);
+    batch.buffer(nullptr, 0);
+    batch.buffer(columns.tasks.data(), rows * sizeof(int32_t));
+
+    batch.node(rows, std::count(columns.levels.begin(), columns.levels.end(), NULL_LEVEL));
+    batch.validity(columns.levels, NULL_LEVEL);
+    batch.buffer(columns.levels.data(), rows * sizeof(int8_t));
+
+    batch.node(rows, 0);
+    batch.buffer(nullptr, 0);
+    batch.buffer(columns.cores.data(), rows * sizeof(uint8_t));
+
+    batch.node(rows, 0);
+    batch.buffer(nullptr, 0);
+    batch.buffer(columns.functions.data(), rows * sizeof(int32_t));
+
+    batch.node(rows, 0);
+    batch.buffer(nullptr, 0);
+    batch.buffer(columns.messageOffsets.data(), (rows + 1) * sizeof(int32_t));
+    batch.buffer(columns.messages.data(), columns.messages.size());
+
+    writer.recordBatch(batch, rows);
+}
+
+static void writeDictionary(ArrowWriter &writer, int id, const std::deque<std::string> &values)
+{
+    std::vector<int32_t> offsets{0};
+    std::string data;
+    for (const std::string &value : values)
+    {
+        data += value;
+        offsets.push_back((int32_t)data.size());
+    }
+    BatchBody batch;
+    batch.node(values.size(), 0);
+    batch.buffer(nullptr, 0);
+    batch.buffer(offsets.data(), offsets.size() * sizeof(int32_t));
+    batch.buffer(data.data(), data.size());
+    writer.dictionaryBatch(batch, id, values.size());
+}
+
+static void printUsage()
+{
+    fprintf(stderr, "Usage: logToArrow [--threads N] OUTPUT.arrow FILE...\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int threadCount = 0;
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--threads" && i + 1 < argc) threadCount = (unsigned int)atoi(argv[++i]);
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            printUsage();
+            return 1;
+        }
+        else arguments.push_back(argument);
+    }
+    if (arguments.size() < 2)
+    {
+        printUsage();
+        return 1;
+    }
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::string outputPath = arguments[0];
+    std::vector<std::string> paths(arguments.begin() + 1, arguments.end());
+
+    std::vector<std::unique_ptr<LogMappedFile>> files;
+    std::vector<Chunk> chunks;
+    for (size_t index = 0; index < paths.size(); index++)
+    {
+        files.emplace_back(new LogMappedFile());
+        LogMappedFile &file = *files.back();
+        if (!file.open(paths[index].c_str()))
+        {
+            fprintf(stderr, "Failed to open %s\n", paths[index].c_str());
+            continue;
+        }
+        if (file.size() == 0) continue;
+        if (LogBinaryReader::isBinary(file.data(), file.size()))
+        {
+            chunks.push_back({index, 0, file.size()});
+            continue;
+        }
+        const char *end = file.data() + file.size();
+        size_t begin = 0;
+        while (begin < file.size())
+        {
+            size_t chunkEnd = std::min(begin + CHUNK_SIZE, file.size());
+            if (chunkEnd < file.size()) chunkEnd = logParserFindNewline(file.data() + chunkEnd, end) - file.data() + 1;
+            chunkEnd = std::min(chunkEnd, file.size());
+            chunks.push_back({index, begin, chunkEnd});
+            begin = chunkEnd;
+        }
+    }
+
+    ArrowWriter writer;
+    if (!writer.open(outputPath.c_str()))
+    {
+        fprintf(stderr, "Failed to create %s\n", outputPath.c_str());
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<ChunkColumns>> parsed(chunks.size());
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t nextChunk = 0;
+    size_t written = 0;
+
+    std::vector<std::thread> threads;
+    for (unsigned int thread = 0; thread < threadCount; thread++)
+    {
+        threads.emplace_back([&]() {
+            while (true)
+            {
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() { return nextChunk >= chunks.size() || nextChunk < written + threadCount * CHUNKS_AHEAD_PER_THREAD; });
+                    if (nextChunk >= chunks.size()) return;
+                    index = nextChunk++;
+                }
+                const Chunk &chunk = chunks[index];
+                std::unique_ptr<ChunkColumns> columns(new ChunkColumns());
+                parseChunk(*files[chunk.file], paths[chunk.file], chunk, *columns);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    parsed[index] = std::move(columns);
+                }
+                changed.notify_all();
+            }
+        });
+    }
+
+    // The chunks are written in order, each as soon as it is parsed
+    StringDictionary taskDictionary;
+    StringDictionary functionDictionary;
+    size_t rows = 0;
+    while (written < chunks.size())
+    {
+        std::unique_ptr<ChunkColumns> columns;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return parsed[written] != nullptr; });
+            columns = std::move(parsed[written]);
+        }
+        rows += columns->millis.size();
+        writeChunk(writer, chunks[written].file, *columns, taskDictionary, functionDictionary);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written++;
+        }
+        changed.notify_all();
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    std::deque<std::string> fileNames(paths.begin(), paths.end());
+    std::deque<std::string> levelNames(LOG_PARSER_LEVELS, LOG_PARSER_LEVELS + LOG_PARSER_LEVEL_COUNT);
+    writeDictionary(writer, FILE_DICTIONARY, fileNames);
+    writeDictionary(writer, TASK_DICTIONARY, taskDictionary.values);
+    writeDictionary(writer, LEVEL_DICTIONARY, levelNames);
+    writeDictionary(writer, FUNCTION_DICTIONARY, functionDictionary.values);
+    if (!writer.close())
+    {
+        fprintf(stderr, "Failed to write %s\n", outputPath.c_str());
+        return 1;
+    }
+    fprintf(stderr, "%zu records from %zu files, %zu functions, %zu tasks\n", rows, paths.size(), functionDictionary.values.size(), taskDictionary.values.size());
+    return 0;
+}
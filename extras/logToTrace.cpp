@@ -0,0 +1,329 @@
+/*
+ * File: logToTrace.cpp
+ * --------------------
+ * Host tool converting downloaded logs, text or binary, into a trace in the Chrome Trace Event
+ * JSON format, which chrome://tracing and the Perfetto UI (https://ui.perfetto.dev) open as a
+ * timeline: the spans traced with LogSpan as nested slices, and the log lines as instant events.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build on Linux or macOS (not part of the Arduino library build):
+ *   g++ -O2 -march=native -std=c++17 -o logToTrace extras/logToTrace.cpp
+ *
+ * Usage:
+ *   logToTrace [--level LEVEL] [--spans] FILE... > trace.json
+ *
+ *   --level LEVEL     only show the log lines at or above the level (e.g. INFO) as instant events
+ *   --spans           only show the spans, without the log lines
+ *
+ * Each FILE is either a text log, as printed by dump() or captured from the Serial, or a binary
+ * segment file copied from the SPIFFS ("log.txt.00"), whose .time and .tasks files are read too
+ * if they are next to it, as in extras/logAnalyzer.cpp. Each log is a process of the trace, the
+ * segments of the same log ("log.txt.00", "log.txt.10", ...) being the same process, and each
+ * task is a thread of its process.
+ *
+ * A span is a "span begin" record and a "span end" record with the same id (see LogSpan). The
+ * beginning of a span becomes a "B" event, and its end an "E" event, dated from the beginning
+ * plus the duration saved on the device, so that the span keeps its microsecond precision even
+ * in a text log, whose lines are only dated to the millisecond. The end of a span whose beginning
+ * was removed by the retention of the log becomes a complete "X" event instead.
+ *
+ * The records of a binary log are placed at their time in microseconds. The lines of a text log
+ * are placed at their uptime, offset by the timestamp of the first line of their boot, so that
+ * the order within a boot is exact, whatever the resolution of the timestamp.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LogParser.h"
+
+constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+struct Options {
+    int minLevel = LOG_PARSER_UNKNOWN_LEVEL;
+    bool spansOnly = false;
+};
+
+// A log, shown as a process of the trace
+struct Process {
+    int pid;
+    std::unordered_map<std::string, int> threads; // Thread id of each task name
+    bool started = false;
+    uint64_t lastMillis = 0;
+    int64_t bootUs = 0; // Trace time of the uptime 0 of the current boot of a text log
+    int64_t lastUs = 0;
+    std::unordered_map<uint32_t, int64_t> openSpans; // Trace time of the beginning of the spans of the current boot
+};
+
+static void appendNumber(std::string &output, int64_t value)
+{
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%lld", (long long)value);
+    output.append(digits, length);
+}
+
+static void appendJsonString(std::string &output, const char *text, size_t length)
+{
+    output += '"';
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char character = (unsigned char)text[i];
+        if (character == '"' || character == '\\')
+        {
+            output += '\\';
+            output += (char)character;
+        }
+        else if (character < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+            output += escaped;
+        }
+        else
+        {
+            output += (char)character;
+        }
+    }
+    output += '"';
+}
+
+// Starts an event, up to its timestamp included
+static void appendEvent(std::string &output, char phase, int pid, int tid, int64_t timeUs)
+{
+    output += ",\n{\"ph\":\"";
+    output += phase;
+    output += "\",\"pid\":";
+    appendNumber(output, pid);
+    output += ",\"tid\":";
+    appendNumber(output, tid);
+    output += ",\"ts\":";
+    appendNumber(output, timeUs);
+}
+
+static void appendMetadata(std::string &output, const char *name, int pid, int tid, const std::string &value)
+{
+    output += ",\n{\"ph\":\"M\",\"name\":\"";
+    output += name;
+    output += "\",\"pid\":";
+    appendNumber(output, pid);
+    output += ",\"tid\":";
+    appendNumber(output, tid);
+    output += ",\"args\":{\"name\":";
+    appendJsonString(output, value.data(), value.size());
+    output += "}}";
+}
+
+// Gets the time of a record in the trace, in microseconds
+static int64_t traceTime(Process &process, const LogParsedRecord &record, bool binary)
+{
+    // A new boot starts when the uptime goes back
+    bool booted = !process.started || record.millis < process.lastMillis;
+    process.started = true;
+    process.lastMillis = record.millis;
+    if (booted)
+    {
+        process.openSpans.clear();
+        if (!binary) process.bootUs = record.timeUs >= 0 ? record.timeUs - (int64_t)record.millis * 1000 : process.lastUs;
+    }
+
+    process.lastUs = binary ? record.timeUs : process.bootUs + (int64_t)record.millis * 1000;
+    return process.lastUs;
+}
+
+// Converts a record into an event, returning whether it is a span
+static bool convertRecord(std::string &output, Process &process, const LogParsedRecord &record, bool binary, const Options &options)
+{
+    int64_t timeUs = traceTime(process, record, binary);
+
+    std::string task(record.task, record.taskLength);
+    auto thread = process.threads.find(task);
+    if (thread == process.threads.end())
+    {
+        thread = process.threads.emplace(task, (int)process.threads.size() + 1).first;
+        appendMetadata(output, "thread_name", process.pid, thread->second, task);
+    }
+    int tid = thread->second;
+
+    LogFrameSpan span;
+    if (logParserReadSpan(record, span))
+    {
+        if (span.phase == LogSpanPhase::BEGIN)
+        {
+            process.openSpans[span.id] = timeUs;
+            appendEvent(output, 'B', process.pid, tid, timeUs);
+            output += ",\"cat\":\"span\",\"name\":";
+            appendJsonString(output, record.function, record.functionLength);
+            output += ",\"args\":{\"id\":";
+            appendNumber(output, span.id);
+            output += ",\"parent\":";
+            appendNumber(output, span.parent);
+            output += "}}";
+            return true;
+        }
+
+        auto begin = process.openSpans.find(span.id);
+        if (begin != process.openSpans.end())
+        {
+            appendEvent(output, 'E', process.pid, tid, begin->second + (int64_t)span.durationUs);
+            output += '}';
+            process.openSpans.erase(begin);
+            return true;
+        }
+        appendEvent(output, 'X', process.pid, tid, timeUs - (int64_t)span.durationUs);
+        output += ",\"dur\":";
+        appendNumber(output, (int64_t)span.durationUs);
+        output += ",\"cat\":\"span\",\"name\":";
+        appendJsonString(output, record.function, record.functionLength);
+        output += ",\"args\":{\"id\":";
+        appendNumber(output, span.id);
+        output += ",\"parent\":";
+        appendNumber(output, span.parent);
+        output += "}}";
+        return true;
+    }
+
+    if (options.spansOnly || record.level < options.minLevel) return false;
+
+    // The message is the name of the event, as it is what the timeline shows
+    std::string message(record.message, record.messageLength);
+    if (record.bytes != nullptr) logParserAppendHex(message, record.bytes, record.bytesLength);
+    if (record.fields != nullptr) logParserAppendFields(message, record.fields, record.fieldsLength);
+    const char *level = record.level != LOG_PARSER_UNKNOWN_LEVEL ? LOG_PARSER_LEVELS[record.level] : "";
+
+    appendEvent(output, 'i', process.pid, tid, timeUs);
+    output += ",\"s\":\"t\",\"cat\":\"";
+    output += level;
+    output += "\",\"name\":";
+    appendJsonString(output, message.data(), message.size());
+    output += ",\"args\":{\"function\":";
+    appendJsonString(output, record.function, record.functionLength);
+    output += ",\"level\":\"";
+    output += level;
+    output += "\",\"core\":";
+    appendNumber(output, record.core);
+    output += "}}";
+    return false;
+}
+
+// Writes the events converted so far, each starting with the separator from the previous one
+static void writeOutput(std::string &output, bool &first)
+{
+    size_t start = first && output.size() >= 2 ? 2 : 0;
+    fwrite(output.data() + start, 1, output.size() - start, stdout);
+    output.clear();
+    first = false;
+}
+
+// Gets the name of the log of a file, without the slot of a segment file
+static std::string logName(const std::string &path, bool binary)
+{
+    size_t dot = path.rfind('.');
+    if (binary && dot != std::string::npos && path.size() - dot == 3) return path.substr(0, dot);
+    return path;
+}
+
+static void printUsage()
+{
+    fprintf(stderr, "Usage: logToTrace [--level LEVEL] [--spans] FILE... > trace.json\n");
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--level" && i + 1 < argc)
+        {
+            const char *level = argv[++i];
+            options.minLevel = logParserLevel(level, strlen(level));
+            if (options.minLevel == LOG_PARSER_UNKNOWN_LEVEL)
+            {
+                fprintf(stderr, "Unknown level %s\n", level);
+                return 1;
+            }
+        }
+        else if (argument == "--spans") options.spansOnly = true;
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            printUsage();
+            return 1;
+        }
+        else paths.push_back(argument);
+    }
+    if (paths.empty())
+    {
+        printUsage();
+        return 1;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", stdout);
+    std::string output;
+    bool first = true;
+    output.reserve(OUTPUT_BUFFER_SIZE + LOG_FRAME_MAX_SIZE * 8);
+    std::unordered_map<std::string, std::unique_ptr<Process>> processes;
+    size_t records = 0;
+    size_t spans = 0;
+
+    for (const std::string &path : paths)
+    {
+        LogMappedFile file;
+        if (!file.open(path.c_str()))
+        {
+            fprintf(stderr, "Failed to open %s\n", path.c_str());
+            continue;
+        }
+        bool binary = LogBinaryReader::isBinary(file.data(), file.size());
+        std::string name = logName(path, binary);
+        std::unique_ptr<Process> &process = processes[name];
+        if (!process)
+        {
+            process.reset(new Process());
+            process->pid = (int)processes.size();
+            appendMetadata(output, "process_name", process->pid, 0, name);
+        }
+        // The segments of a log are separate streams of records, each starting its boots over
+        process->started = false;
+
+        LogParsedRecord record;
+        auto convert = [&]() {
+            records++;
+            if (convertRecord(output, *process, record, binary, options)) spans++;
+            if (output.size() >= OUTPUT_BUFFER_SIZE) writeOutput(output, first);
+        };
+
+        if (binary)
+        {
+            LogBinaryReader reader;
+            reader.loadLog(path);
+            reader.begin(file.data(), file.size());
+            while (reader.next(record)) convert();
+            continue;
+        }
+
+        const char *cursor = file.data();
+        const char *end = cursor + file.size();
+        while (cursor < end)
+        {
+            const char *newline = logParserFindNewline(cursor, end);
+            if (logParserParseLine(cursor, newline - cursor, record)) convert();
+            cursor = newline + 1;
+        }
+    }
+
+    writeOutput(output, first);
+    fputs("\n]}\n", stdout);
+    fflush(stdout);
+    fprintf(stderr, "%zu records, %zu of them spans, from %zu logs\n", records, spans, processes.size());
+    return 0;
+}
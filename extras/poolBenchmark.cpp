@@ -0,0 +1,101 @@
+/*
+ * File: poolBenchmark.cpp
+ * -----------------------
+ * Host benchmark of the LogRecordPool against malloc/free under multithreaded load.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build and run on the host (not part of the Arduino library build):
+ *   g++ -O2 -std=c++17 -pthread -o poolBenchmark extras/poolBenchmark.cpp && ./poolBenchmark
+ *
+ * Each thread repeatedly acquires a block of a random record size, writes to it, and releases
+ * it a few acquisitions later, so that several blocks are held at the same time as when records
+ * are queued. The pool is sized so that it never runs out, and its integrity is checked at the end.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../src/LogRecordPool.h"
+
+constexpr int OPERATIONS_PER_THREAD = 1000000;
+constexpr int HELD_PER_THREAD = 4;
+constexpr size_t MAX_RECORD_SIZE = 1200;
+
+template <typename Acquire, typename Release>
+double runBenchmark(int threadCount, Acquire acquire, Release release)
+{
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t]() {
+            std::minstd_rand random(t + 1);
+            void *held[HELD_PER_THREAD] = {};
+            for (int i = 0; i < OPERATIONS_PER_THREAD; i++)
+            {
+                int slot = i % HELD_PER_THREAD;
+                release(held[slot]);
+
+                // Mostly short records, with a few long ones, as in a typical log
+                size_t size = random() % 8 == 0 ? 256 + random() % (MAX_RECORD_SIZE - 256) : 40 + random() % 80;
+                held[slot] = acquire(size);
+                if (held[slot] != nullptr) memset(held[slot], i, 16);
+            }
+            for (int slot = 0; slot < HELD_PER_THREAD; slot++) release(held[slot]);
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ((double)OPERATIONS_PER_THREAD * threadCount);
+}
+
+int main()
+{
+    unsigned int maxThreads = std::max(2u, std::thread::hardware_concurrency());
+    printf("%-8s %14s %14s %10s\n", "threads", "malloc ns/op", "pool ns/op", "failures");
+
+    for (unsigned int threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+    {
+        double heap = runBenchmark(
+            threadCount,
+            [](size_t size) { return malloc(size); },
+            [](void *block) { free(block); });
+
+        // Enough blocks of every class for all the held records, so that only the speed is compared
+        uint16_t blockCounts[LOG_POOL_CLASS_COUNT];
+        for (int i = 0; i < LOG_POOL_CLASS_COUNT; i++) blockCounts[i] = (uint16_t)(threadCount * HELD_PER_THREAD);
+        LogRecordPool pool;
+        if (!pool.begin(blockCounts))
+        {
+            printf("Failed to allocate the pool\n");
+            return 1;
+        }
+        double pooled = runBenchmark(
+            threadCount,
+            [&pool](size_t size) { return pool.acquire(size); },
+            [&pool](void *block) { pool.release(block); });
+
+        LogPoolStats stats = pool.getStats();
+        size_t failures = 0;
+        for (int i = 0; i < LOG_POOL_CLASS_COUNT; i++)
+        {
+            failures += stats.classes[i].failures;
+            if (stats.classes[i].inUse != 0)
+            {
+                printf("Pool integrity check failed: %zu blocks of %zu bytes still in use\n", stats.classes[i].inUse, stats.classes[i].blockSize);
+                return 1;
+            }
+        }
+        printf("%-8u %14.1f %14.1f %10zu\n", threadCount, heap, pooled, failures);
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * File: watchBenchmark.cpp
+ * ------------------------
+ * Host benchmark of the LogWatchMatcher against a strstr() scan per pattern, with 1, 10 and 100 patterns.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * Build and run on the host (not part of the Arduino library build):
+ *   g++ -O2 -std=c++17 -o watchBenchmark extras/watchBenchmark.cpp && ./watchBenchmark
+ *
+ * The messages look like the ones of a typical firmware, and a few of them contain one of the
+ * patterns. The patterns are plain substrings, except for a few with a '*', which the strstr()
+ * scan handles by searching their pieces one after the other. Both must find the same matches.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/LogWatch.h"
+
+constexpr int MESSAGE_COUNT = 20000;
+constexpr int ROUNDS = 20;
+constexpr size_t MAX_MATCHED = 8;
+
+static const char *WORDS[] = {
+    "sensor", "reading", "value", "wifi", "connected", "mqtt", "publish", "topic", "energy", "meter",
+    "voltage", "current", "power", "relay", "state", "changed", "to", "task", "heap", "free",
+    "bytes", "ms", "loop", "ok", "retry", "after", "channel", "rssi", "dBm", "update"};
+constexpr size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+static bool matchesWithStrstr(const char *message, const std::string &pattern)
+{
+    // The pieces between the '*' must appear in order, without overlapping
+    const char *cursor = message;
+    size_t start = 0;
+    while (start < pattern.size())
+    {
+        size_t end = pattern.find(LOG_WATCH_WILDCARD, start);
+        if (end == std::string::npos) end = pattern.size();
+        if (end > start)
+        {
+            std::string piece = pattern.substr(start, end - start);
+            const char *found = strstr(cursor, piece.c_str());
+            if (found == nullptr) return false;
+            cursor = found + piece.size();
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+int main()
+{
+    std::minstd_rand random(1);
+
+    std::vector<std::string> messages;
+    for (int i = 0; i < MESSAGE_COUNT; i++)
+    {
+        std::string message;
+        int wordCount = 6 + random() % 12;
+        for (int w = 0; w < wordCount; w++)
+        {
+            if (w > 0) message += ' ';
+            message += WORDS[random() % WORD_COUNT];
+            if (random() % 4 == 0) message += std::to_string(random() % 100000);
+        }
+        if (random() % 50 == 0) message += " brownout detected";
+        if (random() % 50 == 0) message += " E(0x1f) timeout after 500 ms";
+        messages.push_back(message);
+    }
+
+    std::vector<std::string> allPatterns = {"brownout", "E(0x", "timeout*ms"};
+    while (allPatterns.size() < 100)
+    {
+        // Codes which never appear, so that every pattern costs a full scan with strstr()
+        char pattern[32];
+        snprintf(pattern, sizeof(pattern), allPatterns.size() % 10 == 0 ? "fault %u*code" : "ERR_%04u", (unsigned int)allPatterns.size());
+        allPatterns.push_back(pattern);
+    }
+
+    printf("%-9s %16s %16s %10s\n", "patterns", "strstr ns/msg", "matcher ns/msg", "matches");
+    for (size_t patternCount : {1, 10, 100})
+    {
+        std::vector<std::string> patterns(allPatterns.begin(), allPatterns.begin() + patternCount);
+        LogWatchMatcher matcher;
+        for (const std::string &pattern : patterns) matcher.add(pattern.c_str());
+
+        size_t strstrMatches = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            for (const std::string &message : messages)
+            {
+                for (const std::string &pattern : patterns) strstrMatches += matchesWithStrstr(message.c_str(), pattern);
+            }
+        }
+        std::chrono::duration<double, std::nano> strstrElapsed = std::chrono::steady_clock::now() - start;
+
+        size_t matcherMatches = 0;
+        uint16_t matched[MAX_MATCHED];
+        start = std::chrono::steady_clock::now();
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            for (const std::string &message : messages) matcherMatches += matcher.match(message.c_str(), message.size(), matched, MAX_MATCHED);
+        }
+        std::chrono::duration<double, std::nano> matcherElapsed = std::chrono::steady_clock::now() - start;
+
+        if (strstrMatches != matcherMatches)
+        {
+            printf("Mismatch with %zu patterns: strstr found %zu matches, the matcher %zu\n", patternCount, strstrMatches, matcherMatches);
+            return 1;
+        }
+        double scans = (double)MESSAGE_COUNT * ROUNDS;
+        printf("%-9zu %16.1f %16.1f %10zu\n", patternCount, strstrElapsed.count() / scans, matcherElapsed.count() / scans, matcherMatches / ROUNDS);
+    }
+    return 0;
+}
@@ -1,5 +1,11 @@
 #include "AdvancedLogger.h"
 
+#if !defined(ESP_PLATFORM)
+#include <signal.h>
+
+#include <exception>
+#endif
+
 // Macros
 #define PROCESS_ARGS(format, function)                   \
     char _message[MAX_LOG_LENGTH];                       \
@@ -8,6 +14,71 @@
     vsnprintf(_message, sizeof(_message), format, args); \
     va_end(args);
 
+AdvancedLogger *AdvancedLogger::_panicLogger = nullptr;
+bool AdvancedLogger::_panicHandlersRegistered = false;
+thread_local LogContext *AdvancedLogger::_context = nullptr;
+thread_local bool AdvancedLogger::_inWatch = false;
+thread_local uint8_t AdvancedLogger::_taskId = LOG_TASK_UNRESOLVED;
+thread_local uint32_t AdvancedLogger::_spanId = 0;
+std::atomic<uint32_t> AdvancedLogger::_spanCount{0};
+char AdvancedLogger::_taskNames[LOG_TASK_COUNT][LOG_TASK_NAME_SIZE] = {"unknown"};
+std::atomic<uint32_t> AdvancedLogger::_taskNamesReady{1};
+std::atomic<int> AdvancedLogger::_taskCount{1};
+
+// Not initialized at startup, so that it survives a panic or a software restart
+static __NOINIT_ATTR LogPanicBuffer _panicBuffer;
+
+static void _onShutdown()
+{
+    AdvancedLogger::emergencyFlush();
+}
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+static void IRAM_ATTR _onPanic(arduino_panic_info_t *info, void *arg)
+{
+    AdvancedLogger::emergencyFlush();
+}
+#endif
+
+#if !defined(ESP_PLATFORM)
+// On a host build (e.g. tests against an Arduino emulation), std::terminate and the fatal signals play the role of the panic handler
+static std::terminate_handler _previousTerminate = nullptr;
+static const int _fatalSignals[] = {SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL};
+static struct sigaction _previousSignalActions[sizeof(_fatalSignals) / sizeof(_fatalSignals[0])];
+
+static void _onTerminate()
+{
+    AdvancedLogger::emergencyFlush();
+    if (_previousTerminate != nullptr) _previousTerminate();
+    abort();
+}
+
+static void _onFatalSignal(int signalNumber)
+{
+    AdvancedLogger::emergencyFlush();
+
+    // The previous handler, or the default action, then runs as if this one had never been installed
+    for (size_t i = 0; i < sizeof(_fatalSignals) / sizeof(_fatalSignals[0]); i++)
+    {
+        if (_fatalSignals[i] == signalNumber) sigaction(signalNumber, &_previousSignalActions[i], nullptr);
+    }
+    raise(signalNumber);
+}
+
+static void _registerHostHandlers()
+{
+    _previousTerminate = std::set_terminate(_onTerminate);
+
+    struct sigaction action = {};
+    action.sa_handler = _onFatalSignal;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(_fatalSignals) / sizeof(_fatalSignals[0]); i++)
+    {
+        sigaction(_fatalSignals[i], &action, &_previousSignalActions[i]);
+    }
+}
+#endif
+
 /**
  * @brief Constructs a new AdvancedLogger object.
  *
@@ -27,6 +98,9 @@ AdvancedLogger::AdvancedLogger(
       _configFilePath(configFilePath),
       _timestampFormat(timestampFormat)
 {
+    _tiers[(int)LogTier::CRITICAL].maxBytes = DEFAULT_MAX_CRITICAL_LOG_BYTES;
+    _mutex = xSemaphoreCreateRecursiveMutex();
+
     if (!_isValidPath(_logFilePath.c_str()) || !_isValidPath(_configFilePath.c_str()))
     {
         Serial.printf(
@@ -53,24 +127,85 @@ AdvancedLogger::AdvancedLogger(
     }
 }
 
+/**
+ * @brief Destroys the AdvancedLogger object.
+ *
+ * The buffered records are written and the flush and callback tasks are stopped.
+ */
+AdvancedLogger::~AdvancedLogger()
+{
+    if (_panicLogger == this) _panicLogger = nullptr;
+    flush();
+    if (_flushTaskHandle != nullptr) vTaskDelete(_flushTaskHandle);
+    if (_callbackTaskHandle != nullptr) vTaskDelete(_callbackTaskHandle);
+    if (_callbackQueue != nullptr) vQueueDelete(_callbackQueue);
+    if (_mutex != nullptr) vSemaphoreDelete(_mutex);
+}
+
 /**
  * @brief Initializes the AdvancedLogger object.
  *
  * Initializes the AdvancedLogger object by setting the configuration
  * from the SPIFFS filesystem. If the configuration file is not found,
- * the default configuration is used.
+ * the default configuration is used. The task writing the buffered
+ * records once their flush deadline expires and the task invoking the
+ * callback are also started, and the
+ * emergency flush is registered as shutdown and panic handler, after
+ * saving the records it left in the no-init RAM at the previous reset.
  * 
  */
 void AdvancedLogger::begin()
 {
     debug("AdvancedLogger initializing...", "AdvancedLogger::begin");
 
-    if (!_setConfigFromSpiffs())
+    // A text config, such as the one of a previous version of the library, is imported only if there is no binary one
+    if (!_loadConfig() && !importConfig())
     {
         Serial.printf("Failed to set config from filesystem, using default config");
         setDefaultConfig();
     }
-    _logLines = getLogLines();
+    _lock();
+    _loadBootTimes();
+    _pruneTaskNames();
+    _loadSegments();
+    _importLegacyLog();
+    _recoverPanicBuffer();
+    _unlock();
+
+    _panicLogger = this;
+    if (!_panicHandlersRegistered)
+    {
+        _panicHandlersRegistered = true;
+        esp_register_shutdown_handler(_onShutdown);
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+        // There is a single Arduino panic handler: an application setting its own should call emergencyFlush() from it
+        set_arduino_panic_handler(_onPanic, nullptr);
+#endif
+#if !defined(ESP_PLATFORM)
+        _registerHostHandlers();
+#endif
+    }
+
+    if (!_recordPool.begin())
+    {
+        warning("Failed to allocate the record pool, records will not be queued", "AdvancedLogger::begin");
+    }
+
+    if (_callbackQueue == nullptr) _callbackQueue = xQueueCreate(CALLBACK_QUEUE_LENGTH, sizeof(LogCallbackRecord *));
+    if (_callbackTaskHandle == nullptr &&
+        (_callbackQueue == nullptr ||
+         xTaskCreate(_callbackTask, CALLBACK_TASK_NAME, CALLBACK_TASK_STACK_SIZE, this, CALLBACK_TASK_PRIORITY, &_callbackTaskHandle) != pdPASS))
+    {
+        _callbackTaskHandle = nullptr;
+        warning("Failed to create callback task, the callback will be invoked by the log calls", "AdvancedLogger::begin");
+    }
+
+    if (_flushTaskHandle == nullptr &&
+        xTaskCreate(_flushTask, FLUSH_TASK_NAME, FLUSH_TASK_STACK_SIZE, this, FLUSH_TASK_PRIORITY, &_flushTaskHandle) != pdPASS)
+    {
+        _flushTaskHandle = nullptr;
+        warning("Failed to create flush task, buffered records will be written by the next log call", "AdvancedLogger::begin");
+    }
 
     if (_invalidPath)
     {
@@ -85,494 +220,3384 @@ void AdvancedLogger::begin()
 }
 
 /**
- * @brief Logs a verbose message.
+ * @brief Formats and logs a message which passed the level check.
  *
- * This method logs a verbose message with the provided format and function name.
+ * This is the slow path of the logging methods, which are inlined in the
+ * header and only check the level. It is kept out of line and marked as
+ * cold, so that the formatting and I/O code does not pollute the
+ * instruction cache of the callers.
  *
+ * @param logLevel Log level of the message.
  * @param format Format of the message.
- * @param function Name of the function where the message is logged. 
+ * @param function Name of the function where the message is logged.
  * @param ... Arguments to be formatted into the message using the printf format.
 */
-void AdvancedLogger::verbose(const char *format, const char *function = "unknown", ...)
+void AdvancedLogger::_logFormatted(LogLevel logLevel, const char *format, const char *function, ...)
 {
     PROCESS_ARGS(format, function);
-    _log(_message, function, LogLevel::VERBOSE);
+    _log(_message, function, logLevel);
 }
 
 /**
- * @brief Logs a debug message.
+ * @brief Logs the duration of a scope timed by a LogScopedTimer.
  *
- * This method logs a debug message with the provided format and function name.
+ * The duration and the line of the timer are saved as typed fields, so the
+ * message is not formatted. Marked cold, as _logFormatted().
  *
- * @param format Format of the message.
- * @param function Name of the function where the message is logged. 
- * @param ... Arguments to be formatted into the message using the printf format.
+ * @param logLevel Log level of the record.
+ * @param function Name of the function where the scope is.
+ * @param label Message of the record, naming what was timed.
+ * @param durationUs Duration of the scope in microseconds.
+ * @param line Line of the timer in the source file.
 */
-void AdvancedLogger::debug(const char *format, const char *function = "unknown", ...)
+void AdvancedLogger::_logDuration(LogLevel logLevel, const char *function, const char *label, uint64_t durationUs, int line)
 {
-    PROCESS_ARGS(format, function);
-    _log(_message, function, LogLevel::DEBUG);
+    LogRecordBuilder(this, logLevel, function, label).kv("us", (unsigned long long)durationUs).kv("line", line);
 }
 
 /**
- * @brief Logs an info message.
+ * @brief Logs a message with a specific log level.
  *
- * This method logs an info message with the provided format and function name.
+ * This method logs a message with the provided function name and log level,
+ * and optionally typed key-value fields, which are saved as they are and
+ * only rendered as text for the Serial and the callback.
  *
- * @param format Format of the message.
+ * @param message Message to log.
  * @param function Name of the function where the message is logged. 
- * @param ... Arguments to be formatted into the message using the printf format.
+ * @param logLevel Log level of the message.
+ * @param fields Encoded fields, starting with their length, or nullptr.
+ * @param fieldsLength Length of the encoded fields, including their length.
 */
-void AdvancedLogger::info(const char *format, const char *function = "unknown", ...)
+void AdvancedLogger::_log(const char *message, const char *function, LogLevel logLevel, const uint8_t *fields, size_t fieldsLength)
 {
-    PROCESS_ARGS(format, function);
-    _log(_message, function, LogLevel::INFO);
-}
+    if ((logLevel < _printLevel) && !_isKept(logLevel)) return;
 
-/**
- * @brief Logs a warning message.
- *
- * This method logs a warning message with the provided format and function name.
- *
- * @param format Format of the message.
- * @param function Name of the function where the message is logged. 
- * @param ... Arguments to be formatted into the message using the printf format.
-*/
-void AdvancedLogger::warning(const char *format, const char *function = "unknown", ...)
-{
-    PROCESS_ARGS(format, function);
-    _log(_message, function, LogLevel::WARNING);
-}
+    uint64_t monotonicUs = esp_timer_get_time();
+    uint64_t wallUs;
+    char _timestamp[TIMESTAMP_BUFFER_SIZE];
+    time_t second = _stampRecord(monotonicUs, wallUs, _timestamp, logLevel, function);
+    uint8_t taskId = _currentTaskId();
 
-/**
- * @brief Logs an error message.
- *
- * This method logs an error message with the provided format and function name.
- *
- * @param format Format of the message.
- * @param function Name of the function where the message is logged. 
- * @param ... Arguments to be formatted into the message using the printf format.
-*/
-void AdvancedLogger::error(const char *format, const char *function = "unknown", ...)
-{
-    PROCESS_ARGS(format, function);
-    _log(_message, function, LogLevel::ERROR);
+    char _messageFormatted[MAX_LOG_LENGTH];
+
+    // The body is formatted right after the prefix, so that only the body is saved
+    int prefixLength = snprintf(
+        _messageFormatted,
+        sizeof(_messageFormatted),
+        LOG_PREFIX_FORMAT,
+        _timestamp,
+        _formatMillis(monotonicUs / 1000).c_str());
+    prefixLength = min(max(prefixLength, 0), (int)sizeof(_messageFormatted) - 1);
+    char *_messageBody = _messageFormatted + prefixLength;
+
+    snprintf(
+        _messageBody,
+        sizeof(_messageFormatted) - prefixLength,
+        LOG_BODY_FORMAT,
+        logLevelToString(logLevel, false),
+        CORE_ID,
+        function,
+        message);
+
+    uint8_t _fieldsWithContext[LOG_FIELDS_MAX_SIZE];
+    if (_context != nullptr)
+    {
+        fieldsLength = _captureContext(_fieldsWithContext, fields, fieldsLength);
+        fields = _fieldsWithContext;
+    }
+
+    // The fields are rendered after a copy of the message, which is what the callback receives, only if an output shows them
+    char _messageWithFields[MAX_LOG_LENGTH];
+    size_t messageLength = 0;
+    size_t fieldsEnd = 0;
+    bool rendered = fields != nullptr &&
+                    (logLevel >= _printLevel || _liveRing.active() || _hasCallback.load(std::memory_order_relaxed));
+    _messageWithFields[0] = '\0';
+    if (rendered)
+    {
+        messageLength = min(strlen(message), sizeof(_messageWithFields) - 1);
+        memcpy(_messageWithFields, message, messageLength);
+        _formatFields(
+            _messageWithFields + messageLength,
+            sizeof(_messageWithFields) - messageLength,
+            fields + LOG_FIELDS_HEADER_SIZE,
+            fieldsLength - LOG_FIELDS_HEADER_SIZE,
+            LogDumpFormat::TEXT);
+        fieldsEnd = strlen(_messageWithFields);
+    }
+
+    // The end of the line follows the body: the fields, if any, and the task
+    const char *_lineEnd = _messageWithFields + messageLength;
+    if (logLevel >= _printLevel || _liveRing.active())
+    {
+        snprintf(_messageWithFields + fieldsEnd, sizeof(_messageWithFields) - fieldsEnd, LOG_TASK_FORMAT, _taskNames[taskId]);
+    }
+
+    if (logLevel >= _printLevel)
+    {
+        Serial.print(_messageFormatted);
+        Serial.println(_lineEnd);
+    }
+
+    if (_liveRing.active())
+    {
+        _lock();
+        _liveRing.write(_messageFormatted, strlen(_messageFormatted), _lineEnd, strlen(_lineEnd));
+        _unlock();
+    }
+
+    if (_isKept(logLevel))
+    {
+        _lock();
+        if (fields != nullptr)
+        {
+            _save(LogFrameType::FIELDS, fields, fieldsLength, (const uint8_t *)_messageBody, strlen(_messageBody), logLevel, monotonicUs, wallUs, taskId);
+        }
+        else
+        {
+            _save(LogFrameType::TEXT, (const uint8_t *)_messageBody, strlen(_messageBody), nullptr, 0, logLevel, monotonicUs, wallUs, taskId);
+        }
+        _unlock();
+    }
+
+    if (_hasCallback.load(std::memory_order_relaxed)) {
+        _messageWithFields[fieldsEnd] = '\0';
+        _queueCallback(second, _timestamp, logLevel, function, rendered ? _messageWithFields : message);
+    }
+
+    if ((int)logLevel >= _watchMinLevel) _checkWatches(message, function, logLevel);
 }
 
 /**
- * @brief Logs a fatal message.
+ * @brief Invokes the callbacks of the watches whose pattern is in a message.
  *
- * This method logs a fatal message with the provided format and function name.
+ * All the patterns are matched in a single pass over the message. The
+ * callbacks are invoked on the logging task, after the lock is released,
+ * and the records they log are not matched again, so that a callback
+ * logging its trigger cannot loop.
  *
- * @param format Format of the message.
- * @param function Name of the function where the message is logged. 
- * @param ... Arguments to be formatted into the message using the printf format.
+ * @param message Message of the record, without its fields.
+ * @param function Name of the function where the message is logged.
+ * @param logLevel Log level of the message.
 */
-void AdvancedLogger::fatal(const char *format, const char *function = "unknown", ...)
+void AdvancedLogger::_checkWatches(const char *message, const char *function, LogLevel logLevel)
 {
-    PROCESS_ARGS(format, function);
-    _log(_message, function, LogLevel::FATAL);
+    if (_inWatch) return;
+
+    uint16_t matched[LOG_WATCH_MAX_MATCHES];
+    LogWatchCallback callbacks[LOG_WATCH_MAX_MATCHES];
+    size_t triggered;
+
+    _lock();
+    // The level is checked while matching, so that the watches of lower levels never take the room of the others
+    triggered = _watchMatcher.match(message, strlen(message), matched, LOG_WATCH_MAX_MATCHES, [this, logLevel](uint16_t watchId) {
+        const LogWatch &watch = _watches[watchId];
+        return logLevel >= watch.minLevel && watch.callback;
+    });
+    for (size_t i = 0; i < triggered; i++) callbacks[i] = _watches[matched[i]].callback;
+    _unlock();
+
+    _inWatch = true;
+    for (size_t i = 0; i < triggered; i++) callbacks[i](matched[i], logLevelToString(logLevel), function, message);
+    _inWatch = false;
 }
 
 /**
- * @brief Logs a message with a specific log level.
+ * @brief Logs a block of raw bytes, such as a protocol frame.
  *
- * This method logs a message with the provided format, function name, and log level.
+ * The bytes are saved as they are, and only rendered as hex when printed,
+ * dumped or passed to the callback. Blocks longer than LOG_BYTES_MAX_DATA_SIZE
+ * are truncated.
  *
- * @param format Format of the message.
- * @param function Name of the function where the message is logged. 
- * @param logLevel Log level of the message.
- * @param ... Arguments to be formatted into the message using the printf format.
+ * @param logLevel Log level of the block.
+ * @param function Name of the function where the block is logged.
+ * @param data Bytes to log.
+ * @param length Number of bytes to log.
 */
-void AdvancedLogger::_log(const char *message, const char *function, LogLevel logLevel)
+void AdvancedLogger::_logBytes(LogLevel logLevel, const char *function, const uint8_t *data, size_t length)
 {
-    if ((logLevel < _printLevel) && (logLevel < _saveLevel)) return;
+    if ((logLevel < _printLevel) && !_isKept(logLevel)) return;
 
-    char _messageFormatted[MAX_LOG_LENGTH];
+    uint64_t monotonicUs = esp_timer_get_time();
+    uint64_t wallUs;
+    char _timestamp[TIMESTAMP_BUFFER_SIZE];
+    time_t second = _stampRecord(monotonicUs, wallUs, _timestamp, logLevel, function);
+    uint8_t taskId = _currentTaskId();
 
-    snprintf(
-        _messageFormatted,
-        sizeof(_messageFormatted),
-        LOG_FORMAT,
-        _getTimestamp().c_str(),
-        _formatMillis(millis()).c_str(),
-        logLevelToString(logLevel, false),
-        CORE_ID,
-        function,
-        message);
+    // The room left by a short function name is given to the bytes
+    size_t functionLength = min(strlen(function), LOG_BYTES_MAX_FUNCTION_LENGTH);
+    length = min(length, LOG_BYTES_MAX_DATA_SIZE + LOG_BYTES_MAX_FUNCTION_LENGTH - functionLength);
+
+    uint8_t header[LOG_BYTES_HEADER_SIZE + LOG_BYTES_MAX_FUNCTION_LENGTH];
+    header[0] = (uint8_t)logLevel;
+    header[1] = (uint8_t)CORE_ID;
+    header[2] = (uint8_t)functionLength;
+    memcpy(header + LOG_BYTES_HEADER_SIZE, function, functionLength);
 
-    Serial.println(_messageFormatted);
+    if (logLevel >= _printLevel)
+    {
+        Serial.printf(LOG_PREFIX_FORMAT, _timestamp, _formatMillis(monotonicUs / 1000).c_str());
+        _printBytes(Serial, header, LOG_BYTES_HEADER_SIZE + functionLength, data, length, _taskNames[taskId]);
+    }
 
-    if (logLevel >= _saveLevel)
+    if (_isKept(logLevel))
     {
-        _save(_messageFormatted);
+        _lock();
+        _save(LogFrameType::BYTES, header, LOG_BYTES_HEADER_SIZE + functionLength, data, length, logLevel, monotonicUs, wallUs, taskId);
+        _unlock();
     }
 
-    if (_callback) {
-        _callback(
-            _getTimestamp().c_str(),
-            millis(),
-            logLevelToStringLower(logLevel),
+    if (_liveRing.active())
+    {
+        // A single line, as for the callback, rather than the hexdump: the bytes are the message of LOG_BODY_FORMAT
+        char _messageFormatted[MAX_LOG_LENGTH];
+        int lineLength = snprintf(
+            _messageFormatted,
+            sizeof(_messageFormatted),
+            LOG_PREFIX_FORMAT,
+            _timestamp,
+            _formatMillis(monotonicUs / 1000).c_str());
+        lineLength = min(max(lineLength, 0), (int)sizeof(_messageFormatted) - 1);
+        lineLength += snprintf(
+            _messageFormatted + lineLength,
+            sizeof(_messageFormatted) - lineLength,
+            LOG_BODY_FORMAT,
+            logLevelToString(logLevel, false),
             CORE_ID,
             function,
-            message
-        );
+            "");
+        lineLength = min(max(lineLength, 0), (int)sizeof(_messageFormatted) - 1);
+        _formatHex(_messageFormatted + lineLength, sizeof(_messageFormatted) - lineLength, data, length);
+        lineLength = strlen(_messageFormatted);
+        snprintf(_messageFormatted + lineLength, sizeof(_messageFormatted) - lineLength, LOG_TASK_FORMAT, _taskNames[taskId]);
+
+        _lock();
+        _liveRing.write(_messageFormatted, strlen(_messageFormatted));
+        _unlock();
+    }
+
+    if (_hasCallback.load(std::memory_order_relaxed)) {
+        char _message[MAX_LOG_LENGTH];
+        _formatHex(_message, sizeof(_message), data, length);
+        _queueCallback(second, _timestamp, logLevel, function, _message);
     }
 }
 
 /**
- * @brief Logs a message with a specific log level and prints it.
+ * @brief Logs the beginning or the end of a span traced by a LogSpan.
  *
- * This method logs a message with the provided format, function name, and log level.
- * It also prints the message to the Serial monitor.
+ * The span is saved as a SPAN frame, with the name of the span as the
+ * function, and is rendered as "span begin id=12 parent=3" or
+ * "span end id=12 parent=3 us=7312" for the Serial, the live subscribers,
+ * the callback and dump(). Spans do not carry the context of the task.
  *
- * @param format Format of the message.
- * @param function Name of the function where the message is logged. 
- * @param logLevel Log level of the message.
- * @param ... Arguments to be formatted into the message using the printf format.
+ * @param logLevel Log level of the span.
+ * @param name Name of the span.
+ * @param span Phase, ids and duration of the span.
+ * @param monotonicUs Time of the beginning or of the end of the span.
 */
-void AdvancedLogger::_logPrint(const char *format, const char *function, LogLevel logLevel, ...)
+void AdvancedLogger::_logSpan(LogLevel logLevel, const char *name, const LogFrameSpan &span, uint64_t monotonicUs)
 {
-    if (logLevel < _printLevel && (logLevel < _saveLevel)) return;
+    if ((logLevel < _printLevel) && !_isKept(logLevel)) return;
+
+    uint64_t wallUs;
+    char _timestamp[TIMESTAMP_BUFFER_SIZE];
+    time_t second = _stampRecord(monotonicUs, wallUs, _timestamp, logLevel, name);
+    uint8_t taskId = _currentTaskId();
+
+    size_t nameLength = min(strlen(name), LOG_BYTES_MAX_FUNCTION_LENGTH);
+    uint8_t header[LOG_BYTES_HEADER_SIZE + LOG_BYTES_MAX_FUNCTION_LENGTH];
+    header[0] = (uint8_t)logLevel;
+    header[1] = (uint8_t)CORE_ID;
+    header[2] = (uint8_t)nameLength;
+    memcpy(header + LOG_BYTES_HEADER_SIZE, name, nameLength);
+    uint8_t data[LOG_SPAN_DATA_SIZE];
+    logFramePutSpan(data, span);
+    char _message[LOG_SPAN_MESSAGE_SIZE];
+    logFrameFormatSpan(_message, sizeof(_message), span);
 
-    PROCESS_ARGS(format, logLevel);
-    char logMessage[MAX_LOG_LENGTH + 200];
+    char _messageFormatted[MAX_LOG_LENGTH];
+    if (logLevel >= _printLevel || _liveRing.active())
+    {
+        int lineLength = snprintf(
+            _messageFormatted,
+            sizeof(_messageFormatted),
+            LOG_PREFIX_FORMAT,
+            _timestamp,
+            _formatMillis(monotonicUs / 1000).c_str());
+        lineLength = min(max(lineLength, 0), (int)sizeof(_messageFormatted) - 1);
+        lineLength += snprintf(
+            _messageFormatted + lineLength,
+            sizeof(_messageFormatted) - lineLength,
+            LOG_SPAN_FORMAT,
+            logLevelToString(logLevel, false),
+            CORE_ID,
+            (int)nameLength,
+            name,
+            _message);
+        lineLength = min(max(lineLength, 0), (int)sizeof(_messageFormatted) - 1);
+        snprintf(_messageFormatted + lineLength, sizeof(_messageFormatted) - lineLength, LOG_TASK_FORMAT, _taskNames[taskId]);
+    }
 
-    snprintf(
-        logMessage,
-        sizeof(logMessage),
-        LOG_FORMAT,
-        _getTimestamp().c_str(),
-        _formatMillis(millis()).c_str(),
-        logLevelToString(logLevel, false),
-        CORE_ID,
-        function,
-        _message);
+    if (logLevel >= _printLevel) Serial.println(_messageFormatted);
 
-    Serial.println(logMessage);
+    if (_isKept(logLevel))
+    {
+        _lock();
+        _save(LogFrameType::SPAN, header, LOG_BYTES_HEADER_SIZE + nameLength, data, sizeof(data), logLevel, monotonicUs, wallUs, taskId);
+        _unlock();
+    }
+
+    if (_liveRing.active())
+    {
+        _lock();
+        _liveRing.write(_messageFormatted, strlen(_messageFormatted));
+        _unlock();
+    }
+
+    if (_hasCallback.load(std::memory_order_relaxed)) _queueCallback(second, _timestamp, logLevel, name, _message);
 }
 
 /**
- * @brief Sets the print level.
+ * @brief Pushes an entry to the logging context of the current task.
  *
- * This method sets the print level to the provided log level.
+ * The entry is added as a field to every message logged by the task until
+ * it is popped, and must stay alive until then. LogContextScope does both
+ * for the lifetime of a scope.
  *
- * @param logLevel Log level to set.
+ * @param context Entry to push.
 */
-void AdvancedLogger::setPrintLevel(LogLevel logLevel)
+void AdvancedLogger::pushContext(LogContext &context)
 {
-    debug("Setting print level to %s", "AdvancedLogger::setPrintLevel", logLevelToString(logLevel));
-    _printLevel = logLevel;
-    _saveConfigToSpiffs();
+    context.parent = _context;
+    _context = &context;
 }
 
 /**
- * @brief Sets the save level.
- *
- * This method sets the save level to the provided log level.
- *
- * @param logLevel Log level to set.
+ * @brief Pops the last entry pushed to the logging context of the current task.
 */
-void AdvancedLogger::setSaveLevel(LogLevel logLevel)
+void AdvancedLogger::popContext()
 {
-    debug("Setting save level to %s", "AdvancedLogger::setSaveLevel", logLevelToString(logLevel));
-    _saveLevel = logLevel;
-    _saveConfigToSpiffs();
+    if (_context != nullptr) _context = _context->parent;
 }
 
 /**
- * @brief Gets the print level.
+ * @brief Encodes the context of the current task followed by the fields of a record.
  *
- * This method returns the current print level.
+ * The context entries are copied as already encoded, from the first pushed
+ * to the last, up to LOG_CONTEXT_MAX_DEPTH. Fields which do not fit are left out.
  *
- * @return LogLevel Current print level.
+ * @param buffer Destination buffer, LOG_FIELDS_MAX_SIZE bytes long.
+ * @param fields Encoded fields of the record, starting with their length, or nullptr.
+ * @param fieldsLength Length of the encoded fields, including their length.
+ * @return size_t Length of the encoded context and fields, including their length.
 */
-LogLevel AdvancedLogger::getPrintLevel()
+size_t AdvancedLogger::_captureContext(uint8_t *buffer, const uint8_t *fields, size_t fieldsLength)
 {
-    return _printLevel;
+    const LogContext *entries[LOG_CONTEXT_MAX_DEPTH];
+    int depth = 0;
+    for (const LogContext *context = _context; context != nullptr; context = context->parent)
+    {
+        // Only the first pushed entries are kept if the context is deeper than the limit
+        if (depth == LOG_CONTEXT_MAX_DEPTH) memmove(entries, entries + 1, (depth - 1) * sizeof(entries[0]));
+        else depth++;
+        entries[depth - 1] = context;
+    }
+
+    size_t length = LOG_FIELDS_HEADER_SIZE;
+    for (int i = depth - 1; i >= 0; i--)
+    {
+        if (length + entries[i]->fieldLength > LOG_FIELDS_MAX_SIZE) break;
+        memcpy(buffer + length, entries[i]->field, entries[i]->fieldLength);
+        length += entries[i]->fieldLength;
+    }
+
+    // Fields are copied whole, as far as they fit
+    size_t offset = LOG_FIELDS_HEADER_SIZE;
+    LogFrameField field;
+    size_t fieldSize;
+    while (fields != nullptr &&
+           (fieldSize = logFrameReadField(fields + offset, fieldsLength - offset, field)) > 0 &&
+           length + fieldSize <= LOG_FIELDS_MAX_SIZE)
+    {
+        memcpy(buffer + length, fields + offset, fieldSize);
+        length += fieldSize;
+        offset += fieldSize;
+    }
+
+    logFramePutU16(buffer, (uint16_t)(length - LOG_FIELDS_HEADER_SIZE));
+    return length;
 }
 
 /**
- * @brief Gets the save level.
+ * @brief Gets the unix time and the formatted timestamp of a new record, and counts it.
  *
- * This method returns the current save level.
+ * The timestamp is only formatted again when the second changes. The record
+ * is counted in the statistics under the same lock.
  *
- * @return LogLevel Current save level.
+ * @param monotonicUs Monotonic time of the record.
+ * @param wallUs Set to the unix time of the record in microseconds.
+ * @param timestamp Destination of the formatted timestamp, TIMESTAMP_BUFFER_SIZE bytes long.
+ * @param logLevel Log level of the record.
+ * @param function Name of the function where the record is logged.
+ * @return time_t Unix time of the record in seconds.
 */
-LogLevel AdvancedLogger::getSaveLevel()
+time_t AdvancedLogger::_stampRecord(uint64_t monotonicUs, uint64_t &wallUs, char *timestamp, LogLevel logLevel, const char *function)
 {
-    return _saveLevel;
+    _lock();
+    _stats.add((uint8_t)logLevel, function, (uint32_t)(monotonicUs / 1000000));
+    wallUs = _wallClockUs(monotonicUs);
+    time_t second = (time_t)(wallUs / 1000000);
+    if (second != _timestampSecond)
+    {
+        _formatTimestamp(second, _timestampCache, sizeof(_timestampCache));
+        _timestampSecond = second;
+    }
+    memcpy(timestamp, _timestampCache, TIMESTAMP_BUFFER_SIZE);
+    _unlock();
+    return second;
 }
 
 /**
- * @brief Sets the configuration to default.
+ * @brief Gets the id of the current task.
  *
- * This method sets the configuration to the default values.
+ * The name of the task is only resolved on its first record, and its id is
+ * then cached in thread-local storage, so that a record only stores the id.
+ * Tasks with the same name share an id, so that tasks created and deleted
+ * repeatedly do not use up the table. The table is filled without taking
+ * any lock, as records are logged concurrently from both cores.
+ *
+ * @return uint8_t Id of the current task, 0 if the table is full.
 */
-void AdvancedLogger::setDefaultConfig()
+uint8_t AdvancedLogger::_currentTaskId()
 {
-    debug("Setting config to default...", "AdvancedLogger::setDefaultConfig");
+    if (_taskId != LOG_TASK_UNRESOLVED) return _taskId;
 
-    setPrintLevel(DEFAULT_PRINT_LEVEL);
-    setSaveLevel(DEFAULT_SAVE_LEVEL);
-    setMaxLogLines(DEFAULT_MAX_LOG_LINES);
+    const char *name = pcTaskGetName(nullptr);
+    if (name == nullptr) name = "";
 
-    debug("Config set to default", "AdvancedLogger::setDefaultConfig");
+    uint32_t ready = _taskNamesReady.load(std::memory_order_acquire);
+    for (int id = 1; id < LOG_TASK_COUNT; id++)
+    {
+        if ((ready & (1UL << id)) && strncmp(_taskNames[id], name, LOG_TASK_NAME_SIZE - 1) == 0)
+        {
+            _taskId = (uint8_t)id;
+            return _taskId;
+        }
+    }
+
+    int id = _taskCount.load(std::memory_order_relaxed);
+    do
+    {
+        if (id >= LOG_TASK_COUNT)
+        {
+            _taskId = 0;
+            return _taskId;
+        }
+    } while (!_taskCount.compare_exchange_weak(id, id + 1, std::memory_order_relaxed));
+
+    // Two tasks of the same name resolved at the same time get two ids, which is harmless
+    strncpy(_taskNames[id], name, LOG_TASK_NAME_SIZE - 1);
+    _taskNames[id][LOG_TASK_NAME_SIZE - 1] = '\0';
+    _taskNamesReady.fetch_or(1UL << id, std::memory_order_release);
+    _taskId = (uint8_t)id;
+    return _taskId;
 }
 
 /**
- * @brief Sets the maximum number of log lines.
+ * @brief Prints the body of a BYTES record, followed by a hexdump of its bytes.
  *
- * This method sets the maximum number of log lines to the provided value.
- *
- * @param maxLogLines Maximum number of log lines.
+ * @param stream Stream to print to.
+ * @param header Level, core, function name length and function name, as stored in a BYTES frame.
+ * @param headerLength Length of the header.
+ * @param data Bytes of the record.
+ * @param length Number of bytes.
+ * @param task Name of the task of the record, which ends the first line.
 */
-bool AdvancedLogger::_setConfigFromSpiffs()
+void AdvancedLogger::_printBytes(Print &stream, const uint8_t *header, size_t headerLength, const uint8_t *data, size_t length, const char *task)
 {
-    debug("Setting config from filesystem...", "AdvancedLogger::_setConfigFromSpiffs");
-
-    File _file = SPIFFS.open(_configFilePath, "r");
-    if (!_file)
-    {
-        Serial.printf("Failed to open config file for reading");
-        _logPrint("Failed to open config file", "AdvancedLogger::_setConfigFromSpiffs", LogLevel::ERROR);
-        return false;
-    }
-
-    int _loopCount = 0;
-    while (_file.available() && _loopCount < MAX_WHILE_LOOP_COUNT)
+    char line[MAX_LOG_LENGTH];
+    int functionLength = (int)min((size_t)header[2], headerLength - LOG_BYTES_HEADER_SIZE);
+    int lineLength = snprintf(
+        line,
+        sizeof(line),
+        LOG_BYTES_FORMAT,
+        logLevelToString((LogLevel)header[0], false),
+        header[1],
+        functionLength,
+        (const char *)header + LOG_BYTES_HEADER_SIZE,
+        (unsigned int)length);
+    lineLength = min(max(lineLength, 0), (int)sizeof(line) - 1);
+    snprintf(line + lineLength, sizeof(line) - lineLength, LOG_TASK_FORMAT, task);
+    stream.println(line);
+
+    for (size_t offset = 0; offset < length; offset += LOG_HEXDUMP_BYTES_PER_LINE)
     {
-        _loopCount++;
-        String line = _file.readStringUntil('\n');
-        int separatorPosition = line.indexOf('=');
-        String key = line.substring(0, separatorPosition);
-        String value = line.substring(separatorPosition + 1);
-        value.trim();
-
-        if (key == "printLevel")
-        {
-            setPrintLevel(_charToLogLevel(value.c_str()));
-        }
-        else if (key == "saveLevel")
+        size_t count = min(length - offset, LOG_HEXDUMP_BYTES_PER_LINE);
+        int position = snprintf(line, sizeof(line), "    %04x ", (unsigned int)offset);
+        for (size_t i = 0; i < LOG_HEXDUMP_BYTES_PER_LINE; i++)
         {
-            setSaveLevel(_charToLogLevel(value.c_str()));
+            if (i < count) position += snprintf(line + position, sizeof(line) - position, " %02x", data[offset + i]);
+            else position += snprintf(line + position, sizeof(line) - position, "   ");
         }
-        else if (key == "maxLogLines")
+        position += snprintf(line + position, sizeof(line) - position, "  |");
+        for (size_t i = 0; i < count; i++)
         {
-            setMaxLogLines(value.toInt());
+            uint8_t byte = data[offset + i];
+            line[position++] = (byte >= 0x20 && byte < 0x7F) ? (char)byte : '.';
         }
+        line[position++] = '|';
+        line[position] = '\0';
+        stream.println(line);
     }
-
-    _file.close();
-
-    debug("Config set from filesystem", "AdvancedLogger::_setConfigFromSpiffs");
-    return true;
+}
+
+/**
+ * @brief Formats bytes as hex on a single line, for the callback.
+ *
+ * If the bytes do not fit, the line ends with " ..." after the last byte that fits.
+ *
+ * @param buffer Destination buffer.
+ * @param size Size of the destination buffer.
+ * @param data Bytes to format.
+ * @param length Number of bytes.
+*/
+void AdvancedLogger::_formatHex(char *buffer, size_t size, const uint8_t *data, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t position = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        // Room for " ..." is kept as long as more bytes follow
+        if (position + 3 + (i + 1 < length ? 4 : 0) >= size)
+        {
+            if (position + 4 < size)
+            {
+                memcpy(buffer + position, " ...", 4);
+                position += 4;
+            }
+            break;
+        }
+        if (i > 0) buffer[position++] = ' ';
+        buffer[position++] = digits[data[i] >> 4];
+        buffer[position++] = digits[data[i] & 0x0F];
+    }
+    buffer[position] = '\0';
+}
+
+/**
+ * @brief Renders the typed fields of a record.
+ *
+ * As text, each field is rendered as " key=value", quoting the strings which
+ * contain spaces, quotes or equal signs. As JSON, each field is rendered as
+ * a member preceded by a comma, to be appended to an object. Fields which do
+ * not fit in the buffer are left out.
+ *
+ * @param buffer Destination buffer.
+ * @param size Size of the destination buffer.
+ * @param fields Encoded fields, without their length.
+ * @param length Length of the encoded fields.
+ * @param format Whether to render the fields as text or as JSON.
+ * @return size_t Number of characters written, excluding the terminator.
+*/
+size_t AdvancedLogger::_formatFields(char *buffer, size_t size, const uint8_t *fields, size_t length, LogDumpFormat format)
+{
+    bool json = format == LogDumpFormat::JSON;
+    size_t position = 0;
+    size_t offset = 0;
+    LogFrameField field;
+    size_t fieldSize;
+    buffer[0] = '\0';
+    while ((fieldSize = logFrameReadField(fields + offset, length - offset, field)) > 0)
+    {
+        offset += fieldSize;
+
+        char value[32];
+        bool quoted = false;
+        switch (field.type)
+        {
+        case LogFieldType::INT:
+            snprintf(value, sizeof(value), "%lld", (long long)(int64_t)field.bits);
+            break;
+        case LogFieldType::UINT:
+            snprintf(value, sizeof(value), "%llu", (unsigned long long)field.bits);
+            break;
+        case LogFieldType::FLOAT:
+        {
+            double number;
+            memcpy(&number, &field.bits, sizeof(number));
+            if (json && !isfinite(number)) snprintf(value, sizeof(value), "null");
+            else snprintf(value, sizeof(value), "%.10g", number);
+            break;
+        }
+        case LogFieldType::BOOL:
+            snprintf(value, sizeof(value), "%s", field.bits ? "true" : "false");
+            break;
+        default:
+            quoted = json || field.stringLength == 0;
+            for (size_t i = 0; i < field.stringLength && !quoted; i++)
+            {
+                char c = field.string[i];
+                quoted = c == ' ' || c == '"' || c == '=' || c == '\\' || (uint8_t)c < 0x20;
+            }
+            break;
+        }
+
+        // Escaping at most doubles the characters of the key and of a string
+        size_t worst = 6 + 2 * field.keyLength + (field.type == LogFieldType::STRING ? 2 * field.stringLength : strlen(value));
+        if (position + worst >= size) break;
+
+        buffer[position++] = json ? ',' : ' ';
+        if (json) buffer[position++] = '"';
+        for (size_t i = 0; i < field.keyLength; i++)
+        {
+            char c = field.key[i];
+            if (json && (c == '"' || c == '\\')) buffer[position++] = '\\';
+            buffer[position++] = ((uint8_t)c < 0x20) ? '_' : c;
+        }
+        if (json) buffer[position++] = '"';
+        buffer[position++] = json ? ':' : '=';
+
+        if (field.type != LogFieldType::STRING)
+        {
+            size_t valueLength = strlen(value);
+            memcpy(buffer + position, value, valueLength);
+            position += valueLength;
+        }
+        else
+        {
+            if (quoted) buffer[position++] = '"';
+            for (size_t i = 0; i < field.stringLength; i++)
+            {
+                char c = field.string[i];
+                if (quoted && (c == '"' || c == '\\')) buffer[position++] = '\\';
+                buffer[position++] = ((uint8_t)c < 0x20) ? ' ' : c;
+            }
+            if (quoted) buffer[position++] = '"';
+        }
+        buffer[position] = '\0';
+    }
+    return position;
+}
+
+/**
+ * @brief Passes a record to the callback.
+ *
+ * The record is copied to a block of the record pool and queued to the
+ * callback task without waiting, so that a slow callback never delays
+ * the log call: if the queue or the pool is full, the record is dropped
+ * and counted. Records logged by the callback itself are not queued, to
+ * avoid a feedback loop. Before begin() creates the callback task, the
+ * callback is invoked directly.
+ *
+ * @param second Unix time of the record.
+ * @param timestamp Formatted timestamp, only used if the callback is invoked directly.
+ * @param logLevel Log level of the record.
+ * @param function Name of the function where the record was logged.
+ * @param message Message of the record.
+*/
+void AdvancedLogger::_queueCallback(time_t second, const char *timestamp, LogLevel logLevel, const char *function, const char *message)
+{
+    if (_callbackTaskHandle == nullptr)
+    {
+        _lock();
+        LogCallback callback = _callback;
+        _unlock();
+        if (callback) callback(timestamp, millis(), logLevelToStringLower(logLevel), CORE_ID, function, message);
+        return;
+    }
+
+    // Passing the records of the callback to itself could never end
+    if (xTaskGetCurrentTaskHandle() == _callbackTaskHandle)
+    {
+        _lock();
+        _callbackStats.dropped++;
+        _unlock();
+        return;
+    }
+
+    // The function name is truncated first, so that the message fits in the largest block
+    const size_t available = LOG_POOL_BLOCK_SIZES[LOG_POOL_CLASS_COUNT - 1] - sizeof(LogCallbackRecord) - 2;
+    size_t messageLength = min(strlen(message), available);
+    size_t functionLength = min(strlen(function), available - messageLength);
+
+    LogCallbackRecord *record = static_cast<LogCallbackRecord *>(
+        _recordPool.acquire(sizeof(LogCallbackRecord) + functionLength + messageLength + 2));
+    if (record != nullptr)
+    {
+        record->second = second;
+        record->millisEsp = millis();
+        record->level = logLevel;
+        record->coreId = CORE_ID;
+        record->functionLength = (uint16_t)functionLength;
+        record->messageLength = (uint16_t)messageLength;
+        char *text = reinterpret_cast<char *>(record + 1);
+        memcpy(text, function, functionLength);
+        text[functionLength] = '\0';
+        memcpy(text + functionLength + 1, message, messageLength);
+        text[functionLength + 1 + messageLength] = '\0';
+
+        if (xQueueSend(_callbackQueue, &record, 0) == pdTRUE) return;
+        _recordPool.release(record);
+    }
+
+    _lock();
+    _callbackStats.dropped++;
+    _checkCallbackDeadline();
+    _unlock();
+}
+
+/**
+ * @brief Counts the running invocation of the callback as an overrun once it exceeds the deadline.
+ *
+ * Called when a record is dropped and when the statistics are read, so
+ * that a callback blocked for a long time is reported while it is still
+ * running. To be called with the lock held.
+*/
+void AdvancedLogger::_checkCallbackDeadline()
+{
+    if (!_callbackRunning || _callbackOverrun) return;
+    if (millis() - _callbackStart <= _callbackDeadline) return;
+
+    _callbackOverrun = true;
+    _callbackStats.overruns++;
+}
+
+/**
+ * @brief Invokes the callback for each queued record.
+ *
+ * Runs on its own task, so that the callback can block (e.g. on a
+ * network request) without delaying the log calls.
+ *
+ * @param parameter AdvancedLogger object.
+*/
+void AdvancedLogger::_callbackTask(void *parameter)
+{
+    AdvancedLogger *logger = static_cast<AdvancedLogger *>(parameter);
+    char timestamp[TIMESTAMP_BUFFER_SIZE];
+    LogCallbackRecord *record = nullptr;
+    // Copied only when it changes, so that the callback runs without the lock and without a copy per record
+    LogCallback callback = nullptr;
+    uint32_t callbackVersion = 0;
+    while (true)
+    {
+        if (xQueueReceive(logger->_callbackQueue, &record, portMAX_DELAY) != pdTRUE) continue;
+
+        const char *function = reinterpret_cast<const char *>(record + 1);
+        const char *message = function + record->functionLength + 1;
+        logger->_formatTimestamp(record->second, timestamp, sizeof(timestamp));
+
+        logger->_lock();
+        logger->_callbackStart = millis();
+        logger->_callbackOverrun = false;
+        logger->_callbackRunning = true;
+        if (callbackVersion != logger->_callbackVersion)
+        {
+            callback = logger->_callback;
+            callbackVersion = logger->_callbackVersion;
+        }
+        logger->_unlock();
+
+        if (callback)
+        {
+            callback(
+                timestamp,
+                record->millisEsp,
+                logLevelToStringLower(record->level),
+                record->coreId,
+                function,
+                message);
+        }
+
+        logger->_lock();
+        unsigned long duration = millis() - logger->_callbackStart;
+        logger->_checkCallbackDeadline();
+        logger->_callbackRunning = false;
+        logger->_callbackStats.invoked++;
+        logger->_callbackStats.maxDuration = max(logger->_callbackStats.maxDuration, (uint32_t)duration);
+        logger->_unlock();
+
+        logger->_recordPool.release(record);
+    }
+}
+
+/**
+ * @brief Logs a message with a specific log level and prints it.
+ *
+ * This method logs a message with the provided format, function name, and log level.
+ * It also prints the message to the Serial monitor.
+ *
+ * @param format Format of the message.
+ * @param function Name of the function where the message is logged. 
+ * @param logLevel Log level of the message.
+ * @param ... Arguments to be formatted into the message using the printf format.
+*/
+void AdvancedLogger::_logPrint(const char *format, const char *function, LogLevel logLevel, ...)
+{
+    if (logLevel < _printLevel && (logLevel < _saveLevel)) return;
+
+    PROCESS_ARGS(format, logLevel);
+    char logMessage[MAX_LOG_LENGTH + 200];
+
+    snprintf(
+        logMessage,
+        sizeof(logMessage),
+        LOG_FORMAT,
+        _getTimestamp().c_str(),
+        _formatMillis(esp_timer_get_time() / 1000).c_str(),
+        logLevelToString(logLevel, false),
+        CORE_ID,
+        function,
+        _message,
+        _taskNames[_currentTaskId()]);
+
+    Serial.println(logMessage);
+}
+
+/**
+ * @brief Sets the print level.
+ *
+ * This method sets the print level to the provided log level.
+ *
+ * @param logLevel Log level to set.
+*/
+void AdvancedLogger::setPrintLevel(LogLevel logLevel)
+{
+    debug("Setting print level to %s", "AdvancedLogger::setPrintLevel", logLevelToString(logLevel));
+    _printLevel = logLevel;
+    _updateMinLevel();
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Sets the save level.
+ *
+ * This method sets the save level to the provided log level.
+ *
+ * @param logLevel Log level to set.
+*/
+void AdvancedLogger::setSaveLevel(LogLevel logLevel)
+{
+    debug("Setting save level to %s", "AdvancedLogger::setSaveLevel", logLevelToString(logLevel));
+    _saveLevel = logLevel;
+    _updateMinLevel();
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the print level.
+ *
+ * This method returns the current print level.
+ *
+ * @return LogLevel Current print level.
+*/
+LogLevel AdvancedLogger::getPrintLevel()
+{
+    return _printLevel;
+}
+
+/**
+ * @brief Gets the save level.
+ *
+ * This method returns the current save level.
+ *
+ * @return LogLevel Current save level.
+*/
+LogLevel AdvancedLogger::getSaveLevel()
+{
+    return _saveLevel;
+}
+
+/**
+ * @brief Sets the configuration to default.
+ *
+ * This method sets the configuration to the default values.
+*/
+void AdvancedLogger::setDefaultConfig()
+{
+    debug("Setting config to default...", "AdvancedLogger::setDefaultConfig");
+
+    // The config is saved once, instead of by each setter
+    _isLoadingConfig = true;
+
+    setPrintLevel(DEFAULT_PRINT_LEVEL);
+    setSaveLevel(DEFAULT_SAVE_LEVEL);
+    setMaxLogLines(DEFAULT_MAX_LOG_LINES);
+    setMaxLogBytes(DEFAULT_MAX_LOG_BYTES);
+    setMaxLogBytes(DEFAULT_MAX_CRITICAL_LOG_BYTES, LogTier::CRITICAL);
+    setCriticalLevel(DEFAULT_CRITICAL_LEVEL);
+    setSyncLevel(DEFAULT_SYNC_LEVEL);
+    setDeadlineLevel(DEFAULT_DEADLINE_LEVEL);
+    setFlushDeadline(DEFAULT_FLUSH_DEADLINE);
+    setFlushInterval(DEFAULT_FLUSH_INTERVAL);
+    setMaxLogAge(DEFAULT_MAX_LOG_AGE);
+    setCallbackDeadline(DEFAULT_CALLBACK_DEADLINE);
+    _isLoadingConfig = false;
+    _saveConfigToSpiffs();
+
+    debug("Config set to default", "AdvancedLogger::setDefaultConfig");
+}
+
+/**
+ * @brief Imports the configuration from the text file.
+ *
+ * The text file has a key=value line per setting, as written by
+ * exportConfig(), so that it can be edited by hand or by a provisioning
+ * tool. The imported settings are then saved in the binary config,
+ * which is the one loaded by begin().
+ *
+ * @return bool Whether the text file was read.
+*/
+bool AdvancedLogger::importConfig()
+{
+    if (!_setConfigFromSpiffs()) return false;
+    _saveConfigToSpiffs();
+    return true;
+}
+
+/**
+ * @brief Exports the configuration to the text file.
+ *
+ * The text file is only written on request, as the configuration is
+ * saved in the binary config whenever a setting changes.
+ *
+ * @return bool Whether the text file was written.
+*/
+bool AdvancedLogger::exportConfig()
+{
+    debug("Exporting config to filesystem...", "AdvancedLogger::exportConfig");
+    File _file = SPIFFS.open(_configFilePath + TEMP_FILE_SUFFIX, "w");
+    if (!_file)
+    {
+        _logPrint("Failed to open config file", "AdvancedLogger::exportConfig", LogLevel::ERROR);
+        return false;
+    }
+
+    _file.println(String("printLevel=") + logLevelToString(_printLevel));
+    _file.println(String("saveLevel=") + logLevelToString(_saveLevel));
+    _file.println(String("maxLogLines=") + String(_maxLogLines));
+    _file.println(String("maxLogBytes=") + String((unsigned long)getMaxLogBytes(LogTier::MAIN)));
+    _file.println(String("maxCriticalLogBytes=") + String((unsigned long)getMaxLogBytes(LogTier::CRITICAL)));
+    _file.println(String("criticalLevel=") + logLevelToString(_criticalLevel));
+    _file.println(String("maxLogAge=") + String((unsigned long)_maxLogAge));
+    _file.println(String("syncLevel=") + logLevelToString(_syncLevel));
+    _file.println(String("deadlineLevel=") + logLevelToString(_deadlineLevel));
+    _file.println(String("flushDeadline=") + String((unsigned long)_flushDeadline));
+    _file.println(String("flushInterval=") + String((unsigned long)_flushInterval));
+    _file.println(String("callbackDeadline=") + String((unsigned long)_callbackDeadline));
+    _file.close();
+
+    if (!_commitTempFile(_configFilePath)) return false;
+    debug("Config exported to filesystem", "AdvancedLogger::exportConfig");
+    return true;
+}
+
+/**
+ * @brief Loads the configuration from the binary config.
+ *
+ * The file holds a single CONFIG frame, which is read at once and checked
+ * by its CRC, so a file torn by a reset while being saved is never applied.
+ * A reset during the rename of _commitTempFile() leaves only the temporary
+ * file, which is recovered first.
+ *
+ * @return bool Whether a valid binary config was loaded.
+*/
+bool AdvancedLogger::_loadConfig()
+{
+    String path = _configFilePath + CONFIG_BINARY_SUFFIX;
+    logFileRecoverRotation(SPIFFS, path);
+    File _file = SPIFFS.open(path, "r");
+    if (!_file) return false;
+
+    uint8_t frame[LOG_FRAME_MAX_SIZE];
+    size_t bytesRead = _file.read(frame, sizeof(frame));
+    _file.close();
+
+    size_t frameSize = logFrameValidate(frame, bytesRead);
+    const uint8_t *payload = frame + LOG_FRAME_HEADER_SIZE;
+    if (frameSize == 0 ||
+        frame[1] != (uint8_t)LogFrameType::CONFIG ||
+        frameSize - LOG_FRAME_OVERHEAD < LOG_CONFIG_PAYLOAD_SIZE ||
+        payload[0] < LOG_CONFIG_VERSION)
+    {
+        _logPrint("Invalid binary config file", "AdvancedLogger::_loadConfig", LogLevel::ERROR);
+        return false;
+    }
+    for (int i = 1; i <= 5; i++)
+    {
+        if (payload[i] > (uint8_t)LogLevel::FATAL)
+        {
+            _logPrint("Invalid level in binary config file", "AdvancedLogger::_loadConfig", LogLevel::ERROR);
+            return false;
+        }
+    }
+
+    // The setters below save the config, which is not needed as it was just loaded
+    _isLoadingConfig = true;
+    setPrintLevel((LogLevel)payload[1]);
+    setSaveLevel((LogLevel)payload[2]);
+    setCriticalLevel((LogLevel)payload[3]);
+    setSyncLevel((LogLevel)payload[4]);
+    setDeadlineLevel((LogLevel)payload[5]);
+    setMaxLogLines((int)logFrameGetU32(payload + 6));
+    setMaxLogBytes(logFrameGetU32(payload + 10));
+    setMaxLogBytes(logFrameGetU32(payload + 14), LogTier::CRITICAL);
+    setMaxLogAge(logFrameGetU32(payload + 18));
+    setFlushDeadline(logFrameGetU32(payload + 22));
+    setFlushInterval(logFrameGetU32(payload + 26));
+    setCallbackDeadline(logFrameGetU32(payload + 30));
+    _isLoadingConfig = false;
+
+    debug("Config loaded from filesystem", "AdvancedLogger::_loadConfig");
+    return true;
+}
+
+/**
+ * @brief Sets the configuration from the text file.
+ *
+ * This method reads the key=value lines of the text file, ignoring the
+ * unknown keys. It is only used to import a text config.
+ *
+ * @return bool Whether the text file was read.
+*/
+bool AdvancedLogger::_setConfigFromSpiffs()
+{
+    debug("Setting config from filesystem...", "AdvancedLogger::_setConfigFromSpiffs");
+
+    File _file = SPIFFS.open(_configFilePath, "r");
+    if (!_file)
+    {
+        Serial.printf("Failed to open config file for reading");
+        _logPrint("Failed to open config file", "AdvancedLogger::_setConfigFromSpiffs", LogLevel::ERROR);
+        return false;
+    }
+
+    // The setters below save the config, which would rewrite the file while it is being read
+    _isLoadingConfig = true;
+
+    int _loopCount = 0;
+    while (_file.available() && _loopCount < MAX_WHILE_LOOP_COUNT)
+    {
+        _loopCount++;
+        String line = _file.readStringUntil('\n');
+        int separatorPosition = line.indexOf('=');
+        String key = line.substring(0, separatorPosition);
+        String value = line.substring(separatorPosition + 1);
+        value.trim();
+
+        if (key == "printLevel")
+        {
+            setPrintLevel(_charToLogLevel(value.c_str()));
+        }
+        else if (key == "saveLevel")
+        {
+            setSaveLevel(_charToLogLevel(value.c_str()));
+        }
+        else if (key == "maxLogLines")
+        {
+            setMaxLogLines(value.toInt());
+        }
+        else if (key == "maxLogBytes")
+        {
+            setMaxLogBytes(value.toInt());
+        }
+        else if (key == "maxCriticalLogBytes")
+        {
+            setMaxLogBytes(value.toInt(), LogTier::CRITICAL);
+        }
+        else if (key == "criticalLevel")
+        {
+            setCriticalLevel(_charToLogLevel(value.c_str()));
+        }
+        else if (key == "maxLogAge")
+        {
+            setMaxLogAge(value.toInt());
+        }
+        else if (key == "syncLevel")
+        {
+            setSyncLevel(_charToLogLevel(value.c_str()));
+        }
+        else if (key == "deadlineLevel")
+        {
+            setDeadlineLevel(_charToLogLevel(value.c_str()));
+        }
+        else if (key == "flushDeadline")
+        {
+            setFlushDeadline(value.toInt());
+        }
+        else if (key == "flushInterval")
+        {
+            setFlushInterval(value.toInt());
+        }
+        else if (key == "callbackDeadline")
+        {
+            setCallbackDeadline(value.toInt());
+        }
+    }
+
+    _file.close();
+    _isLoadingConfig = false;
+
+    debug("Config set from filesystem", "AdvancedLogger::_setConfigFromSpiffs");
+    return true;
 }
 
 /**
  * @brief Saves the configuration to the SPIFFS filesystem.
  *
- * This method saves the configuration to the SPIFFS filesystem.
+ * The configuration is encoded in a single CONFIG frame, written to a
+ * temporary file which then replaces the binary config, so that a reset
+ * never leaves a partially written config behind.
+*/
+void AdvancedLogger::_saveConfigToSpiffs()
+{
+    if (_isLoadingConfig) return;
+
+    debug("Saving config to filesystem...", "AdvancedLogger::_saveConfigToSpiffs");
+    uint8_t payload[LOG_CONFIG_PAYLOAD_SIZE];
+    payload[0] = LOG_CONFIG_VERSION;
+    payload[1] = (uint8_t)_printLevel;
+    payload[2] = (uint8_t)_saveLevel;
+    payload[3] = (uint8_t)_criticalLevel;
+    payload[4] = (uint8_t)_syncLevel;
+    payload[5] = (uint8_t)_deadlineLevel;
+    logFramePutU32(payload + 6, (uint32_t)_maxLogLines);
+    logFramePutU32(payload + 10, (uint32_t)getMaxLogBytes(LogTier::MAIN));
+    logFramePutU32(payload + 14, (uint32_t)getMaxLogBytes(LogTier::CRITICAL));
+    logFramePutU32(payload + 18, _maxLogAge);
+    logFramePutU32(payload + 22, _flushDeadline);
+    logFramePutU32(payload + 26, _flushInterval);
+    logFramePutU32(payload + 30, _callbackDeadline);
+    uint8_t frame[LOG_CONFIG_FRAME_SIZE];
+    size_t frameSize = logFrameEncode(frame, LogFrameType::CONFIG, payload, sizeof(payload));
+
+    String path = _configFilePath + CONFIG_BINARY_SUFFIX;
+    File tempFile = SPIFFS.open(path + TEMP_FILE_SUFFIX, "w");
+    if (!tempFile)
+    {
+        _logPrint("Failed to create temp file", "AdvancedLogger::_saveConfigToSpiffs", LogLevel::ERROR);
+        return;
+    }
+    bool written = tempFile.write(frame, frameSize) == frameSize;
+    tempFile.close();
+
+    if (!written)
+    {
+        SPIFFS.remove(path + TEMP_FILE_SUFFIX);
+        _logPrint("Failed to write config file", "AdvancedLogger::_saveConfigToSpiffs", LogLevel::ERROR);
+        return;
+    }
+    _commitTempFile(path);
+
+    debug("Config saved to filesystem", "AdvancedLogger::_saveConfigToSpiffs");
+}
+
+/**
+ * @brief Sets the maximum number of log lines.
+ *
+ * This method sets the maximum number of log lines to the provided value.
+ * When reached, only the latest 10% of the lines of each tier are kept. This
+ * is kept for compatibility: a value of 0 disables it, leaving only the byte budget.
+ *
+ * @param maxLogLines Maximum number of log lines.
+*/
+void AdvancedLogger::setMaxLogLines(int maxLogLines)
+{
+    debug(
+        ("Setting max log lines to " + String(maxLogLines)).c_str(),
+        "AdvancedLogger::setMaxLogLines");
+    _maxLogLines = maxLogLines;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the number of log lines.
+ *
+ * This method returns the number of log lines in all the tiers of the log.
+ * The value is tracked in memory, so the log is not read.
+ *
+ * @return int Number of log lines.
+*/
+int AdvancedLogger::getLogLines()
+{
+    size_t lines = 0;
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++) lines += _tiers[tier].lines;
+    return (int)lines;
+}
+
+/**
+ * @brief Sets the maximum size of a tier of the log.
+ *
+ * Each tier is stored in LOG_SEGMENT_COUNT segments of maxLogBytes / LOG_SEGMENT_COUNT
+ * bytes each. Whenever the size of the tier exceeds its budget, its oldest segment is
+ * removed as a whole, so no file is ever rewritten to enforce it.
+ *
+ * @param maxLogBytes Maximum size of the tier in bytes.
+ * @param tier Tier to set the budget of.
+*/
+void AdvancedLogger::setMaxLogBytes(size_t maxLogBytes, LogTier tier)
+{
+    debug("Setting max log bytes of tier %d to %u", "AdvancedLogger::setMaxLogBytes", (int)tier, (unsigned int)maxLogBytes);
+    _tiers[(int)tier].maxBytes = maxLogBytes;
+    _saveConfigToSpiffs();
+    _lock();
+    _enforceRetention((int)tier);
+    _unlock();
+}
+
+/**
+ * @brief Gets the maximum size of a tier of the log.
+ *
+ * @param tier Tier to get the budget of.
+ * @return size_t Maximum size of the tier in bytes.
+*/
+size_t AdvancedLogger::getMaxLogBytes(LogTier tier)
+{
+    return _tiers[(int)tier].maxBytes;
+}
+
+/**
+ * @brief Gets the size of the log.
+ *
+ * This method returns the total size of the log segments of all the tiers.
+ * The value is tracked in memory, so no file is opened.
+ *
+ * @return size_t Size of the log in bytes.
+*/
+size_t AdvancedLogger::getLogBytes()
+{
+    size_t bytes = 0;
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++) bytes += _tiers[tier].bytes;
+    return bytes;
+}
+
+/**
+ * @brief Sets the maximum age of the log.
+ *
+ * Segments whose newest record is older than maxLogAge seconds are removed
+ * as a whole. The check is done incrementally while saving records, removing
+ * at most one segment per record, and only once the clock has been set.
+ * Segments are also rolled over every maxLogAge / LOG_SEGMENT_COUNT seconds,
+ * so that old records do not linger in a slowly filling segment.
+ *
+ * @param maxLogAge Maximum age of the log in seconds. 0 disables time-based retention.
+*/
+void AdvancedLogger::setMaxLogAge(uint32_t maxLogAge)
+{
+    debug("Setting max log age to %u s", "AdvancedLogger::setMaxLogAge", (unsigned int)maxLogAge);
+    _maxLogAge = maxLogAge;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the maximum age of the log.
+ *
+ * @return uint32_t Maximum age of the log in seconds, 0 if disabled.
+*/
+uint32_t AdvancedLogger::getMaxLogAge()
+{
+    return _maxLogAge;
+}
+
+/**
+ * @brief Sets the critical level.
+ *
+ * Records at or above this level are saved in the CRITICAL tier, which has its
+ * own byte budget, so that a burst of less severe records cannot push them out.
+ * Records already saved stay in their tier.
+ *
+ * @param logLevel Lowest level saved in the CRITICAL tier.
+*/
+void AdvancedLogger::setCriticalLevel(LogLevel logLevel)
+{
+    debug("Setting critical level to %s", "AdvancedLogger::setCriticalLevel", logLevelToString(logLevel));
+    _criticalLevel = logLevel;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the critical level.
+ *
+ * @return LogLevel Lowest level saved in the CRITICAL tier.
+*/
+LogLevel AdvancedLogger::getCriticalLevel()
+{
+    return _criticalLevel;
+}
+
+/**
+ * @brief Sets the sync level.
+ *
+ * Records at or above this level are written to storage, together with
+ * all the records buffered before them, before the log call returns.
+ * Setting it to VERBOSE writes every record as soon as it is logged.
+ *
+ * @param logLevel Lowest level written synchronously.
+*/
+void AdvancedLogger::setSyncLevel(LogLevel logLevel)
+{
+    debug("Setting sync level to %s", "AdvancedLogger::setSyncLevel", logLevelToString(logLevel));
+    _syncLevel = logLevel;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the sync level.
+ *
+ * @return LogLevel Lowest level written synchronously.
+*/
+LogLevel AdvancedLogger::getSyncLevel()
+{
+    return _syncLevel;
+}
+
+/**
+ * @brief Sets the deadline level.
+ *
+ * Records at or above this level, but below the sync level, are written
+ * to storage within the flush deadline. Less severe records are written
+ * within the flush interval, or earlier if the buffer fills up.
+ *
+ * @param logLevel Lowest level written within the flush deadline.
+*/
+void AdvancedLogger::setDeadlineLevel(LogLevel logLevel)
+{
+    debug("Setting deadline level to %s", "AdvancedLogger::setDeadlineLevel", logLevelToString(logLevel));
+    _deadlineLevel = logLevel;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the deadline level.
+ *
+ * @return LogLevel Lowest level written within the flush deadline.
+*/
+LogLevel AdvancedLogger::getDeadlineLevel()
+{
+    return _deadlineLevel;
+}
+
+/**
+ * @brief Sets the flush deadline.
+ *
+ * @param flushDeadline Maximum time in milliseconds a record at or above the deadline level stays buffered.
+*/
+void AdvancedLogger::setFlushDeadline(uint32_t flushDeadline)
+{
+    debug("Setting flush deadline to %u ms", "AdvancedLogger::setFlushDeadline", (unsigned int)flushDeadline);
+    _flushDeadline = flushDeadline;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the flush deadline.
+ *
+ * @return uint32_t Flush deadline in milliseconds.
+*/
+uint32_t AdvancedLogger::getFlushDeadline()
+{
+    return _flushDeadline;
+}
+
+/**
+ * @brief Sets the flush interval.
+ *
+ * @param flushInterval Maximum time in milliseconds a record below the deadline level stays buffered.
+*/
+void AdvancedLogger::setFlushInterval(uint32_t flushInterval)
+{
+    debug("Setting flush interval to %u ms", "AdvancedLogger::setFlushInterval", (unsigned int)flushInterval);
+    _flushInterval = flushInterval;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the flush interval.
+ *
+ * @return uint32_t Flush interval in milliseconds.
+*/
+uint32_t AdvancedLogger::getFlushInterval()
+{
+    return _flushInterval;
+}
+
+/**
+ * @brief Sets the callback receiving every logged record.
+ *
+ * The callback is replaced under the lock, so it can be changed while
+ * records are being passed to the previous one, which still receives
+ * the record it is running for.
+ *
+ * @param callback Callback to invoke, or nullptr to stop invoking one.
+*/
+void AdvancedLogger::setCallback(LogCallback callback)
+{
+    _lock();
+    _callback = callback;
+    _callbackVersion++;
+    _hasCallback.store((bool)_callback, std::memory_order_relaxed);
+    _unlock();
+}
+
+/**
+ * @brief Sets the callback deadline.
+ *
+ * The callback is not interrupted when it runs past its deadline, as
+ * that could leave its connections in an inconsistent state, but the
+ * invocation is counted as an overrun.
+ *
+ * @param callbackDeadline Maximum time in milliseconds a single invocation of the callback should take.
+*/
+void AdvancedLogger::setCallbackDeadline(uint32_t callbackDeadline)
+{
+    debug("Setting callback deadline to %u ms", "AdvancedLogger::setCallbackDeadline", (unsigned int)callbackDeadline);
+    _callbackDeadline = callbackDeadline;
+    _saveConfigToSpiffs();
+}
+
+/**
+ * @brief Gets the callback deadline.
+ *
+ * @return uint32_t Callback deadline in milliseconds.
+*/
+uint32_t AdvancedLogger::getCallbackDeadline()
+{
+    return _callbackDeadline;
+}
+
+/**
+ * @brief Gets the statistics of the callback task.
+ *
+ * Dropped records mean that the callback could not keep up with the
+ * rate of the log calls, while overruns mean that single invocations
+ * took longer than the callback deadline.
+ *
+ * @return LogCallbackStats Invocations, queued and dropped records, overruns and longest invocation.
+*/
+LogCallbackStats AdvancedLogger::getCallbackStats()
+{
+    _lock();
+    _checkCallbackDeadline();
+    LogCallbackStats stats = _callbackStats;
+    _unlock();
+    if (_callbackQueue != nullptr) stats.queued = uxQueueMessagesWaiting(_callbackQueue);
+    return stats;
+}
+
+/**
+ * @brief Writes all the buffered records to storage.
+ *
+ * To be called before a planned restart or deep sleep, so that the
+ * records still within their flush deadline are not lost.
+*/
+void AdvancedLogger::flush()
+{
+    _lock();
+    _flushAll();
+    _unlock();
+}
+
+/**
+ * @brief Copies the buffered records to the no-init RAM.
+ *
+ * Meant to be called when the system is going down, e.g. from a panic
+ * handler: it takes no lock, allocates nothing and only copies at most
+ * LOG_PANIC_BUFFER_SIZE bytes. The CRITICAL tier is copied first and,
+ * if a tier does not fit, only its newest records are kept. Only the
+ * frames fully encoded are copied, so a frame reserved but not yet
+ * written when the system goes down never hides the ones before it.
+*/
+void IRAM_ATTR AdvancedLogger::emergencyFlush()
+{
+    AdvancedLogger *logger = _panicLogger;
+    if (logger == nullptr) return;
+
+    size_t used = 0;
+    for (int tier = LOG_TIER_COUNT - 1; tier >= 0; tier--)
+    {
+        const uint8_t *buffer = logger->_tiers[tier].buffer.data();
+        size_t size = min(logger->_tiers[tier].encoded.load(std::memory_order_acquire), LOG_WRITE_BUFFER_SIZE);
+
+        // Walk the frames backwards through their trailer, as long as they fit
+        size_t start = size;
+        while (start >= LOG_FRAME_OVERHEAD)
+        {
+            size_t frameSize = logFrameGetU16(buffer + start - LOG_FRAME_TRAILER_SIZE) + LOG_FRAME_OVERHEAD;
+            if (frameSize > start || used + size - (start - frameSize) > LOG_PANIC_BUFFER_SIZE) break;
+            start -= frameSize;
+        }
+
+        memcpy(_panicBuffer.data + used, buffer + start, size - start);
+        _panicBuffer.lengths[tier] = (uint16_t)(size - start);
+        used += size - start;
+    }
+    _panicBuffer.magic = LOG_PANIC_MAGIC;
+}
+
+/**
+ * @brief Saves the records left in the no-init RAM by the emergency flush.
+ *
+ * Each frame is validated before being saved to its tier, and the copy
+ * of a tier stops at the first invalid one. Must be called with the lock
+ * held, after the segments have been loaded.
+*/
+void AdvancedLogger::_recoverPanicBuffer()
+{
+    if (_panicBuffer.magic != LOG_PANIC_MAGIC) return;
+    _panicBuffer.magic = 0;
+
+    size_t offset = 0;
+    unsigned int recovered = 0;
+    for (int tier = LOG_TIER_COUNT - 1; tier >= 0; tier--)
+    {
+        size_t end = min(offset + _panicBuffer.lengths[tier], LOG_PANIC_BUFFER_SIZE);
+        size_t frameSize;
+        while ((frameSize = logFrameValidate(_panicBuffer.data + offset, end - offset)) > 0)
+        {
+            const uint8_t *frame = _panicBuffer.data + offset;
+            offset += frameSize;
+            if (!logFrameIsRecord(frame[1])) continue;
+
+            uint8_t *destination = _reserveFrame(tier, frameSize, logFrameGetU32(frame + LOG_FRAME_HEADER_SIZE));
+            if (destination == nullptr) break;
+            memcpy(destination, frame, frameSize);
+            _commitFrame(tier);
+            recovered++;
+        }
+        offset = end;
+        _enforceRetention(tier);
+    }
+    _flushAll();
+
+    if (recovered > 0)
+    {
+        _logPrint("Saved %u records buffered before the last reset", "AdvancedLogger::_recoverPanicBuffer", LogLevel::WARNING, recovered);
+    }
+}
+
+/**
+ * @brief Starts streaming the logged records to live subscribers.
+ *
+ * The records are appended to a ring in RAM, shared by all the
+ * subscribers, which each read it at their own pace through their
+ * cursor. The ring is the only allocation, and is kept until the logger
+ * is destroyed. Calling it again after a successful call does nothing.
+ *
+ * @param bufferSize Size of the ring in bytes, rounded down to a power of two.
+ * @return bool Whether the ring was allocated.
+*/
+bool AdvancedLogger::startLive(size_t bufferSize)
+{
+    _lock();
+    bool started = _liveRing.begin(bufferSize);
+    _unlock();
+
+    if (!started)
+    {
+        _logPrint("Failed to allocate the live buffer of %u bytes", "AdvancedLogger::startLive", LogLevel::ERROR, (unsigned int)bufferSize);
+    }
+    return started;
+}
+
+/**
+ * @brief Keeps the records below the save level in RAM, to save them along with an error.
+ *
+ * The records at or above minLevel which are not saved are kept as
+ * frames in a ring in RAM, the oldest ones being overwritten. When a
+ * record at or above triggerLevel is saved, the last maxRecords records
+ * of its task (or of all the tasks) are saved right before it, so that
+ * the log shows what led to the error without saving every verbose
+ * record. The kept records older than the last record saved to their
+ * tier are dropped, so that the tiers stay in chronological order. The
+ * ring is the only allocation, and is kept until the logger is
+ * destroyed. Calling it again changes the levels and the number of
+ * records, but not the size of the ring.
+ *
+ * @param minLevel Lowest level kept in RAM.
+ * @param triggerLevel Lowest level of the records triggering the backtrace.
+ * @param maxRecords Maximum number of records saved on each trigger.
+ * @param allTasks Whether a trigger saves the records of all the tasks, or only of its own task.
+ * @param bufferSize Size of the ring in bytes.
+ * @return bool Whether the ring was allocated.
+*/
+bool AdvancedLogger::startBacktrace(LogLevel minLevel, LogLevel triggerLevel, size_t maxRecords, bool allTasks, size_t bufferSize)
+{
+    _lock();
+    bool started = _backtrace.begin(bufferSize);
+    if (started)
+    {
+        _backtraceTrigger = triggerLevel;
+        _backtraceRecords = maxRecords;
+        _backtraceAllTasks = allTasks;
+        _backtraceLevel = (int)minLevel;
+        _updateMinLevel();
+    }
+    _unlock();
+
+    if (!started)
+    {
+        _logPrint("Failed to allocate the backtrace buffer of %u bytes", "AdvancedLogger::startBacktrace", LogLevel::ERROR, (unsigned int)bufferSize);
+    }
+    return started;
+}
+
+/**
+ * @brief Saves all the records kept in RAM by the backtrace.
+ *
+ * Useful before a planned restart, or when an error is detected without
+ * being logged at the trigger level. The last records of all the tasks
+ * are saved, up to the number given to startBacktrace().
+*/
+void AdvancedLogger::saveBacktrace()
+{
+    _lock();
+    if (_backtrace.count() > 0)
+    {
+        _saveBacktrace(LOG_BACKTRACE_ALL_TASKS);
+        _scheduleFlush(_flushInterval);
+    }
+    _unlock();
+}
+
+/**
+ * @brief Updates the lowest level of the records to format.
+ *
+ * Read without the lock by the inlined logging methods.
+*/
+void AdvancedLogger::_updateMinLevel()
+{
+    _minLevel.store(min((int)min(_printLevel, _saveLevel), _backtraceLevel), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the cursor of a new live subscriber.
+ *
+ * The cursor is all the state of a subscriber, so nothing needs to be
+ * released when the subscriber goes away.
+ *
+ * @param fromOldest Whether to start from the oldest record still in the ring, or from the next one logged.
+ * @return LogLiveCursor Cursor to pass to readLive().
+*/
+LogLiveCursor AdvancedLogger::subscribeLive(bool fromOldest)
+{
+    _lock();
+    LogLiveCursor cursor = _liveRing.subscribe(fromOldest);
+    _unlock();
+    return cursor;
+}
+
+/**
+ * @brief Reads the next live record of a subscriber.
+ *
+ * No lock is taken, so a slow subscriber never delays the logging. If it
+ * fell so far behind that its records were overwritten, it is moved to the
+ * oldest record still in the ring, and gets a line in LOG_LIVE_GAP_FORMAT
+ * with the number of records it missed.
+ *
+ * @param cursor Cursor of the subscriber, from subscribeLive().
+ * @param buffer Destination of the line, null-terminated and truncated to fit.
+ * @param size Size of the buffer.
+ * @return size_t Length of the line, 0 if there is no new record.
+*/
+size_t AdvancedLogger::readLive(LogLiveCursor &cursor, char *buffer, size_t size)
+{
+    uint32_t skipped;
+    size_t length = _liveRing.read(cursor, buffer, size, skipped);
+    if (skipped == 0) return length;
+
+    int gapLength = snprintf(buffer, size, LOG_LIVE_GAP_FORMAT, (unsigned int)skipped);
+    return (size_t)min(max(gapLength, 0), (int)size - 1);
+}
+
+/**
+ * @brief Watches the logged messages for a pattern.
+ *
+ * The callback is invoked on the logging task whenever the message of a
+ * record at or above the level contains the pattern, and should return
+ * quickly. The fields and the blocks of bytes are not matched.
+ *
+ * @param pattern Substring to find, in which '*' matches any sequence of characters.
+ * @param callback Function invoked with the watch id, level, function and message of the record.
+ * @param minLevel Lowest level of the records matched.
+ * @return int Id of the watch, or -1 if the pattern is invalid or LOG_WATCH_MAX_PATTERNS are already watched.
+*/
+int AdvancedLogger::addWatch(const char *pattern, LogWatchCallback callback, LogLevel minLevel)
+{
+    _lock();
+    int watchId = _watchMatcher.add(pattern);
+    if (watchId >= 0)
+    {
+        if ((size_t)watchId >= _watches.size()) _watches.resize(watchId + 1);
+        _watches[watchId].callback = callback;
+        _watches[watchId].minLevel = minLevel;
+        if (callback) _watchMinLevel = min(_watchMinLevel, (int)minLevel);
+    }
+    _unlock();
+
+    if (watchId < 0)
+    {
+        _logPrint("Failed to add watch %s", "AdvancedLogger::addWatch", LogLevel::ERROR, pattern);
+    }
+    return watchId;
+}
+
+/**
+ * @brief Stops watching for a pattern.
+ *
+ * @param watchId Id returned by addWatch().
+*/
+void AdvancedLogger::removeWatch(int watchId)
+{
+    _lock();
+    if (_watchMatcher.remove(watchId))
+    {
+        _watches[watchId] = LogWatch();
+        _watchMinLevel = (int)LogLevel::FATAL + 1;
+        for (const LogWatch &watch : _watches)
+        {
+            if (watch.callback) _watchMinLevel = min(_watchMinLevel, (int)watch.minLevel);
+        }
+    }
+    _unlock();
+}
+
+/**
+ * @brief Gets the number of records of a level logged in a window.
+ *
+ * The statistics are kept in RAM as the records are logged, so that they
+ * are answered without reading the log. Only the records at or above the
+ * lower of the print and save levels are counted, as the others are
+ * discarded before reaching the logger.
+ *
+ * @param logLevel Log level of the records.
+ * @param window Last minute, last hour or since boot.
+ * @return uint32_t Number of records.
+*/
+uint32_t AdvancedLogger::getLogCount(LogLevel logLevel, LogStatsWindow window)
+{
+    _lock();
+    uint32_t count = _stats.count((uint8_t)logLevel, window, (uint32_t)(esp_timer_get_time() / 1000000));
+    _unlock();
+    return count;
+}
+
+/**
+ * @brief Gets the functions which logged the most records in a window.
+ *
+ * Each function is counted separately for each level, and only the
+ * LOG_STATS_FUNCTION_COUNT pairs logging the most are tracked, so the
+ * count of a pair which started being tracked late only covers the
+ * records since then, while its count since boot is overestimated by at
+ * most its error.
+ *
+ * @param top Destination of the functions, from the one with the most records.
+ * @param maxCount Maximum number of functions to get.
+ * @param window Last minute, last hour or since boot.
+ * @param minLevel Lowest level of the records counted.
+ * @return size_t Number of functions written to top.
+*/
+size_t AdvancedLogger::getTopFunctions(LogFunctionStats *top, size_t maxCount, LogStatsWindow window, LogLevel minLevel)
+{
+    const LogStatsEntry *entries[LOG_STATS_FUNCTION_COUNT];
+    uint32_t counts[LOG_STATS_FUNCTION_COUNT];
+
+    _lock();
+    size_t found = _stats.top(entries, counts, min(maxCount, (size_t)LOG_STATS_FUNCTION_COUNT), window, (uint8_t)minLevel, (uint32_t)(esp_timer_get_time() / 1000000));
+    for (size_t i = 0; i < found; i++)
+    {
+        memcpy(top[i].function, entries[i]->function, sizeof(top[i].function));
+        top[i].level = (LogLevel)entries[i]->level;
+        top[i].count = counts[i];
+        top[i].error = entries[i]->error;
+    }
+    _unlock();
+    return found;
+}
+
+/**
+ * @brief Resets the statistics of the logged records.
+*/
+void AdvancedLogger::resetStats()
+{
+    _lock();
+    _stats.reset();
+    _unlock();
+}
+
+/**
+ * @brief Gets the occupancy of the record pool.
+ *
+ * The pool holds the records waiting in a queue, so that no heap
+ * allocation is done per record. A high-water mark close to the block
+ * count, or any failure, means that records were dropped because the
+ * pool was too small.
+ *
+ * @return LogPoolStats Block size, block count, blocks in use, high-water mark and failures of each size class.
 */
-void AdvancedLogger::_saveConfigToSpiffs()
+LogPoolStats AdvancedLogger::getRecordPoolStats()
 {
-    debug("Saving config to filesystem...", "AdvancedLogger::_saveConfigToSpiffs");
-    File _file = SPIFFS.open(_configFilePath, "w");
+    return _recordPool.getStats();
+}
+
+/**
+ * @brief Clears the log.
+ *
+ * This method removes all the log segments of all the tiers, and the
+ * log of a previous version if any.
+*/
+void AdvancedLogger::clearLog()
+{
+    _lock();
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++)
+    {
+        _tiers[tier].encoded.store(0, std::memory_order_release);
+        _tiers[tier].buffer.clear();
+        _tiers[tier].bufferedLines = 0;
+        for (int slot = 0; slot < LOG_SEGMENT_SLOTS; slot++)
+        {
+            if (_tiers[tier].segments[slot].used) _removeSegment(tier, slot);
+            String tempPath = _segmentPath(tier, slot) + TEMP_FILE_SUFFIX;
+            if (SPIFFS.exists(tempPath)) SPIFFS.remove(tempPath);
+        }
+    }
+    // The log of a previous version, in case it could not be imported
+    if (SPIFFS.exists(_logFilePath)) SPIFFS.remove(_logFilePath);
+    _backtrace.clear();
+    _flushPending = false;
+    _unlock();
+    _logPrint("Log cleared", "AdvancedLogger::clearLog", LogLevel::INFO);
+}
+
+/**
+ * @brief Clears the log but keeps the latest X percent of log entries.
+ *
+ * This method clears the log but retains the latest X percent of log entries
+ * of each tier. The default value is 10%.
+ *
+ * Segments are walked from the newest one: the ones entirely within the
+ * lines to keep are left untouched, the older ones are removed, and only
+ * the segment containing the cut point is rewritten.
+ */
+void AdvancedLogger::clearLogKeepLatestXPercent(int percent) 
+{
+    percent = min(max(percent, 0), 100);
+
+    _lock();
+    _flushAll();
+
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++) {
+        LogTierStorage &storage = _tiers[tier];
+        size_t linesToKeep = (storage.lines * percent) / 100;
+
+        int order[LOG_SEGMENT_SLOTS];
+        int count = _segmentsInOrder(tier, order);
+
+        for (int i = count - 1; i >= 0; i--) {
+            int slot = order[i];
+            if (storage.segments[slot].lines <= linesToKeep) {
+                linesToKeep -= storage.segments[slot].lines;
+            } else if (linesToKeep > 0) {
+                _trimSegment(tier, slot, linesToKeep);
+                linesToKeep = 0;
+            } else {
+                _removeSegment(tier, slot);
+            }
+        }
+    }
+    _unlock();
+
+    _logPrint("Log cleared keeping latest entries", 
+              "AdvancedLogger::clearLogKeepLatestXPercent", LogLevel::INFO);
+}
+
+/**
+ * @brief Saves a message to the log file.
+ *
+ * This method appends a message to the write buffer of the tier of its
+ * level, and then enforces the retention of that tier. The first record
+ * with a valid time in a boot also saves when the clock was set. The buffer is
+ * written to the active segment right away if the level is at or above
+ * the sync level, and otherwise within the flush deadline or the flush
+ * interval, depending on the level. The first record of a task in a boot
+ * also saves the name of the task. A record below the save level is only
+ * kept in the backtrace, and a record at or above the trigger level saves
+ * the backtrace first. Must be called with the lock held.
+ *
+ * @param type Type of the frame, TEXT, BYTES or FIELDS.
+ * @param body Formatted message without its timestamp, uptime and task, or header of the BYTES frame.
+ * @param bodyLength Length of the body.
+ * @param data Bytes following the body, for a BYTES frame.
+ * @param dataLength Number of bytes following the body.
+ * @param logLevel Log level of the message.
+ * @param monotonicUs Monotonic time at which the message was logged.
+ * @param wallUs Unix time in microseconds at which the message was logged.
+ * @param taskId Id of the task which logged the message.
+*/
+void AdvancedLogger::_save(LogFrameType type, const uint8_t *body, size_t bodyLength, const uint8_t *data, size_t dataLength, LogLevel logLevel, uint64_t monotonicUs, uint64_t wallUs, uint8_t taskId)
+{
+    int tier = (int)(logLevel >= _criticalLevel ? LogTier::CRITICAL : LogTier::MAIN);
+
+    bodyLength = min(bodyLength, LOG_FRAME_MAX_PAYLOAD - LOG_TEXT_PREFIX_SIZE);
+    dataLength = min(dataLength, LOG_FRAME_MAX_PAYLOAD - LOG_TEXT_PREFIX_SIZE - bodyLength);
+    size_t length = bodyLength + dataLength;
+    size_t frameSize = LOG_TEXT_PREFIX_SIZE + length + LOG_FRAME_OVERHEAD;
+    uint32_t now = (uint32_t)(wallUs / 1000000);
+
+    if (!_clockSet && now >= LOG_MIN_VALID_TIME && _bootTimeCount > 0)
+    {
+        _bootTimes[_bootTimeCount - 1].monotonicUs = monotonicUs;
+        _bootTimes[_bootTimeCount - 1].unixUs = wallUs;
+        _clockSet = true;
+        _saveBootTimes();
+    }
+    if (logLevel < _saveLevel)
+    {
+        // Only kept in RAM, until a record triggers the backtrace
+        uint8_t *frame = _backtrace.reserve(frameSize, (uint8_t)logLevel, taskId);
+        if (frame != nullptr) _encodeFrame(frame, type, body, bodyLength, data, dataLength, now, monotonicUs, taskId);
+        return;
+    }
+    if (taskId != 0 && !(_persistedTasks & (1UL << taskId))) _saveTaskName(taskId);
+    if (logLevel >= _backtraceTrigger && _backtrace.count() > 0) _saveBacktrace(_backtraceAllTasks ? LOG_BACKTRACE_ALL_TASKS : taskId);
+
+    // The frame is encoded in place, so that it never has to be assembled elsewhere
+    uint8_t *frame = _reserveFrame(tier, frameSize, now);
+    if (frame == nullptr) return;
+    _encodeFrame(frame, type, body, bodyLength, data, dataLength, now, monotonicUs, taskId);
+    _commitFrame(tier);
+    _tiers[tier].lastMonotonicUs = max(_tiers[tier].lastMonotonicUs, monotonicUs);
+
+    _enforceRetention(tier, now);
+
+    if (logLevel >= _syncLevel)
+    {
+        _flushAll();
+        return;
+    }
+    _scheduleFlush(logLevel >= _deadlineLevel ? _flushDeadline : _flushInterval);
+
+    // Without the flush task, the deadline can only be checked while logging
+    if (_flushPending && (long)(millis() - _flushDue) >= 0) _flushAll();
+}
+
+/**
+ * @brief Encodes a record frame.
+ *
+ * @param frame Where the frame is written, with room for the whole frame.
+ * @param type Type of the frame.
+ * @param body Body of the record.
+ * @param bodyLength Length of the body.
+ * @param data Data following the body, or nullptr.
+ * @param dataLength Length of the data.
+ * @param now Unix time of the record.
+ * @param monotonicUs Time of the record since boot.
+ * @param taskId Id of the task of the record.
+*/
+void AdvancedLogger::_encodeFrame(uint8_t *frame, LogFrameType type, const uint8_t *body, size_t bodyLength, const uint8_t *data, size_t dataLength, uint32_t now, uint64_t monotonicUs, uint8_t taskId)
+{
+    size_t length = bodyLength + dataLength;
+    uint8_t *prefix = frame + LOG_FRAME_HEADER_SIZE;
+    logFramePutU32(prefix, now);
+    logFramePutU32(prefix + 4, _bootId);
+    logFramePutU64(prefix + 8, monotonicUs);
+    prefix[16] = taskId;
+    memset(prefix + 17, 0, LOG_TEXT_PREFIX_SIZE - 17);
+    memcpy(prefix + LOG_TEXT_PREFIX_SIZE, body, bodyLength);
+    if (dataLength > 0) memcpy(prefix + LOG_TEXT_PREFIX_SIZE + bodyLength, data, dataLength);
+    logFrameEncodeHeader(frame, type, prefix, LOG_TEXT_PREFIX_SIZE, prefix + LOG_TEXT_PREFIX_SIZE, length);
+    logFramePutU16(frame + LOG_FRAME_HEADER_SIZE + LOG_TEXT_PREFIX_SIZE + length, (uint16_t)(LOG_TEXT_PREFIX_SIZE + length));
+}
+
+/**
+ * @brief Saves the records kept in RAM by the backtrace.
+ *
+ * The frames are copied as they are, so the records keep the time they
+ * were logged at, and land right before the record which triggered the
+ * backtrace. As the records of a tier must stay in chronological order,
+ * the ones older than the last record saved to their tier are dropped
+ * (see LogBacktraceRing::takeInOrder()). Must be called with the lock held.
+ *
+ * @param taskId Id of the task whose records are saved, or LOG_BACKTRACE_ALL_TASKS.
+*/
+void AdvancedLogger::_saveBacktrace(int taskId)
+{
+    bool saved[LOG_TIER_COUNT] = {};
+    _backtrace.takeInOrder(
+        taskId,
+        _backtraceRecords,
+        [this](uint8_t level) { return (int)(level >= (uint8_t)_criticalLevel ? LogTier::CRITICAL : LogTier::MAIN); },
+        [this](int tier) -> uint64_t & { return _tiers[tier].lastMonotonicUs; },
+        [this, &saved](int tier, uint8_t recordTaskId, const uint8_t *frame, size_t frameSize) {
+            if (recordTaskId != 0 && !(_persistedTasks & (1UL << recordTaskId))) _saveTaskName(recordTaskId);
+            uint8_t *destination = _reserveFrame(tier, frameSize, logFrameGetU32(frame + LOG_FRAME_HEADER_SIZE));
+            if (destination == nullptr) return false;
+            memcpy(destination, frame, frameSize);
+            _commitFrame(tier);
+            saved[tier] = true;
+            return true;
+        });
+
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++)
+    {
+        if (saved[tier]) _enforceRetention(tier);
+    }
+}
+
+/**
+ * @brief Reserves room for a frame in the write buffer of a tier.
+ *
+ * A new segment is opened when the active one is full or too old, and the
+ * buffer is written first if the frame does not fit. The frame is accounted
+ * to the active segment right away. Must be called with the lock held.
+ *
+ * @param tier Tier of the frame.
+ * @param frameSize Size of the frame.
+ * @param recordTime Unix time of the record.
+ * @return uint8_t* Where the frame must be written, or nullptr if no segment could be opened.
+*/
+uint8_t *AdvancedLogger::_reserveFrame(int tier, size_t frameSize, uint32_t recordTime)
+{
+    LogTierStorage &storage = _tiers[tier];
+    bool validTime = recordTime >= LOG_MIN_VALID_TIME;
+
+    if (storage.activeSegment < 0 ||
+        (storage.segments[storage.activeSegment].lines > 0 &&
+         storage.segments[storage.activeSegment].bytes + frameSize > storage.maxBytes / LOG_SEGMENT_COUNT) ||
+        (_maxLogAge > 0 && validTime && storage.segments[storage.activeSegment].minTime > 0 &&
+         recordTime - storage.segments[storage.activeSegment].minTime > _maxLogAge / LOG_SEGMENT_COUNT))
+    {
+        // The buffered frames belong to the segment being closed
+        _flushTier(tier);
+        if (!_openNewSegment(tier)) return nullptr;
+    }
+    if (storage.buffer.size() + frameSize > LOG_WRITE_BUFFER_SIZE) _flushTier(tier);
+
+    // The capacity is never changed afterwards, so the emergency flush can read the buffer at any time
+    if (storage.buffer.capacity() < LOG_WRITE_BUFFER_SIZE) storage.buffer.reserve(LOG_WRITE_BUFFER_SIZE);
+    size_t offset = storage.buffer.size();
+    storage.buffer.resize(offset + frameSize);
+    storage.bufferedLines++;
+
+    LogSegment &segment = storage.segments[storage.activeSegment];
+    segment.bytes += frameSize;
+    segment.lines++;
+    if (validTime)
+    {
+        if (segment.minTime == 0) segment.minTime = recordTime;
+        segment.maxTime = recordTime;
+    }
+    else
+    {
+        segment.undated = true;
+    }
+    storage.bytes += frameSize;
+    storage.lines++;
+
+    return storage.buffer.data() + offset;
+}
+
+/**
+ * @brief Marks the frames of the write buffer of a tier as fully encoded.
+ *
+ * Called once a frame reserved by _reserveFrame() is written, so that
+ * the emergency flush only copies complete frames. Must be called with
+ * the lock held.
+ *
+ * @param tier Tier of the frame.
+*/
+void AdvancedLogger::_commitFrame(int tier)
+{
+    _tiers[tier].encoded.store(_tiers[tier].buffer.size(), std::memory_order_release);
+}
+
+/**
+ * @brief Takes the lock protecting the log storage.
+ *
+ * The lock is recursive, as saving a record can end up logging an error.
+*/
+void AdvancedLogger::_lock()
+{
+    if (_mutex != nullptr) xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+}
+
+/**
+ * @brief Releases the lock protecting the log storage.
+*/
+void AdvancedLogger::_unlock()
+{
+    if (_mutex != nullptr) xSemaphoreGiveRecursive(_mutex);
+}
+
+/**
+ * @brief Makes sure the buffered records are written within a delay.
+ *
+ * The flush task is only woken up if the new deadline is earlier than
+ * the pending one.
+ *
+ * @param delay Maximum time in milliseconds before the buffered records are written.
+*/
+void AdvancedLogger::_scheduleFlush(uint32_t delay)
+{
+    unsigned long due = millis() + delay;
+    if (_flushPending && (long)(due - _flushDue) >= 0) return;
+
+    _flushDue = due;
+    _flushPending = true;
+    if (_flushTaskHandle != nullptr) xTaskNotifyGive(_flushTaskHandle);
+}
+
+/**
+ * @brief Writes the buffered records of all the tiers.
+*/
+void AdvancedLogger::_flushAll()
+{
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++) _flushTier(tier);
+    _flushPending = false;
+}
+
+/**
+ * @brief Writes the buffered records of a tier to its active segment.
+ *
+ * The segment is opened, written with a single call and closed, which
+ * commits the data and the file size to the filesystem. If the write
+ * fails, the buffered records are dropped and the segment is closed, so
+ * that no record is appended after a torn one. Errors are only printed,
+ * as logging them would save a record and flush again.
+ *
+ * @param tier Tier to flush.
+*/
+void AdvancedLogger::_flushTier(int tier)
+{
+    LogTierStorage &storage = _tiers[tier];
+    if (storage.buffer.empty()) return;
+
+    size_t bufferedBytes = storage.buffer.size();
+    bool written = false;
+    File _file = SPIFFS.open(_segmentPath(tier, storage.activeSegment), "a");
     if (!_file)
     {
-        Serial.printf("Failed to open config file for writing");
-        _logPrint("Failed to open config file", "AdvancedLogger::_saveConfigToSpiffs", LogLevel::ERROR);
+        Serial.printf("Failed to open log file for writing");
+    }
+    else
+    {
+        written = _file.write(storage.buffer.data(), bufferedBytes) == bufferedBytes;
+        _file.flush();
+        _file.close();
+        if (!written) Serial.printf("Failed to write log file");
+    }
+
+    if (!written)
+    {
+        // A partial write leaves a torn frame, which is dropped at the next begin()
+        LogSegment &segment = storage.segments[storage.activeSegment];
+        segment.bytes -= bufferedBytes;
+        segment.lines -= storage.bufferedLines;
+        storage.bytes -= bufferedBytes;
+        storage.lines -= storage.bufferedLines;
+        storage.activeSegment = -1;
+    }
+    storage.encoded.store(0, std::memory_order_release);
+    storage.buffer.clear();
+    storage.bufferedLines = 0;
+}
+
+/**
+ * @brief Writes the buffered records once their deadline expires.
+ *
+ * The task sleeps until the earliest pending deadline, or until it is
+ * notified of an earlier one.
+ *
+ * @param parameter AdvancedLogger object.
+*/
+void AdvancedLogger::_flushTask(void *parameter)
+{
+    AdvancedLogger *logger = static_cast<AdvancedLogger *>(parameter);
+    while (true)
+    {
+        TickType_t wait = portMAX_DELAY;
+
+        logger->_lock();
+        if (logger->_flushPending)
+        {
+            long remaining = (long)(logger->_flushDue - millis());
+            if (remaining <= 0)
+            {
+                logger->_flushAll();
+            }
+            else
+            {
+                wait = pdMS_TO_TICKS(remaining);
+            }
+        }
+        logger->_unlock();
+
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+/**
+ * @brief Dumps the log to a Stream.
+ *
+ * Dump the log to a Stream, such as Serial or an opened file. The tiers are
+ * merged by time with a k-way merge, so that the output is in chronological
+ * order. Each valid record is written as a text line, with its timestamp
+ * and uptime rendered from its metadata, while torn or corrupted records
+ * are skipped. Records logged before the clock was set are re-stamped if
+ * it was set later during the same boot. The name of the task of each record
+ * is looked up from its id, in the names saved for the boot of the record.
+ *
+ * The output can be restricted to a time range, in which case the segments
+ * entirely outside of it are not even opened.
+ *
+ * The segments and their sizes are taken under the lock when the dump
+ * starts, and the lock is then only held to read each record, never while
+ * writing to the stream, so that a slow stream does not block the logging
+ * tasks. The records saved after the dump started are not dumped, and the
+ * segments removed by the retention meanwhile are skipped.
+ *
+ * @param stream Stream to dump the log to.
+ * @param fromTime Unix time of the oldest record to dump, 0 for no lower bound.
+ * @param toTime Unix time of the newest record to dump, 0 for no upper bound.
+ * @param format Whether to dump the records as text lines or as JSON lines.
+*/
+void AdvancedLogger::dump(Print &stream, uint32_t fromTime, uint32_t toTime, LogDumpFormat format)
+{
+    debug("Dumping log to Stream...", "AdvancedLogger::dump");
+
+    _lock();
+    _flushAll();
+
+    // The heap holds the tiers that still have records, ordered by their next record
+    LogTierCursor cursors[LOG_TIER_COUNT];
+    LogMergeHeap<uint64_t> heap;
+    heap.reserve(LOG_TIER_COUNT);
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++)
+    {
+        LogTierCursor &cursor = cursors[tier];
+        cursor.tier = tier;
+        cursor.count = _segmentsInOrder(tier, cursor.order);
+        for (int i = 0; i < cursor.count; i++)
+        {
+            cursor.sequences[i] = _tiers[tier].segments[cursor.order[i]].sequence;
+            cursor.ends[i] = _tiers[tier].segments[cursor.order[i]].bytes;
+        }
+        if (_advanceCursor(cursor, fromTime, toTime)) heap.push(tier, cursor.time);
+    }
+
+    // The names of the current boot are in memory, the ones of the previous boots are sorted for a binary search
+    std::vector<LogTaskName> taskNames;
+    _loadTaskNames(taskNames);
+    _unlock();
+    auto precedes = [](const LogTaskName &a, const LogTaskName &b) { return a.bootId != b.bootId ? a.bootId < b.bootId : a.taskId < b.taskId; };
+    std::sort(taskNames.begin(), taskNames.end(), precedes);
+    uint32_t namesReady = _taskNamesReady.load(std::memory_order_acquire);
+
+    char timestamp[TIMESTAMP_BUFFER_SIZE] = "";
+    time_t timestampSecond = -1;
+    while (!heap.empty())
+    {
+        LogTierCursor &cursor = cursors[heap.top()];
+
+        time_t second = (time_t)(cursor.time / 1000000);
+        if (second != timestampSecond)
+        {
+            _formatTimestamp(second, timestamp, sizeof(timestamp));
+            timestampSecond = second;
+        }
+        LogTaskName key;
+        key.bootId = logFrameGetU32(cursor.frame.data() + LOG_FRAME_HEADER_SIZE + 4);
+        key.taskId = cursor.frame[LOG_FRAME_HEADER_SIZE + 16];
+        const char *task = _taskNames[0];
+        if (key.bootId == _bootId)
+        {
+            if (key.taskId < LOG_TASK_COUNT && (namesReady & (1UL << key.taskId))) task = _taskNames[key.taskId];
+        }
+        else
+        {
+            auto name = std::lower_bound(taskNames.begin(), taskNames.end(), key, precedes);
+            if (name != taskNames.end() && name->bootId == key.bootId && name->taskId == key.taskId) task = name->name;
+        }
+        _printRecord(stream, cursor.frame.data(), cursor.frameSize, timestamp, task, format);
+
+        _lock();
+        bool advanced = _advanceCursor(cursor, fromTime, toTime);
+        _unlock();
+        if (advanced)
+        {
+            heap.replaceTop(cursor.time);
+        }
+        else
+        {
+            heap.pop();
+        }
+    }
+    stream.flush();
+
+    debug("Log dumped to Stream", "AdvancedLogger::dump");
+}
+
+/**
+ * @brief Prints a record read from the log.
+ *
+ * As text, the line is the same that was printed to the Serial when the
+ * record was logged. As JSON, the level, core, function and message are
+ * split back from the stored line, and the fields become members.
+ *
+ * @param stream Stream to print to.
+ * @param frame Record frame.
+ * @param frameSize Size of the frame.
+ * @param timestamp Formatted timestamp of the record.
+ * @param task Name of the task of the record.
+ * @param format Whether to print the record as a text line or as a JSON line.
+*/
+void AdvancedLogger::_printRecord(Print &stream, const uint8_t *frame, size_t frameSize, const char *timestamp, const char *task, LogDumpFormat format)
+{
+    uint8_t type = frame[1];
+    uint64_t monotonicUs = logFrameGetU64(frame + LOG_FRAME_HEADER_SIZE + 8);
+    const uint8_t *body = frame + LOG_FRAME_HEADER_SIZE + LOG_TEXT_PREFIX_SIZE;
+    size_t bodyLength = frameSize - LOG_FRAME_OVERHEAD - LOG_TEXT_PREFIX_SIZE;
+
+    const uint8_t *fields = nullptr;
+    size_t fieldsLength = 0;
+    if (type == (uint8_t)LogFrameType::FIELDS && bodyLength >= LOG_FIELDS_HEADER_SIZE)
+    {
+        fieldsLength = min((size_t)logFrameGetU16(body), bodyLength - LOG_FIELDS_HEADER_SIZE);
+        fields = body + LOG_FIELDS_HEADER_SIZE;
+        body += LOG_FIELDS_HEADER_SIZE + fieldsLength;
+        bodyLength -= LOG_FIELDS_HEADER_SIZE + fieldsLength;
+    }
+
+    const uint8_t *data = nullptr;
+    size_t dataLength = 0;
+    size_t headerLength = 0;
+    if (type == (uint8_t)LogFrameType::BYTES || type == (uint8_t)LogFrameType::SPAN)
+    {
+        headerLength = bodyLength >= LOG_BYTES_HEADER_SIZE ? min(LOG_BYTES_HEADER_SIZE + body[2], bodyLength) : bodyLength;
+    }
+    if (type == (uint8_t)LogFrameType::BYTES)
+    {
+        data = body + headerLength;
+        dataLength = bodyLength - headerLength;
+    }
+
+    // A span has the header of a block of bytes, and its message is rendered from its data
+    LogFrameSpan span;
+    char spanMessage[LOG_SPAN_MESSAGE_SIZE] = "";
+    bool isSpan = type == (uint8_t)LogFrameType::SPAN &&
+                  headerLength >= LOG_BYTES_HEADER_SIZE &&
+                  logFrameReadSpan(body + headerLength, bodyLength - headerLength, span);
+    if (isSpan) logFrameFormatSpan(spanMessage, sizeof(spanMessage), span);
+
+    char buffer[MAX_LOG_LENGTH];
+    if (format == LogDumpFormat::TEXT)
+    {
+        snprintf(buffer, sizeof(buffer), LOG_PREFIX_FORMAT, timestamp, _formatMillis(monotonicUs / 1000).c_str());
+        stream.print(buffer);
+        if (data != nullptr)
+        {
+            _printBytes(stream, body, headerLength, data, dataLength, task);
+            return;
+        }
+        if (isSpan)
+        {
+            snprintf(
+                buffer,
+                sizeof(buffer),
+                LOG_SPAN_FORMAT,
+                logLevelToString((LogLevel)body[0], false),
+                body[1],
+                (int)(headerLength - LOG_BYTES_HEADER_SIZE),
+                (const char *)body + LOG_BYTES_HEADER_SIZE,
+                spanMessage);
+            stream.print(buffer);
+        }
+        else
+        {
+            stream.write(body, bodyLength);
+            if (fields != nullptr)
+            {
+                _formatFields(buffer, sizeof(buffer), fields, fieldsLength, format);
+                stream.print(buffer);
+            }
+        }
+        snprintf(buffer, sizeof(buffer), LOG_TASK_FORMAT, task);
+        stream.println(buffer);
         return;
     }
 
-    _file.println(String("printLevel=") + logLevelToString(_printLevel));
-    _file.println(String("saveLevel=") + logLevelToString(_saveLevel));
-    _file.println(String("maxLogLines=") + String(_maxLogLines));
-    _file.close();
+    // The stored line is "[LEVEL   ] [Core N] [function] message", as in LOG_BODY_FORMAT
+    const char *level = "";
+    size_t levelLength = 0;
+    unsigned int core = 0;
+    const char *function = "";
+    size_t functionLength = 0;
+    const char *message = "";
+    size_t messageLength = 0;
+    if (data != nullptr || isSpan)
+    {
+        if (headerLength >= LOG_BYTES_HEADER_SIZE)
+        {
+            level = logLevelToStringLower((LogLevel)body[0]);
+            levelLength = strlen(level);
+            core = body[1];
+            function = (const char *)body + LOG_BYTES_HEADER_SIZE;
+            functionLength = headerLength - LOG_BYTES_HEADER_SIZE;
+        }
+        message = spanMessage;
+        messageLength = strlen(spanMessage);
+    }
+    else
+    {
+        const char *text = (const char *)body;
+        const char *end = text + bodyLength;
+        const char *cursor = text;
+        if (cursor < end && *cursor == '[')
+        {
+            const char *close = (const char *)memchr(cursor, ']', end - cursor);
+            if (close != nullptr)
+            {
+                level = cursor + 1;
+                levelLength = close - level;
+                while (levelLength > 0 && level[levelLength - 1] == ' ') levelLength--;
+                cursor = close + 1;
+            }
+        }
+        if (end - cursor > 7 && memcmp(cursor, " [Core ", 7) == 0)
+        {
+            cursor += 7;
+            while (cursor < end && *cursor >= '0' && *cursor <= '9') core = core * 10 + (*cursor++ - '0');
+            if (end - cursor >= 3 && memcmp(cursor, "] [", 3) == 0)
+            {
+                cursor += 3;
+                // Function names may contain brackets, but not "] " followed by the message
+                const char *close = cursor;
+                while (close < end && !(*close == ']' && (close + 1 == end || close[1] == ' '))) close++;
+                function = cursor;
+                functionLength = close - cursor;
+                cursor = close < end ? close + 1 : end;
+                if (cursor < end && *cursor == ' ') cursor++;
+            }
+        }
+        message = cursor;
+        messageLength = end - cursor;
+    }
+
+    stream.print("{\"timestamp\":");
+    _printJsonString(stream, timestamp, strlen(timestamp));
+    stream.print(",\"millis\":");
+    stream.print(String((unsigned long long)(monotonicUs / 1000)));
+    stream.print(",\"task\":");
+    _printJsonString(stream, task, strlen(task));
+    stream.print(",\"level\":\"");
+    for (size_t i = 0; i < levelLength; i++) stream.print((char)tolower(level[i]));
+    stream.print("\",\"core\":");
+    stream.print(core);
+    stream.print(",\"function\":");
+    _printJsonString(stream, function, functionLength);
+    if (data != nullptr)
+    {
+        stream.print(",\"bytes\":\"");
+        for (size_t offset = 0; offset < dataLength; offset += (sizeof(buffer) - 1) / 3)
+        {
+            size_t count = min(dataLength - offset, (sizeof(buffer) - 1) / 3);
+            _formatHex(buffer, sizeof(buffer), data + offset, count);
+            if (offset > 0) stream.print(' ');
+            stream.print(buffer);
+        }
+        stream.print('"');
+    }
+    else
+    {
+        stream.print(",\"message\":");
+        _printJsonString(stream, message, messageLength);
+    }
+    if (fields != nullptr)
+    {
+        _formatFields(buffer, sizeof(buffer), fields, fieldsLength, format);
+        stream.print(buffer);
+    }
+    stream.println("}");
+}
+
+/**
+ * @brief Prints a string as a JSON string, with its quotes.
+ *
+ * @param stream Stream to print to.
+ * @param string Characters of the string, not necessarily null-terminated.
+ * @param length Number of characters.
+*/
+void AdvancedLogger::_printJsonString(Print &stream, const char *string, size_t length)
+{
+    stream.print('"');
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = string[i];
+        if (c == '"' || c == '\\')
+        {
+            stream.print('\\');
+            stream.print(c);
+        }
+        else if ((uint8_t)c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)(uint8_t)c);
+            stream.print(escaped);
+        }
+        else
+        {
+            stream.print(c);
+        }
+    }
+    stream.print('"');
+}
+
+/**
+ * @brief Advances a tier cursor to its next record.
+ *
+ * Frames other than records and records outside of the time range are
+ * skipped. Segments are opened one at a time, from the oldest to the
+ * newest, skipping the ones entirely outside of the time range, and are
+ * read up to their size when the dump started.
+ *
+ * As the lock is released between two calls, the segment being read may
+ * have been removed meanwhile, in which case it is closed, or trimmed, in
+ * which case it is opened again and the records up to the current one,
+ * found by their time, are skipped. Must be called with the lock held.
+ *
+ * @param cursor Cursor to advance.
+ * @param fromTime Unix time of the oldest record to return, 0 for no lower bound.
+ * @param toTime Unix time of the newest record to return, 0 for no upper bound.
+ * @return bool Whether a record is available in cursor.frame.
+*/
+bool AdvancedLogger::_advanceCursor(LogTierCursor &cursor, uint32_t fromTime, uint32_t toTime)
+{
+    if (cursor.frame.empty()) cursor.frame.resize(LOG_FRAME_MAX_SIZE);
+
+    bool resuming = false;
+    if (cursor.file)
+    {
+        int slot = cursor.order[cursor.index - 1];
+        const LogSegment &segment = _tiers[cursor.tier].segments[slot];
+        if (!segment.used || segment.sequence != cursor.sequences[cursor.index - 1])
+        {
+            cursor.file.close();
+            cursor.file = File();
+        }
+        else if (segment.generation != cursor.generation)
+        {
+            // Trimming only drops the oldest records, so the next ones are still after the current one
+            cursor.file.close();
+            cursor.file = SPIFFS.open(_segmentPath(cursor.tier, slot), "r");
+            cursor.generation = segment.generation;
+            cursor.end = segment.bytes;
+            resuming = true;
+        }
+    }
+
+    int _loopCount = 0;
+    while (_loopCount < MAX_WHILE_LOOP_COUNT)
+    {
+        _loopCount++;
 
-    debug("Config saved to filesystem", "AdvancedLogger::_saveConfigToSpiffs");
+        if (!cursor.file)
+        {
+            if (cursor.index >= cursor.count) return false;
+
+            int slot = cursor.order[cursor.index];
+            const LogSegment &segment = _tiers[cursor.tier].segments[slot];
+            cursor.end = cursor.ends[cursor.index];
+            if (!segment.used || segment.sequence != cursor.sequences[cursor.index++]) continue;
+            // Re-stamped records are older than the first dated one, so undated segments can only be skipped by fromTime
+            if ((fromTime > 0 && segment.maxTime > 0 && segment.maxTime < fromTime) ||
+                (toTime > 0 && !segment.undated && segment.minTime > toTime)) continue;
+
+            cursor.file = SPIFFS.open(_segmentPath(cursor.tier, slot), "r");
+            cursor.generation = segment.generation;
+            if (!cursor.file)
+            {
+                _logPrint("Failed to open log file", "AdvancedLogger::_advanceCursor", LogLevel::ERROR);
+                continue;
+            }
+        }
+
+        cursor.frameSize = cursor.file.position() < cursor.end ? logFileReadFrame(cursor.file, cursor.frame.data()) : 0;
+        if (cursor.frameSize == 0)
+        {
+            cursor.file.close();
+            cursor.file = File();
+            continue;
+        }
+        if (!logFrameIsRecord(cursor.frame[1])) continue;
+
+        uint64_t previousTime = cursor.time;
+        cursor.time = _recordTime(cursor.frame.data());
+        if (resuming && cursor.time <= previousTime)
+        {
+            cursor.time = previousTime;
+            continue;
+        }
+        resuming = false;
+        uint32_t recordTime = (uint32_t)(cursor.time / 1000000);
+        if ((fromTime > 0 && recordTime < fromTime) || (toTime > 0 && recordTime > toTime)) continue;
+        return true;
+    }
+    return false;
 }
 
 /**
- * @brief Sets the maximum number of log lines.
+ * @brief Gets the time of a record frame.
  *
- * This method sets the maximum number of log lines to the provided value.
+ * The saved unix time is used if valid, refined to the microsecond with
+ * the monotonic time of the record if the clock of its boot was set and
+ * both agree on the second. A record logged before the clock was set is
+ * re-stamped from its monotonic time if the clock was set later during
+ * its boot. Records which cannot be dated keep their monotonic time, so
+ * that they come before all the others.
  *
- * @param maxLogLines Maximum number of log lines.
+ * @param frame Record frame.
+ * @return uint64_t Unix time of the record in microseconds.
 */
-void AdvancedLogger::setMaxLogLines(int maxLogLines)
+uint64_t AdvancedLogger::_recordTime(const uint8_t *frame)
 {
-    debug(
-        ("Setting max log lines to " + String(maxLogLines)).c_str(),
-        "AdvancedLogger::setMaxLogLines");
-    _maxLogLines = maxLogLines;
-    _saveConfigToSpiffs();
+    const uint8_t *prefix = frame + LOG_FRAME_HEADER_SIZE;
+    uint32_t unixTime = logFrameGetU32(prefix);
+    uint32_t bootId = logFrameGetU32(prefix + 4);
+    uint64_t monotonicUs = logFrameGetU64(prefix + 8);
+
+    uint64_t bootUs = 0;
+    for (int i = 0; i < _bootTimeCount; i++)
+    {
+        const LogBootTime &bootTime = _bootTimes[i];
+        if (bootTime.bootId == bootId && bootTime.unixUs > 0) bootUs = bootTime.unixUs - bootTime.monotonicUs + monotonicUs;
+    }
+
+    if (unixTime >= LOG_MIN_VALID_TIME)
+    {
+        // The clock may have been adjusted since it was set, in which case the saved second wins
+        uint64_t unixUs = (uint64_t)unixTime * 1000000;
+        return bootUs / 1000000 == unixTime ? bootUs : unixUs;
+    }
+    return bootUs > 0 ? bootUs : monotonicUs;
 }
 
 /**
- * @brief Gets the number of log lines.
+ * @brief Gets the unix time from the monotonic time.
  *
- * This method returns the number of log lines in the log file.
+ * The clock is read at most once per second, and extrapolated with the
+ * monotonic time in between, so that no system call is done per record.
+ * Reading it every second keeps up with the clock being set or adjusted.
+ * Must be called with the lock held.
  *
- * @return int Number of log lines.
+ * @param monotonicUs Monotonic time in microseconds.
+ * @return uint64_t Unix time in microseconds.
 */
-int AdvancedLogger::getLogLines()
+uint64_t AdvancedLogger::_wallClockUs(uint64_t monotonicUs)
 {
-    File _file = SPIFFS.open(_logFilePath, "r");
-    if (!_file)
+    if (_wallBaseUs == 0 || monotonicUs - _wallBaseMonotonicUs >= 1000000)
     {
-        Serial.printf("Failed to open log file for reading");
-        _logPrint("Failed to open log file", "AdvancedLogger::getLogLines", LogLevel::ERROR);
-        return 0;
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        _wallBaseUs = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+        _wallBaseMonotonicUs = monotonicUs;
     }
+    return _wallBaseUs + (int64_t)(monotonicUs - _wallBaseMonotonicUs);
+}
 
-    int lines = 0;
-    int _loopCount = 0;
-    while (_file.available() && _loopCount < MAX_WHILE_LOOP_COUNT)
+/**
+ * @brief Loads the boot times and starts a new boot.
+ *
+ * The boot times are kept in a file of TIME frames next to the log. The
+ * new boot gets the id following the last one, and replaces the oldest
+ * boot if all the entries are in use. Must be called with the lock held.
+*/
+void AdvancedLogger::_loadBootTimes()
+{
+    String path = _logFilePath + TIME_FILE_SUFFIX;
+    logFileRecoverRotation(SPIFFS, path);
+
+    _bootTimeCount = 0;
+    File file = SPIFFS.open(path, "r");
+    if (file)
     {
-        _loopCount++;
-        if (_file.read() == '\n')
+        uint8_t frame[LOG_FRAME_MAX_SIZE];
+        size_t frameSize;
+        while ((frameSize = logFileReadFrame(file, frame)) > 0)
         {
-            lines++;
+            if (frame[1] != (uint8_t)LogFrameType::TIME || frameSize != LOG_TIME_FRAME_SIZE) continue;
+            if (_bootTimeCount == LOG_BOOT_TIME_COUNT)
+            {
+                memmove(_bootTimes, _bootTimes + 1, sizeof(LogBootTime) * (LOG_BOOT_TIME_COUNT - 1));
+                _bootTimeCount--;
+            }
+            LogBootTime &bootTime = _bootTimes[_bootTimeCount++];
+            bootTime.bootId = logFrameGetU32(frame + LOG_FRAME_HEADER_SIZE);
+            bootTime.monotonicUs = logFrameGetU64(frame + LOG_FRAME_HEADER_SIZE + 4);
+            bootTime.unixUs = logFrameGetU64(frame + LOG_FRAME_HEADER_SIZE + 12);
         }
+        file.close();
     }
-    _file.close();
-    return lines;
+
+    _bootId = _bootTimeCount > 0 ? _bootTimes[_bootTimeCount - 1].bootId + 1 : 1;
+    if (_bootTimeCount == LOG_BOOT_TIME_COUNT)
+    {
+        memmove(_bootTimes, _bootTimes + 1, sizeof(LogBootTime) * (LOG_BOOT_TIME_COUNT - 1));
+        _bootTimeCount--;
+    }
+    _bootTimes[_bootTimeCount] = LogBootTime();
+    _bootTimes[_bootTimeCount].bootId = _bootId;
+    _bootTimeCount++;
+    _clockSet = false;
+
+    _saveBootTimes();
 }
 
 /**
- * @brief Clears the log.
+ * @brief Saves the boot times.
  *
- * This method clears the log file.
+ * The file is rewritten through a temporary file, as it is at most a few
+ * hundred bytes and only saved twice per boot. Must be called with the
+ * lock held.
 */
-void AdvancedLogger::clearLog()
+void AdvancedLogger::_saveBootTimes()
 {
-    File _file = SPIFFS.open(_logFilePath, "w");
-    if (!_file)
+    String path = _logFilePath + TIME_FILE_SUFFIX;
+    File tempFile = SPIFFS.open(path + TEMP_FILE_SUFFIX, "w");
+    if (!tempFile)
     {
-        Serial.printf("Failed to open log file for writing");
-        _logPrint("Failed to open log file", "AdvancedLogger::clearLog", LogLevel::ERROR);
+        _logPrint("Failed to create temp file", "AdvancedLogger::_saveBootTimes", LogLevel::ERROR);
         return;
     }
-    _file.print("");
-    _file.close();
-    _logLines = 0;
-    _logPrint("Log cleared", "AdvancedLogger::clearLog", LogLevel::INFO);
+
+    bool written = true;
+    for (int i = 0; i < _bootTimeCount && written; i++)
+    {
+        uint8_t payload[LOG_TIME_PAYLOAD_SIZE];
+        uint8_t frame[LOG_TIME_FRAME_SIZE];
+        logFramePutU32(payload, _bootTimes[i].bootId);
+        logFramePutU64(payload + 4, _bootTimes[i].monotonicUs);
+        logFramePutU64(payload + 12, _bootTimes[i].unixUs);
+        size_t frameSize = logFrameEncode(frame, LogFrameType::TIME, payload, sizeof(payload));
+        written = tempFile.write(frame, frameSize) == frameSize;
+    }
+    tempFile.close();
+
+    if (!written)
+    {
+        SPIFFS.remove(path + TEMP_FILE_SUFFIX);
+        _logPrint("Failed to write boot times", "AdvancedLogger::_saveBootTimes", LogLevel::ERROR);
+        return;
+    }
+    _commitTempFile(path);
 }
 
 /**
- * @brief Clears the log but keeps the latest X percent of log entries.
+ * @brief Loads the task names saved during the boots whose times are kept.
  *
- * This method clears the log file but retains the latest X percent of log entries.
- * The default value is 10%.
- */
-void AdvancedLogger::clearLogKeepLatestXPercent(int percent) 
+ * The names are kept in a file of TASK frames next to the log, appended to
+ * when a task saves its first record in a boot. Must be called with the
+ * lock held.
+ *
+ * @param names Set to the names of the boots whose times are kept.
+ * @return size_t Number of names in the file, including the ones of the boots no longer kept.
+*/
+size_t AdvancedLogger::_loadTaskNames(std::vector<LogTaskName> &names)
 {
-    File sourceFile = SPIFFS.open(_logFilePath, "r");
-    if (!sourceFile) {
-        _logPrint("Failed to open source file", "AdvancedLogger::clearLogKeepLatestXPercent", LogLevel::ERROR);
-        return;
+    names.clear();
+    File file = SPIFFS.open(_logFilePath + TASK_FILE_SUFFIX, "r");
+    if (!file) return 0;
+
+    size_t count = 0;
+    uint8_t frame[LOG_FRAME_MAX_SIZE];
+    size_t frameSize;
+    while ((frameSize = logFileReadFrame(file, frame)) > 0)
+    {
+        size_t payloadSize = frameSize - LOG_FRAME_OVERHEAD;
+        if (frame[1] != (uint8_t)LogFrameType::TASK || payloadSize < LOG_TASK_PAYLOAD_HEADER_SIZE) continue;
+        count++;
+
+        LogTaskName name;
+        name.bootId = logFrameGetU32(frame + LOG_FRAME_HEADER_SIZE);
+        name.taskId = frame[LOG_FRAME_HEADER_SIZE + 4];
+        bool kept = false;
+        for (int i = 0; i < _bootTimeCount && !kept; i++) kept = _bootTimes[i].bootId == name.bootId;
+        if (!kept) continue;
+
+        size_t nameLength = min(payloadSize - LOG_TASK_PAYLOAD_HEADER_SIZE, LOG_TASK_NAME_SIZE - 1);
+        memcpy(name.name, frame + LOG_FRAME_HEADER_SIZE + LOG_TASK_PAYLOAD_HEADER_SIZE, nameLength);
+        name.name[nameLength] = '\0';
+        names.push_back(name);
     }
+    file.close();
+    return count;
+}
 
-    // Count lines first
-    size_t totalLines = 0;
-    while (sourceFile.available() && totalLines < MAX_WHILE_LOOP_COUNT) {
-        if (sourceFile.readStringUntil('\n').length() > 0) totalLines++;
-    }
-    sourceFile.seek(0);
+/**
+ * @brief Drops the task names of the boots whose times are no longer kept.
+ *
+ * Called once per boot after loading the boot times, as the records of
+ * those boots can no longer be dated either. The file is only rewritten,
+ * through a temporary file, if some names are dropped. Must be called
+ * with the lock held.
+*/
+void AdvancedLogger::_pruneTaskNames()
+{
+    String path = _logFilePath + TASK_FILE_SUFFIX;
+    logFileRecoverRotation(SPIFFS, path);
+    _persistedTasks = 0;
 
-    // Calculate lines to keep/skip
-    percent = min(max(percent, 0), 100);
-    size_t linesToKeep = (totalLines * percent) / 100;
-    size_t linesToSkip = totalLines - linesToKeep;
+    std::vector<LogTaskName> names;
+    if (_loadTaskNames(names) == names.size()) return;
 
-    File tempFile = SPIFFS.open(_logFilePath + ".tmp", "w");
-    if (!tempFile) {
-        _logPrint("Failed to create temp file", "AdvancedLogger::clearLogKeepLatestXPercent", LogLevel::ERROR);
-        sourceFile.close();
+    File tempFile = SPIFFS.open(path + TEMP_FILE_SUFFIX, "w");
+    if (!tempFile)
+    {
+        _logPrint("Failed to create temp file", "AdvancedLogger::_pruneTaskNames", LogLevel::ERROR);
         return;
     }
 
-    // Skip lines by reading
-    for (size_t i = 0; i < linesToSkip && sourceFile.available(); i++) {
-        sourceFile.readStringUntil('\n');
+    bool written = true;
+    for (size_t i = 0; i < names.size() && written; i++)
+    {
+        uint8_t payload[LOG_TASK_PAYLOAD_HEADER_SIZE + LOG_TASK_NAME_SIZE];
+        uint8_t frame[LOG_FRAME_OVERHEAD + sizeof(payload)];
+        size_t nameLength = strlen(names[i].name);
+        logFramePutU32(payload, names[i].bootId);
+        payload[4] = names[i].taskId;
+        memcpy(payload + LOG_TASK_PAYLOAD_HEADER_SIZE, names[i].name, nameLength);
+        size_t frameSize = logFrameEncode(frame, LogFrameType::TASK, payload, LOG_TASK_PAYLOAD_HEADER_SIZE + nameLength);
+        written = tempFile.write(frame, frameSize) == frameSize;
+    }
+    tempFile.close();
+
+    if (!written)
+    {
+        SPIFFS.remove(path + TEMP_FILE_SUFFIX);
+        _logPrint("Failed to write task names", "AdvancedLogger::_pruneTaskNames", LogLevel::ERROR);
+        return;
     }
+    _commitTempFile(path);
+}
 
-    // Direct copy of remaining lines
-    int _loopCount = 0;
-    while (sourceFile.available() && _loopCount < MAX_WHILE_LOOP_COUNT) {
-        String line = sourceFile.readStringUntil('\n');
-        if (line.length() > 0) {
-            tempFile.print(line);
+/**
+ * @brief Saves the name of a task for the current boot.
+ *
+ * The name is appended to the task names file, so that a task costs a
+ * single small write per boot. Must be called with the lock held.
+ *
+ * @param taskId Id of the task.
+*/
+void AdvancedLogger::_saveTaskName(uint8_t taskId)
+{
+    if (_bootId == 0) return; // Not started yet, the name is saved with the first record after begin()
+    _persistedTasks |= 1UL << taskId;
+
+    uint8_t payload[LOG_TASK_PAYLOAD_HEADER_SIZE + LOG_TASK_NAME_SIZE];
+    uint8_t frame[LOG_FRAME_OVERHEAD + sizeof(payload)];
+    size_t nameLength = strlen(_taskNames[taskId]);
+    logFramePutU32(payload, _bootId);
+    payload[4] = taskId;
+    memcpy(payload + LOG_TASK_PAYLOAD_HEADER_SIZE, _taskNames[taskId], nameLength);
+    size_t frameSize = logFrameEncode(frame, LogFrameType::TASK, payload, LOG_TASK_PAYLOAD_HEADER_SIZE + nameLength);
+
+    File file = SPIFFS.open(_logFilePath + TASK_FILE_SUFFIX, "a");
+    bool written = file && file.write(frame, frameSize) == frameSize;
+    if (file) file.close();
+    if (!written) _logPrint("Failed to save the name of task %s", "AdvancedLogger::_saveTaskName", LogLevel::ERROR, _taskNames[taskId]);
+}
+
+/**
+ * @brief Loads the state of the log segments from the filesystem.
+ *
+ * For each tier, each slot is first recovered from an interrupted rotation,
+ * and then identified by its header frame. The tail of each segment is
+ * checked for torn records: usually only the newest one can have been
+ * written to when a reset happened, but a failed write also leaves a torn
+ * record at the end of the segment it closes. Sizes are taken from the
+ * filesystem, and the number of records and the time span of a closed
+ * segment are read from its summary frame, so that only the segment that
+ * was active is walked. A segment closed without a summary (by a failed
+ * write or by a previous version) is walked once and then given one.
+*/
+void AdvancedLogger::_loadSegments()
+{
+    uint8_t frame[LOG_SEGMENT_FRAME_SIZE];
+    for (int tier = 0; tier < LOG_TIER_COUNT; tier++)
+    {
+        LogTierStorage &storage = _tiers[tier];
+        storage.activeSegment = -1;
+        storage.lines = 0;
+        storage.bytes = 0;
+
+        for (int slot = 0; slot < LOG_SEGMENT_SLOTS; slot++)
+        {
+            storage.segments[slot] = LogSegment();
+
+            String path = _segmentPath(tier, slot);
+            logFileRecoverRotation(SPIFFS, path);
+            if (!SPIFFS.exists(path)) continue;
+
+            File file = SPIFFS.open(path, "r");
+            if (!file) continue;
+            bool valid = file.read(frame, sizeof(frame)) == sizeof(frame) &&
+                         logFrameValidate(frame, sizeof(frame)) == sizeof(frame) &&
+                         frame[1] == (uint8_t)LogFrameType::SEGMENT;
+            file.close();
+
+            if (!valid)
+            {
+                // A reset while the segment was being opened: nothing else can have been written to it
+                SPIFFS.remove(path);
+                continue;
+            }
+
+            storage.segments[slot].used = true;
+            storage.segments[slot].sequence = logFrameGetU32(frame + LOG_FRAME_HEADER_SIZE);
+            if (storage.activeSegment < 0 || storage.segments[slot].sequence > storage.segments[storage.activeSegment].sequence)
+            {
+                storage.activeSegment = slot;
+            }
+        }
+
+        for (int slot = 0; slot < LOG_SEGMENT_SLOTS; slot++)
+        {
+            LogSegment &segment = storage.segments[slot];
+            if (!segment.used) continue;
+
+            String path = _segmentPath(tier, slot);
+            _recoverTail(path);
+            File file = SPIFFS.open(path, "r");
+            if (!file) continue;
+
+            LogSegmentSummary summary;
+            bool closed = logFileReadSegmentSummary(file, summary);
+            if (!closed) logFileScanRecords(file, LOG_SEGMENT_FRAME_SIZE, file.size(), summary);
+            segment.bytes = file.size();
+            file.close();
+
+            segment.lines = summary.lines;
+            segment.minTime = summary.minTime;
+            segment.maxTime = summary.maxTime;
+            segment.undated = summary.undated;
+            storage.bytes += segment.bytes;
+            storage.lines += segment.lines;
+
+            // The newest segment is only appended to if it was not closed yet
+            if (closed && slot == storage.activeSegment) storage.activeSegment = -1;
+            if (!closed && slot != storage.activeSegment) _closeSegment(tier, slot);
         }
+
+        _enforceRetention(tier);
     }
+}
 
-    sourceFile.close();
-    tempFile.close();
+/**
+ * @brief Imports the log written by the versions of the library before the segments.
+ *
+ * Those versions appended the lines as text to the log path itself, which
+ * is no longer read nor trimmed. Each line is saved as a record of the tier
+ * of its level, dated by its timestamp if it can be parsed with the
+ * timestamp format, and the file is then removed, so that it is only
+ * imported once. The lines were formatted as LOG_FORMAT without the task,
+ * so their level, core, function and message are already the body of a
+ * record. Must be called with the lock held, after the segments have been
+ * loaded.
+*/
+void AdvancedLogger::_importLegacyLog()
+{
+    if (!SPIFFS.exists(_logFilePath)) return;
 
+    unsigned int imported = 0;
+    File file = SPIFFS.open(_logFilePath, "r");
+    if (file)
+    {
+        uint8_t payload[LOG_TEXT_PREFIX_SIZE + MAX_LOG_LENGTH];
+        int _loopCount = 0;
+        while (file.available() && _loopCount < MAX_WHILE_LOOP_COUNT)
+        {
+            _loopCount++;
+            String line = file.readStringUntil('\n');
+            line.trim();
+
+            // [TIME] [MILLIS ms] [LOG_LEVEL] [Core CORE] [FUNCTION] MESSAGE
+            const char *timestamp = line.c_str();
+            const char *timestampEnd = strstr(timestamp, "] [");
+            if (timestamp[0] != '[' || timestampEnd == nullptr) continue;
+            const char *millisEnd = strstr(timestampEnd, " ms] [");
+            if (millisEnd == nullptr) continue;
+            const char *body = millisEnd + 5;
+
+            LogLevel logLevel = LogLevel::INFO;
+            for (int level = (int)LogLevel::VERBOSE; level <= (int)LogLevel::FATAL; level++)
+            {
+                const char *name = logLevelToString((LogLevel)level, false);
+                if (strncmp(body + 1, name, strlen(name)) == 0) logLevel = (LogLevel)level;
+            }
+
+            struct tm timeinfo = {};
+            String timestampText = line.substring(1, timestampEnd - timestamp);
+            const char *parsed = strptime(timestampText.c_str(), _timestampFormat, &timeinfo);
+            time_t unixTime = parsed != nullptr && *parsed == '\0' ? mktime(&timeinfo) : 0;
+            uint64_t millisValue = 0;
+            for (const char *c = timestampEnd + 3; c < millisEnd; c++)
+            {
+                if (*c >= '0' && *c <= '9') millisValue = millisValue * 10 + (*c - '0');
+            }
+
+            // The boot of the line is unknown, so it is saved with the boot id 0, which is never re-stamped
+            size_t bodyLength = min(strlen(body), (size_t)MAX_LOG_LENGTH);
+            logFramePutU32(payload, unixTime >= LOG_MIN_VALID_TIME ? (uint32_t)unixTime : 0);
+            logFramePutU32(payload + 4, 0);
+            logFramePutU64(payload + 8, millisValue * 1000);
+            memset(payload + 16, 0, LOG_TEXT_PREFIX_SIZE - 16);
+            memcpy(payload + LOG_TEXT_PREFIX_SIZE, body, bodyLength);
+
+            int tier = (int)(logLevel >= _criticalLevel ? LogTier::CRITICAL : LogTier::MAIN);
+            size_t frameSize = LOG_TEXT_PREFIX_SIZE + bodyLength + LOG_FRAME_OVERHEAD;
+            uint8_t *frame = _reserveFrame(tier, frameSize, logFrameGetU32(payload));
+            if (frame == nullptr) break;
+            logFrameEncode(frame, LogFrameType::TEXT, payload, LOG_TEXT_PREFIX_SIZE + bodyLength);
+            _commitFrame(tier);
+            _enforceRetention(tier, logFrameGetU32(payload));
+            imported++;
+        }
+        file.close();
+    }
+    _flushAll();
     SPIFFS.remove(_logFilePath);
-    SPIFFS.rename(_logFilePath + ".tmp", _logFilePath);
 
-    _logLines = linesToKeep;
-    _logPrint("Log cleared keeping latest entries", 
-              "AdvancedLogger::clearLogKeepLatestXPercent", LogLevel::INFO);
+    _logPrint("Imported %u lines of the log of a previous version", "AdvancedLogger::_importLegacyLog", LogLevel::INFO, imported);
 }
 
 /**
- * @brief Saves a message to the log file.
+ * @brief Gets the path of a segment.
  *
- * This method saves a message to the log file.
+ * @param tier Tier of the segment.
+ * @param slot Slot of the segment.
+ * @return String Path of the segment file.
+*/
+String AdvancedLogger::_segmentPath(int tier, int slot)
+{
+    return _logFilePath + "." + String(tier) + String(slot);
+}
+
+/**
+ * @brief Gets the oldest segment of a tier.
  *
- * @param messageFormatted Formatted message to save.
+ * @param tier Tier of the segments.
+ * @return int Slot of the segment with the lowest sequence number, or -1 if there are none.
 */
-void AdvancedLogger::_save(const char *messageFormatted)
+int AdvancedLogger::_oldestSegment(int tier)
 {
-    File _file = SPIFFS.open(_logFilePath, "a");
-    if (!_file)
+    const LogSegment *segments = _tiers[tier].segments;
+    int oldest = -1;
+    for (int slot = 0; slot < LOG_SEGMENT_SLOTS; slot++)
     {
-        Serial.printf("Failed to open log file for writing");
-        _logPrint("Failed to open log file", "AdvancedLogger::_save", LogLevel::ERROR);
-        return;
+        if (segments[slot].used && (oldest < 0 || segments[slot].sequence < segments[oldest].sequence)) oldest = slot;
     }
-    else
+    return oldest;
+}
+
+/**
+ * @brief Sorts the segments in use of a tier from the oldest to the newest.
+ *
+ * @param tier Tier of the segments.
+ * @param order Array of LOG_SEGMENT_SLOTS elements filled with the sorted slots.
+ * @return int Number of segments in use.
+*/
+int AdvancedLogger::_segmentsInOrder(int tier, int *order)
+{
+    const LogSegment *segments = _tiers[tier].segments;
+    int count = 0;
+    for (int slot = 0; slot < LOG_SEGMENT_SLOTS; slot++)
     {
-        _file.println(messageFormatted);
-        _file.close();
-        _logLines++;
+        if (!segments[slot].used) continue;
+
+        int i = count++;
+        while (i > 0 && segments[order[i - 1]].sequence > segments[slot].sequence)
+        {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = slot;
     }
-    
-    if (_logLines >= _maxLogLines) clearLogKeepLatestXPercent();
+    return count;
 }
 
 /**
- * @brief Dumps the log to a Stream.
+ * @brief Opens a new segment and makes it the active one of its tier.
  *
- * Dump the log to a Stream, such as Serial or an opened file.
+ * The active segment, whose frames must have been written, is closed
+ * first. A free slot is used if available, otherwise the oldest segment is
+ * removed to make room. The new segment starts with its header frame.
  *
- * @param stream Stream to dump the log to.
+ * @param tier Tier of the segment.
+ * @return bool Whether the segment was opened.
 */
-void AdvancedLogger::dump(Stream &stream)
+bool AdvancedLogger::_openNewSegment(int tier)
 {
-    debug("Dumping log to Stream...", "AdvancedLogger::dump");
+    LogTierStorage &storage = _tiers[tier];
+    if (storage.activeSegment >= 0)
+    {
+        _closeSegment(tier, storage.activeSegment);
+        storage.activeSegment = -1;
+    }
 
-    File _file = SPIFFS.open(_logFilePath, "r");
-    if (!_file)
+    int slot = -1;
+    uint32_t sequence = 0;
+    for (int i = 0; i < LOG_SEGMENT_SLOTS; i++)
+    {
+        if (!storage.segments[i].used)
+        {
+            if (slot < 0) slot = i;
+        }
+        else if (storage.segments[i].sequence >= sequence)
+        {
+            sequence = storage.segments[i].sequence + 1;
+        }
+    }
+
+    if (slot < 0)
+    {
+        slot = _oldestSegment(tier);
+        _removeSegment(tier, slot);
+    }
+
+    File file = SPIFFS.open(_segmentPath(tier, slot), "w");
+    if (!file)
+    {
+        _logPrint("Failed to create log segment", "AdvancedLogger::_openNewSegment", LogLevel::ERROR);
+        return false;
+    }
+    bool written = logFileWriteSegmentHeader(file, sequence);
+    file.close();
+
+    if (!written)
+    {
+        SPIFFS.remove(_segmentPath(tier, slot));
+        _logPrint("Failed to write log segment header", "AdvancedLogger::_openNewSegment", LogLevel::ERROR);
+        return false;
+    }
+
+    storage.segments[slot].used = true;
+    storage.segments[slot].sequence = sequence;
+    storage.segments[slot].bytes = LOG_SEGMENT_FRAME_SIZE;
+    storage.segments[slot].lines = 0;
+    storage.bytes += LOG_SEGMENT_FRAME_SIZE;
+    storage.activeSegment = slot;
+    return true;
+}
+
+/**
+ * @brief Appends the summary frame to a segment that is no longer written to.
+ *
+ * The summary holds the number of records and the time span of the
+ * segment, so that begin() does not have to walk it. If it cannot be
+ * written, the segment is walked at the next begin() instead.
+ *
+ * @param tier Tier of the segment.
+ * @param slot Slot of the segment to close.
+*/
+void AdvancedLogger::_closeSegment(int tier, int slot)
+{
+    LogSegment &segment = _tiers[tier].segments[slot];
+    LogSegmentSummary summary;
+    summary.lines = (uint32_t)segment.lines;
+    summary.minTime = segment.minTime;
+    summary.maxTime = segment.maxTime;
+    summary.undated = segment.undated;
+
+    File file = SPIFFS.open(_segmentPath(tier, slot), "a");
+    bool written = file && logFileWriteSegmentSummary(file, summary);
+    if (file) file.close();
+    if (!written)
     {
-        Serial.printf("Failed to open log file for reading");
-        _logPrint("Failed to open log file", "AdvancedLogger::dump", LogLevel::ERROR);
+        _logPrint("Failed to write log segment summary", "AdvancedLogger::_closeSegment", LogLevel::ERROR);
         return;
     }
 
+    segment.bytes += LOG_SUMMARY_FRAME_SIZE;
+    _tiers[tier].bytes += LOG_SUMMARY_FRAME_SIZE;
+}
+
+/**
+ * @brief Removes a segment.
+ *
+ * @param tier Tier of the segment.
+ * @param slot Slot of the segment to remove.
+*/
+void AdvancedLogger::_removeSegment(int tier, int slot)
+{
+    LogTierStorage &storage = _tiers[tier];
+    SPIFFS.remove(_segmentPath(tier, slot));
+
+    storage.bytes -= storage.segments[slot].bytes;
+    storage.lines -= storage.segments[slot].lines;
+    storage.segments[slot] = LogSegment();
+    if (storage.activeSegment == slot) storage.activeSegment = -1;
+}
+
+/**
+ * @brief Enforces the retention policies of a tier.
+ *
+ * The byte budget is checked against the tracked sizes, and the oldest
+ * segments are removed until the tier fits. Then, if the oldest segment
+ * only holds records older than the maximum age, it is removed: a single
+ * segment per call keeps the expiry spread over the appends. The active
+ * segment is never removed. The line-count limit, if enabled, is applied
+ * last to the whole log.
+ *
+ * @param tier Tier to enforce the retention of.
+ * @param now Unix time of the record just saved, or 0 to read the clock, which is only done if the maximum age is enabled.
+*/
+void AdvancedLogger::_enforceRetention(int tier, uint32_t now)
+{
+    LogTierStorage &storage = _tiers[tier];
+
     int _loopCount = 0;
-    while (_file.available() && _loopCount < MAX_WHILE_LOOP_COUNT)
+    while (storage.bytes > storage.maxBytes && _loopCount < LOG_SEGMENT_SLOTS)
     {
         _loopCount++;
-        stream.write(_file.read());
+        int oldest = _oldestSegment(tier);
+        if (oldest < 0 || oldest == storage.activeSegment) break;
+        _removeSegment(tier, oldest);
     }
-    stream.flush();
-    _file.close();
 
-    debug("Log dumped to Stream", "AdvancedLogger::dump");
+    if (_maxLogAge > 0 && now == 0) now = (uint32_t)time(nullptr);
+    if (_maxLogAge > 0 && now >= LOG_MIN_VALID_TIME)
+    {
+        int order[LOG_SEGMENT_SLOTS];
+        int count = _segmentsInOrder(tier, order);
+
+        // A segment logged before the clock was set is dated by the first record of the next one
+        if (count > 1 && order[0] != storage.activeSegment)
+        {
+            uint32_t newestTime = storage.segments[order[0]].maxTime > 0 ? storage.segments[order[0]].maxTime : storage.segments[order[1]].minTime;
+            if (newestTime > 0 && now - newestTime > _maxLogAge) _removeSegment(tier, order[0]);
+        }
+    }
+
+    if (_maxLogLines > 0 && getLogLines() >= _maxLogLines) clearLogKeepLatestXPercent();
+}
+
+/**
+ * @brief Keeps only the latest records of a segment.
+ *
+ * The segment is rewritten through a temporary file, which starts with a
+ * fresh header with the same sequence number, followed by the kept bytes.
+ * The records kept are counted and their time span is read from their
+ * headers, and a segment that was closed gets a new summary.
+ *
+ * @param tier Tier of the segment.
+ * @param slot Slot of the segment to trim.
+ * @param linesToKeep Number of records to keep.
+ * @return bool Whether the segment was trimmed.
+*/
+bool AdvancedLogger::_trimSegment(int tier, int slot, size_t linesToKeep)
+{
+    LogTierStorage &storage = _tiers[tier];
+    LogSegment &segment = storage.segments[slot];
+
+    String path = _segmentPath(tier, slot);
+    File sourceFile = SPIFFS.open(path, "r");
+    if (!sourceFile) {
+        _logPrint("Failed to open source file", "AdvancedLogger::_trimSegment", LogLevel::ERROR);
+        return false;
+    }
+
+    LogSegmentSummary summary;
+    bool closed = logFileReadSegmentSummary(sourceFile, summary);
+    size_t recordsEnd = sourceFile.size() - (closed ? LOG_SUMMARY_FRAME_SIZE : 0);
+
+    size_t linesKept = 0;
+    size_t cutOffset = logFileFindCutOffset(sourceFile, recordsEnd, linesToKeep, LOG_SEGMENT_FRAME_SIZE, linesKept);
+    logFileScanRecords(sourceFile, cutOffset, recordsEnd, summary);
+
+    File tempFile = SPIFFS.open(path + TEMP_FILE_SUFFIX, "w");
+    if (!tempFile) {
+        _logPrint("Failed to create temp file", "AdvancedLogger::_trimSegment", LogLevel::ERROR);
+        sourceFile.close();
+        return false;
+    }
+
+    bool copied = logFileWriteSegmentHeader(tempFile, segment.sequence) &&
+                  logFileCopyRange(sourceFile, tempFile, cutOffset, recordsEnd) &&
+                  (!closed || logFileWriteSegmentSummary(tempFile, summary));
+
+    sourceFile.close();
+    tempFile.close();
+
+    if (!copied) {
+        SPIFFS.remove(path + TEMP_FILE_SUFFIX);
+        _logPrint("Failed to copy latest entries", "AdvancedLogger::_trimSegment", LogLevel::ERROR);
+        return false;
+    }
+    _commitTempFile(path);
+    segment.generation++;
+
+    size_t bytesKept = LOG_SEGMENT_FRAME_SIZE + recordsEnd - cutOffset + (closed ? LOG_SUMMARY_FRAME_SIZE : 0);
+    storage.bytes -= segment.bytes - bytesKept;
+    storage.lines -= segment.lines - summary.lines;
+
+    segment.bytes = bytesKept;
+    segment.lines = summary.lines;
+    segment.minTime = summary.minTime;
+    segment.maxTime = summary.maxTime;
+    segment.undated = summary.undated;
+    return true;
+}
+
+/**
+ * @brief Drops the torn records at the end of a file.
+ *
+ * Looks for the last valid record by reading only the tail of the file,
+ * and drops any torn record left by a power loss during a write (see
+ * logFileRecoverTail()).
+ *
+ * @param path Path of the file to recover.
+*/
+void AdvancedLogger::_recoverTail(const String &path)
+{
+    size_t droppedBytes = 0;
+    switch (logFileRecoverTail(SPIFFS, path, droppedBytes))
+    {
+    case LogTailRecovery::INTACT:
+        break;
+    case LogTailRecovery::RECOVERED:
+        _logPrint("Dropped %u bytes of torn records", "AdvancedLogger::_recoverTail", LogLevel::WARNING, (unsigned int)droppedBytes);
+        break;
+    case LogTailRecovery::OPEN_FAILED:
+        _logPrint("Failed to open log file", "AdvancedLogger::_recoverTail", LogLevel::ERROR);
+        break;
+    case LogTailRecovery::CREATE_FAILED:
+        _logPrint("Failed to create temp file", "AdvancedLogger::_recoverTail", LogLevel::ERROR);
+        break;
+    case LogTailRecovery::COPY_FAILED:
+        _logPrint("Failed to copy valid records", "AdvancedLogger::_recoverTail", LogLevel::ERROR);
+        break;
+    case LogTailRecovery::RENAME_FAILED:
+        _logPrint("Failed to rename temp file", "AdvancedLogger::_recoverTail", LogLevel::ERROR);
+        break;
+    }
+}
+
+/**
+ * @brief Replaces a file with its temporary copy.
+ *
+ * SPIFFS cannot rename over an existing file, so the original is removed
+ * first. A reset between the two steps leaves only the temporary file,
+ * which logFileRecoverRotation() renames at the next begin().
+ *
+ * @param path Path of the file to replace. The temporary copy is at path + TEMP_FILE_SUFFIX.
+ * @return bool Whether the replacement succeeded.
+*/
+bool AdvancedLogger::_commitTempFile(const String &path)
+{
+    if (!logFileCommitTemp(SPIFFS, path))
+    {
+        _logPrint("Failed to rename temp file", "AdvancedLogger::_commitTempFile", LogLevel::ERROR);
+        return false;
+    }
+    return true;
 }
 
 /**
@@ -612,14 +3637,25 @@ LogLevel AdvancedLogger::_charToLogLevel(const char *logLevelChar)
 */
 String AdvancedLogger::_getTimestamp()
 {
-    char _timestamp[1024];
-
-    time_t _time = time(nullptr);
-    struct tm _timeinfo = *localtime(&_time);
-    strftime(_timestamp, sizeof(_timestamp), _timestampFormat, &_timeinfo);
+    char _timestamp[TIMESTAMP_BUFFER_SIZE];
+    _formatTimestamp(time(nullptr), _timestamp, sizeof(_timestamp));
     return String(_timestamp);
 }
 
+/**
+ * @brief Formats a unix time with the timestamp format.
+ *
+ * @param seconds Unix time to format.
+ * @param buffer Destination buffer.
+ * @param size Size of the destination buffer.
+*/
+void AdvancedLogger::_formatTimestamp(time_t seconds, char *buffer, size_t size)
+{
+    struct tm _timeinfo;
+    localtime_r(&seconds, &_timeinfo);
+    if (strftime(buffer, size, _timestampFormat, &_timeinfo) == 0) buffer[0] = '\0';
+}
+
 /**
  * @brief Checks if a path is valid.
  *
@@ -692,11 +3728,11 @@ bool AdvancedLogger::_isValidTimestampFormat(const char *format)
  *
  * This method formats milliseconds.
  *
- * @param millis Milliseconds to format.
+ * @param millis Milliseconds since boot to format, as 64 bits so that it never wraps.
  * @return String Formatted milliseconds.
 */
-String AdvancedLogger::_formatMillis(unsigned long millisToFormat) {
-    String str = String(millisToFormat);
+String AdvancedLogger::_formatMillis(uint64_t millisToFormat) {
+    String str = String((unsigned long long)millisToFormat);
     int n = str.length();
     int insertPosition = n - 3;
 
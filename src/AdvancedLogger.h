@@ -18,9 +18,23 @@
 
 #include <Arduino.h>
 #include <SPIFFS.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <sys/time.h>
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
+#include "LogBacktrace.h"
+#include "LogFile.h"
+#include "LogFrame.h"
+#include "LogLiveRing.h"
+#include "LogMerge.h"
+#include "LogRecordPool.h"
+#include "LogStats.h"
+#include "LogWatch.h"
+
 #define CORE_ID xPortGetCoreID()
 #define LOG_D(format, ...) log_d(format, ##__VA_ARGS__)
 #define LOG_I(format, ...) log_i(format, ##__VA_ARGS__)
@@ -38,18 +52,270 @@ enum class LogLevel : int {
 
 constexpr const LogLevel DEFAULT_PRINT_LEVEL = LogLevel::DEBUG;
 constexpr const LogLevel DEFAULT_SAVE_LEVEL = LogLevel::INFO;
+constexpr const LogLevel DEFAULT_CRITICAL_LEVEL = LogLevel::ERROR;
+constexpr const LogLevel DEFAULT_SYNC_LEVEL = LogLevel::ERROR; // Records at or above are on storage before the log call returns
+constexpr const LogLevel DEFAULT_DEADLINE_LEVEL = LogLevel::WARNING; // Records at or above are on storage within the flush deadline
+
+enum class LogTier : int {
+    MAIN,    // Records below the critical level
+    CRITICAL // Records at or above the critical level, with their own byte budget
+};
+
+constexpr int LOG_TIER_COUNT = 2;
 
 constexpr int MAX_LOG_LENGTH = 1024;
 
 constexpr const char* DEFAULT_LOG_PATH = "/AdvancedLogger/log.txt";
 constexpr const char* DEFAULT_CONFIG_PATH = "/AdvancedLogger/config.txt";
-
-constexpr int DEFAULT_MAX_LOG_LINES = 1000;
+constexpr const char* TEMP_FILE_SUFFIX = LOG_TEMP_FILE_SUFFIX;
+constexpr const char* TIME_FILE_SUFFIX = ".time";
+constexpr const char* TASK_FILE_SUFFIX = ".tasks";
+constexpr const char* CONFIG_BINARY_SUFFIX = ".bin"; // The binary configuration is next to the text one, which is only imported and exported
+
+constexpr int DEFAULT_MAX_LOG_LINES = 0; // Line-count retention is disabled by default, the byte budget is used instead
+constexpr size_t DEFAULT_MAX_LOG_BYTES = 256 * 1024;
+constexpr size_t DEFAULT_MAX_CRITICAL_LOG_BYTES = 64 * 1024;
+constexpr uint32_t DEFAULT_MAX_LOG_AGE = 0; // Time-based retention is disabled by default
+constexpr int LOG_SEGMENT_COUNT = 8; // The byte budget is split in this many segments, and the oldest one is dropped when it is exceeded
+constexpr int LOG_SEGMENT_SLOTS = LOG_SEGMENT_COUNT + 1; // One spare slot for the segment being opened
 constexpr int MAX_WHILE_LOOP_COUNT = 10000;
+constexpr size_t LOG_WRITE_BUFFER_SIZE = 4096; // Per tier, must hold at least one frame of LOG_FRAME_MAX_SIZE
+constexpr uint32_t DEFAULT_FLUSH_DEADLINE = 100; // ms
+constexpr uint32_t DEFAULT_FLUSH_INTERVAL = 5000; // ms
+constexpr const char* FLUSH_TASK_NAME = "AdvancedLoggerFlush";
+constexpr uint32_t FLUSH_TASK_STACK_SIZE = 6144;
+constexpr UBaseType_t FLUSH_TASK_PRIORITY = 1;
+constexpr const char* CALLBACK_TASK_NAME = "AdvancedLoggerCallback";
+constexpr uint32_t CALLBACK_TASK_STACK_SIZE = 8192; // The callback usually does network I/O
+constexpr UBaseType_t CALLBACK_TASK_PRIORITY = 1;
+constexpr UBaseType_t CALLBACK_QUEUE_LENGTH = 16;
+constexpr uint32_t DEFAULT_CALLBACK_DEADLINE = 1000; // ms
+constexpr size_t DEFAULT_LIVE_BUFFER_SIZE = 8192; // Shared by all the live subscribers
+constexpr const char* LOG_LIVE_GAP_FORMAT = "[... %u records skipped ...]"; // Returned to a live subscriber which fell behind
+constexpr size_t DEFAULT_BACKTRACE_BUFFER_SIZE = 4096;
+constexpr size_t DEFAULT_BACKTRACE_RECORDS = 32; // Saved ahead of each record triggering the backtrace
+constexpr size_t LOG_PANIC_BUFFER_SIZE = 4096; // No-init RAM receiving the buffered records on a panic or restart
+constexpr uint32_t LOG_PANIC_MAGIC = 0x41444C50;
 
 constexpr const char* DEFAULT_TIMESTAMP_FORMAT = "%Y-%m-%d %H:%M:%S";
+constexpr size_t TIMESTAMP_BUFFER_SIZE = 64;
+constexpr int LOG_BOOT_TIME_COUNT = 16; // Boots whose clock setting is kept, to re-stamp the records logged before it
+
+constexpr const char* LOG_FORMAT = "[%s] [%s ms] [%s] [Core %d] [%s] %s task=%s"; // [TIME] [MILLIS ms] [LOG_LEVEL] [Core CORE] [FUNCTION] MESSAGE task=TASK
+constexpr const char* LOG_PREFIX_FORMAT = "[%s] [%s ms] "; // The part of LOG_FORMAT rendered from the record metadata when the log is read
+constexpr const char* LOG_BODY_FORMAT = "[%s] [Core %d] [%s] %s"; // The part of LOG_FORMAT stored in the log
+constexpr const char* LOG_TASK_FORMAT = " task=%s"; // Ends the line, after the fields, so that the columns are the ones of the versions without the task
+constexpr const char* LOG_BYTES_FORMAT = "[%s] [Core %d] [%.*s] %u bytes"; // First line of a block of bytes, followed by its hexdump
+constexpr size_t LOG_HEXDUMP_BYTES_PER_LINE = 16;
+constexpr const char* LOG_SPAN_FORMAT = "[%s] [Core %d] [%.*s] %s"; // LOG_BODY_FORMAT of a span, whose name is the function
+constexpr size_t LOG_FIELDS_MAX_SIZE = 256; // Encoded fields of a record, including their length
+constexpr size_t LOG_CONTEXT_FIELD_SIZE = 48; // Encoded key and value of a context entry
+constexpr int LOG_CONTEXT_MAX_DEPTH = 8; // Entries of the context of a task added to a record, starting from the first pushed
+constexpr size_t LOG_WATCH_MAX_MATCHES = 8; // Watches triggered by a single record
+constexpr int LOG_TASK_COUNT = 32; // Task names resolved per boot, the tasks past these get the id 0, rendered as "unknown"
+constexpr size_t LOG_TASK_NAME_SIZE = 16; // configMAX_TASK_NAME_LEN of the Arduino core
+constexpr uint8_t LOG_TASK_UNRESOLVED = 0xFF;
+
+struct LogSegment {
+    bool used = false;
+    uint32_t sequence = 0;
+    size_t bytes = 0;
+    size_t lines = 0;
+    uint32_t minTime = 0; // Unix time of the oldest record with a valid time, 0 if none
+    uint32_t maxTime = 0; // Unix time of the newest record with a valid time, 0 if none
+    bool undated = false; // Whether it holds records logged before the clock was set
+    uint32_t generation = 0; // Incremented when the file is rewritten, so that a dump reading it notices
+};
+
+struct LogBootTime {
+    uint32_t bootId = 0;
+    uint64_t monotonicUs = 0; // Monotonic time at which the clock was found set
+    uint64_t unixUs = 0; // Unix time at that moment, 0 if the clock was never set during the boot
+};
+
+struct LogTierStorage {
+    LogSegment segments[LOG_SEGMENT_SLOTS];
+    int activeSegment = -1;
+    size_t maxBytes = DEFAULT_MAX_LOG_BYTES;
+    size_t bytes = 0; // Including the buffered frames
+    size_t lines = 0; // Including the buffered frames
+    std::vector<uint8_t> buffer; // Frames not yet written to the active segment
+    std::atomic<size_t> encoded{0}; // End of the frames of buffer fully encoded, read by the emergency flush
+    size_t bufferedLines = 0;
+    uint64_t lastMonotonicUs = 0; // Of the newest record saved during this boot, as the records of a tier must stay in chronological order
+};
+
+struct LogPanicBuffer {
+    uint32_t magic; // LOG_PANIC_MAGIC when the buffer holds records not yet saved
+    uint16_t lengths[LOG_TIER_COUNT]; // Bytes of frames of each tier, stored from the last tier to the first
+    uint8_t data[LOG_PANIC_BUFFER_SIZE];
+};
+
+struct LogTierCursor {
+    int tier = 0;
+    int order[LOG_SEGMENT_SLOTS];
+    int count = 0;
+    int index = 0; // Next segment of order to open
+    uint32_t sequences[LOG_SEGMENT_SLOTS]; // Sequence numbers of the segments of order when the dump started
+    size_t ends[LOG_SEGMENT_SLOTS]; // Sizes of the segments of order when the dump started
+    File file;
+    uint32_t generation = 0; // Of the segment being read
+    size_t end = 0; // Offset at which the segment being read stops
+    std::vector<uint8_t> frame; // Current record, allocated on first use
+    size_t frameSize = 0;
+    uint64_t time = 0; // Unix time of the current record in microseconds, re-stamped if needed
+};
+
+struct LogTaskName {
+    uint32_t bootId = 0;
+    uint8_t taskId = 0;
+    char name[LOG_TASK_NAME_SIZE] = "";
+};
+
+struct LogCallbackRecord {
+    time_t second = 0; // Unix time, rendered with the timestamp format by the callback task
+    unsigned long millisEsp = 0;
+    LogLevel level = LogLevel::INFO;
+    unsigned int coreId = 0;
+    uint16_t functionLength = 0;
+    uint16_t messageLength = 0;
+    // Followed by the function name and the message, both null-terminated
+};
+
+struct LogCallbackStats {
+    uint32_t invoked = 0;
+    uint32_t queued = 0; // Records currently waiting for the callback
+    uint32_t dropped = 0; // Records not passed to the callback as the queue or the record pool was full, or as the callback logged them itself
+    uint32_t overruns = 0; // Invocations which exceeded the callback deadline
+    uint32_t maxDuration = 0; // Longest invocation, in milliseconds
+};
+
+struct LogFunctionStats {
+    char function[LOG_STATS_FUNCTION_SIZE] = "";
+    LogLevel level = LogLevel::INFO;
+    uint32_t count = 0; // Records of the function at this level in the window
+    uint32_t error = 0; // Maximum overestimation of the count since boot, from the records before the function was tracked
+};
+
+enum class LogDumpFormat : int {
+    TEXT, // One line per record, in LOG_FORMAT, with the fields as key=value
+    JSON  // One JSON object per line, with the fields as members
+};
+
+class AdvancedLogger;
+
+/**
+ * @brief Collects the typed key-value fields of a record, and logs it when destroyed.
+ *
+ * Returned by AdvancedLogger::record(), to be used in a single expression:
+ * logger.record(LogLevel::INFO, "valve::move", "valve moved").kv("id", 3).kv("pos", 42.5);
+ * If the level is filtered out, the fields are not even encoded. Fields which
+ * do not fit in LOG_FIELDS_MAX_SIZE bytes are dropped.
+ */
+class LogRecordBuilder
+{
+public:
+    LogRecordBuilder(AdvancedLogger *logger, LogLevel logLevel, const char *function, const char *message)
+        : _logger(logger), _logLevel(logLevel), _function(function), _message(message) {}
+    LogRecordBuilder(LogRecordBuilder &&other)
+        : _logger(other._logger), _logLevel(other._logLevel), _function(other._function), _message(other._message), _fieldsLength(other._fieldsLength)
+    {
+        memcpy(_fields, other._fields, _fieldsLength);
+        other._logger = nullptr;
+    }
+    LogRecordBuilder(const LogRecordBuilder &) = delete;
+    LogRecordBuilder &operator=(const LogRecordBuilder &) = delete;
+    ~LogRecordBuilder();
+
+    LogRecordBuilder &kv(const char *key, int value) { return _putNumber(LogFieldType::INT, key, (uint64_t)(int64_t)value); }
+    LogRecordBuilder &kv(const char *key, long value) { return _putNumber(LogFieldType::INT, key, (uint64_t)(int64_t)value); }
+    LogRecordBuilder &kv(const char *key, long long value) { return _putNumber(LogFieldType::INT, key, (uint64_t)value); }
+    LogRecordBuilder &kv(const char *key, unsigned int value) { return _putNumber(LogFieldType::UINT, key, value); }
+    LogRecordBuilder &kv(const char *key, unsigned long value) { return _putNumber(LogFieldType::UINT, key, value); }
+    LogRecordBuilder &kv(const char *key, unsigned long long value) { return _putNumber(LogFieldType::UINT, key, value); }
+    LogRecordBuilder &kv(const char *key, double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return _putNumber(LogFieldType::FLOAT, key, bits);
+    }
+    LogRecordBuilder &kv(const char *key, bool value)
+    {
+        uint8_t byte = value ? 1 : 0;
+        return _put(LogFieldType::BOOL, key, &byte, 1, nullptr, 0);
+    }
+    LogRecordBuilder &kv(const char *key, const char *value)
+    {
+        size_t length = std::min(strlen(value), (size_t)255);
+        uint8_t lengthByte = (uint8_t)length;
+        return _put(LogFieldType::STRING, key, &lengthByte, 1, (const uint8_t *)value, length);
+    }
+    LogRecordBuilder &kv(const char *key, const String &value) { return kv(key, value.c_str()); }
 
-constexpr const char* LOG_FORMAT = "[%s] [%s ms] [%s] [Core %d] [%s] %s"; // [TIME] [MILLIS ms] [LOG_LEVEL] [Core CORE] [FUNCTION] MESSAGE
+private:
+    AdvancedLogger *_logger; // nullptr if the level is filtered out
+    LogLevel _logLevel;
+    const char *_function;
+    const char *_message;
+    uint8_t _fields[LOG_FIELDS_MAX_SIZE]; // Starts with the length of the fields, set when the record is logged
+    size_t _fieldsLength = LOG_FIELDS_HEADER_SIZE;
+
+    LogRecordBuilder &_putNumber(LogFieldType type, const char *key, uint64_t bits)
+    {
+        uint8_t value[8];
+        logFramePutU64(value, bits);
+        return _put(type, key, value, sizeof(value), nullptr, 0);
+    }
+
+    LogRecordBuilder &_put(LogFieldType type, const char *key, const uint8_t *value, size_t valueLength, const uint8_t *extra, size_t extraLength)
+    {
+        if (_logger == nullptr) return *this;
+
+        _fieldsLength += logFramePutField(_fields + _fieldsLength, sizeof(_fields) - _fieldsLength, type, key, strlen(key), value, valueLength, extra, extraLength);
+        return *this;
+    }
+};
+
+/**
+ * @brief An entry of the logging context of a task, such as a request or job id.
+ *
+ * The entries pushed by a task are added as fields to every message it logs,
+ * from the first pushed to the last. The key and the value are encoded when
+ * the entry is created, so that logging only copies the encoded bytes. The
+ * key should be short, and strings are truncated to fit in LOG_CONTEXT_FIELD_SIZE.
+ */
+struct LogContext {
+    LogContext(const char *key, const char *value) { _putString(key, value); }
+    LogContext(const char *key, const String &value) { _putString(key, value.c_str()); }
+    LogContext(const char *key, int value) { _putNumber(LogFieldType::INT, key, (uint64_t)(int64_t)value); }
+    LogContext(const char *key, long value) { _putNumber(LogFieldType::INT, key, (uint64_t)(int64_t)value); }
+    LogContext(const char *key, long long value) { _putNumber(LogFieldType::INT, key, (uint64_t)value); }
+    LogContext(const char *key, unsigned int value) { _putNumber(LogFieldType::UINT, key, value); }
+    LogContext(const char *key, unsigned long value) { _putNumber(LogFieldType::UINT, key, value); }
+    LogContext(const char *key, unsigned long long value) { _putNumber(LogFieldType::UINT, key, value); }
+    LogContext(const LogContext &) = delete;
+    LogContext &operator=(const LogContext &) = delete;
+
+    uint8_t field[LOG_CONTEXT_FIELD_SIZE]; // Encoded as in a FIELDS frame
+    size_t fieldLength = 0;
+    LogContext *parent = nullptr; // Entry pushed before this one by the same task
+
+private:
+    void _putNumber(LogFieldType type, const char *key, uint64_t bits)
+    {
+        uint8_t value[8];
+        logFramePutU64(value, bits);
+        fieldLength = logFramePutField(field, sizeof(field), type, key, strlen(key), value, sizeof(value), nullptr, 0);
+    }
+
+    void _putString(const char *key, const char *value)
+    {
+        size_t keyLength = std::min(strlen(key), LOG_CONTEXT_FIELD_SIZE - LOG_FIELD_HEADER_SIZE - 1);
+        size_t length = std::min(strlen(value), LOG_CONTEXT_FIELD_SIZE - LOG_FIELD_HEADER_SIZE - 1 - keyLength);
+        uint8_t lengthByte = (uint8_t)length;
+        fieldLength = logFramePutField(field, sizeof(field), LogFieldType::STRING, key, keyLength, &lengthByte, 1, (const uint8_t *)value, length);
+    }
+};
 
 using LogCallback = std::function<void(
     const char* timestamp,
@@ -59,7 +325,19 @@ using LogCallback = std::function<void(
     const char* function,
     const char* message
 )>;
-     
+
+
+using LogWatchCallback = std::function<void(
+    int watchId,
+    const char* level,
+    const char* function,
+    const char* message
+)>;
+
+struct LogWatch {
+    LogWatchCallback callback = nullptr;
+    LogLevel minLevel = LogLevel::VERBOSE;
+};
 
 class AdvancedLogger
 {
@@ -68,15 +346,80 @@ public:
         const char *logFilePath = DEFAULT_LOG_PATH,
         const char *configFilePath = DEFAULT_CONFIG_PATH,
         const char *timestampFormat = DEFAULT_TIMESTAMP_FORMAT);
+    ~AdvancedLogger();
 
     void begin();
 
-    void verbose(const char *format, const char *function, ...);
-    void debug(const char *format, const char *function, ...);
-    void info(const char *format, const char *function, ...);
-    void warning(const char *format, const char *function, ...);
-    void error(const char *format, const char *function, ...);
-    void fatal(const char *format, const char *function, ...);
+    /**
+     * @brief Logs a message with the provided format and function name.
+     *
+     * The logging methods are always inlined in the caller, even with -Os, where
+     * they only load the lowest enabled level: the formatting and I/O are only reached,
+     * through an out-of-line call, if the message is printed or saved.
+     *
+     * @param format Format of the message.
+     * @param function Name of the function where the message is logged.
+     * @param args Arguments to be formatted into the message using the printf format.
+     */
+    template <typename... Args>
+    [[gnu::always_inline]] inline void verbose(const char *format, const char *function = "unknown", Args... args)
+    {
+        if (_isEnabled(LogLevel::VERBOSE)) _logFormatted(LogLevel::VERBOSE, format, function, args...);
+    }
+    template <typename... Args>
+    [[gnu::always_inline]] inline void debug(const char *format, const char *function = "unknown", Args... args)
+    {
+        if (_isEnabled(LogLevel::DEBUG)) _logFormatted(LogLevel::DEBUG, format, function, args...);
+    }
+    template <typename... Args>
+    [[gnu::always_inline]] inline void info(const char *format, const char *function = "unknown", Args... args)
+    {
+        if (_isEnabled(LogLevel::INFO)) _logFormatted(LogLevel::INFO, format, function, args...);
+    }
+    template <typename... Args>
+    [[gnu::always_inline]] inline void warning(const char *format, const char *function = "unknown", Args... args)
+    {
+        if (_isEnabled(LogLevel::WARNING)) _logFormatted(LogLevel::WARNING, format, function, args...);
+    }
+    template <typename... Args>
+    [[gnu::always_inline]] inline void error(const char *format, const char *function = "unknown", Args... args)
+    {
+        if (_isEnabled(LogLevel::ERROR)) _logFormatted(LogLevel::ERROR, format, function, args...);
+    }
+    template <typename... Args>
+    [[gnu::always_inline]] inline void fatal(const char *format, const char *function = "unknown", Args... args)
+    {
+        if (_isEnabled(LogLevel::FATAL)) _logFormatted(LogLevel::FATAL, format, function, args...);
+    }
+
+    /**
+     * @brief Logs a block of raw bytes, such as a protocol frame, rendered as a hexdump only when read.
+     *
+     * @param logLevel Log level of the block.
+     * @param function Name of the function where the block is logged.
+     * @param data Bytes to log.
+     * @param length Number of bytes to log.
+     */
+    [[gnu::always_inline]] inline void logBytes(LogLevel logLevel, const char *function, const uint8_t *data, size_t length)
+    {
+        if (_isEnabled(logLevel)) _logBytes(logLevel, function, data, length);
+    }
+
+    /**
+     * @brief Starts a record with typed key-value fields, logged at the end of the expression.
+     *
+     * @param logLevel Log level of the record.
+     * @param function Name of the function where the record is logged.
+     * @param message Message of the record, which is not formatted.
+     * @return LogRecordBuilder Builder whose kv() methods add the fields.
+     */
+    [[gnu::always_inline]] inline LogRecordBuilder record(LogLevel logLevel, const char *function, const char *message)
+    {
+        return LogRecordBuilder(_isEnabled(logLevel) ? this : nullptr, logLevel, function, message);
+    }
+
+    static void pushContext(LogContext &context);
+    static void popContext();
 
     void setPrintLevel(LogLevel logLevel);
     void setSaveLevel(LogLevel logLevel);
@@ -85,13 +428,34 @@ public:
     LogLevel getSaveLevel();
 
     void setDefaultConfig();
+    bool importConfig();
+    bool exportConfig();
 
     void setMaxLogLines(int maxLogLines);
     int getLogLines();
+    void setMaxLogBytes(size_t maxLogBytes, LogTier tier = LogTier::MAIN);
+    size_t getMaxLogBytes(LogTier tier = LogTier::MAIN);
+    size_t getLogBytes();
+    void setMaxLogAge(uint32_t maxLogAge);
+    uint32_t getMaxLogAge();
+    void setCriticalLevel(LogLevel logLevel);
+    LogLevel getCriticalLevel();
+    void setSyncLevel(LogLevel logLevel);
+    LogLevel getSyncLevel();
+    void setDeadlineLevel(LogLevel logLevel);
+    LogLevel getDeadlineLevel();
+    void setFlushDeadline(uint32_t flushDeadline);
+    uint32_t getFlushDeadline();
+    void setFlushInterval(uint32_t flushInterval);
+    uint32_t getFlushInterval();
+    void flush();
+    static void emergencyFlush();
+
+    LogPoolStats getRecordPoolStats();
     void clearLog();
     void clearLogKeepLatestXPercent(int percent = 10);
 
-    void dump(Stream& stream);
+    void dump(Print& stream, uint32_t fromTime = 0, uint32_t toTime = 0, LogDumpFormat format = LogDumpFormat::TEXT);
 
     static const char* logLevelToString(LogLevel level, bool trim = true) {
         switch (level) {
@@ -117,39 +481,296 @@ public:
         }
     }
 
-    void setCallback(LogCallback callback) {
-        _callback = callback;
-    }
+    void setCallback(LogCallback callback);
+    void setCallbackDeadline(uint32_t callbackDeadline);
+    uint32_t getCallbackDeadline();
+    LogCallbackStats getCallbackStats();
+
+    bool startLive(size_t bufferSize = DEFAULT_LIVE_BUFFER_SIZE);
+    LogLiveCursor subscribeLive(bool fromOldest = false);
+    size_t readLive(LogLiveCursor &cursor, char *buffer, size_t size);
+
+    bool startBacktrace(LogLevel minLevel = LogLevel::DEBUG, LogLevel triggerLevel = LogLevel::ERROR, size_t maxRecords = DEFAULT_BACKTRACE_RECORDS, bool allTasks = false, size_t bufferSize = DEFAULT_BACKTRACE_BUFFER_SIZE);
+    void saveBacktrace();
+
+    int addWatch(const char *pattern, LogWatchCallback callback, LogLevel minLevel = LogLevel::VERBOSE);
+    void removeWatch(int watchId);
+
+    uint32_t getLogCount(LogLevel logLevel, LogStatsWindow window = LogStatsWindow::SINCE_BOOT);
+    size_t getTopFunctions(LogFunctionStats *top, size_t maxCount, LogStatsWindow window = LogStatsWindow::SINCE_BOOT, LogLevel minLevel = LogLevel::VERBOSE);
+    void resetStats();
 
 private:
+    friend class LogRecordBuilder;
+    friend class LogScopedTimer;
+    friend class LogSpan;
+
     String _logFilePath = DEFAULT_LOG_PATH;
     String _configFilePath = DEFAULT_CONFIG_PATH;
 
     LogLevel _printLevel = DEFAULT_PRINT_LEVEL;
     LogLevel _saveLevel = DEFAULT_SAVE_LEVEL;
+    std::atomic<int> _minLevel{(int)std::min(DEFAULT_PRINT_LEVEL, DEFAULT_SAVE_LEVEL)}; // Lowest of the print, save and backtrace levels, read by the inlined logging methods
+    LogLevel _criticalLevel = DEFAULT_CRITICAL_LEVEL;
+    LogLevel _syncLevel = DEFAULT_SYNC_LEVEL;
+    LogLevel _deadlineLevel = DEFAULT_DEADLINE_LEVEL;
 
     int _maxLogLines = DEFAULT_MAX_LOG_LINES;
-    int _logLines = 0;
-
-    void _log(const char *format, const char *function, LogLevel logLevel);
+    uint32_t _maxLogAge = DEFAULT_MAX_LOG_AGE;
+
+    LogTierStorage _tiers[LOG_TIER_COUNT];
+
+    uint32_t _flushDeadline = DEFAULT_FLUSH_DEADLINE;
+    uint32_t _flushInterval = DEFAULT_FLUSH_INTERVAL;
+    bool _flushPending = false;
+    unsigned long _flushDue = 0; // millis() by which the buffered frames must be written
+    SemaphoreHandle_t _mutex = nullptr;
+    TaskHandle_t _flushTaskHandle = nullptr;
+    static AdvancedLogger *_panicLogger;
+    static bool _panicHandlersRegistered;
+
+    LogRecordPool _recordPool;
+    LogStats _stats;
+    LogLiveRing _liveRing;
+
+    LogBacktraceRing _backtrace;
+    int _backtraceLevel = (int)LogLevel::FATAL + 1; // Lowest level kept in RAM, above all the levels while the backtrace is off
+    LogLevel _backtraceTrigger = LogLevel::ERROR;
+    size_t _backtraceRecords = DEFAULT_BACKTRACE_RECORDS;
+    bool _backtraceAllTasks = false; // Whether a trigger saves the records of all the tasks, or only of its own
+
+    LogWatchMatcher _watchMatcher;
+    std::vector<LogWatch> _watches; // By watch id
+    int _watchMinLevel = (int)LogLevel::FATAL + 1; // Lowest level of the watches, above all the levels if there is none
+    static thread_local bool _inWatch; // Whether the current task is running a watch callback
+
+    static thread_local LogContext *_context; // Last entry pushed by the current task
+
+    static thread_local uint32_t _spanId; // Id of the innermost span of the current task, 0 if none
+    static std::atomic<uint32_t> _spanCount; // Ids given to the spans during this boot
+
+    static thread_local uint8_t _taskId; // Id of the current task, resolved on its first record
+    static char _taskNames[LOG_TASK_COUNT][LOG_TASK_NAME_SIZE]; // By task id, shared by all the loggers
+    static std::atomic<uint32_t> _taskNamesReady; // Bit of each task id whose name was written
+    static std::atomic<int> _taskCount;
+    uint32_t _persistedTasks = 0; // Bit of each task id whose name was saved during this boot
+
+    QueueHandle_t _callbackQueue = nullptr; // Pointers to LogCallbackRecord held by _recordPool
+    TaskHandle_t _callbackTaskHandle = nullptr;
+    uint32_t _callbackDeadline = DEFAULT_CALLBACK_DEADLINE;
+    volatile bool _callbackRunning = false;
+    volatile bool _callbackOverrun = false; // Whether the running invocation was already counted as an overrun
+    volatile unsigned long _callbackStart = 0; // millis() at which the running invocation started
+    LogCallbackStats _callbackStats;
+
+    uint32_t _bootId = 0;
+    LogBootTime _bootTimes[LOG_BOOT_TIME_COUNT]; // From the oldest boot to the current one
+    int _bootTimeCount = 0;
+    bool _clockSet = false;
+    uint64_t _wallBaseUs = 0; // Unix time read at _wallBaseMonotonicUs
+    uint64_t _wallBaseMonotonicUs = 0;
+    time_t _timestampSecond = -1;
+    char _timestampCache[TIMESTAMP_BUFFER_SIZE] = "";
+
+    [[gnu::always_inline]] inline bool _isEnabled(LogLevel logLevel) const
+    {
+        return (int)logLevel >= _minLevel.load(std::memory_order_relaxed);
+    }
+    inline bool _isKept(LogLevel logLevel) const
+    {
+        return logLevel >= _saveLevel || (int)logLevel >= _backtraceLevel;
+    }
+    [[gnu::cold, gnu::noinline]] void _logFormatted(LogLevel logLevel, const char *format, const char *function, ...);
+    [[gnu::cold, gnu::noinline]] void _logBytes(LogLevel logLevel, const char *function, const uint8_t *data, size_t length);
+    [[gnu::cold, gnu::noinline]] void _logDuration(LogLevel logLevel, const char *function, const char *label, uint64_t durationUs, int line);
+    [[gnu::cold, gnu::noinline]] void _logSpan(LogLevel logLevel, const char *name, const LogFrameSpan &span, uint64_t monotonicUs);
+    void _log(const char *message, const char *function, LogLevel logLevel, const uint8_t *fields = nullptr, size_t fieldsLength = 0);
+    void _checkWatches(const char *message, const char *function, LogLevel logLevel);
+    size_t _captureContext(uint8_t *buffer, const uint8_t *fields, size_t fieldsLength);
+    time_t _stampRecord(uint64_t monotonicUs, uint64_t &wallUs, char *timestamp, LogLevel logLevel, const char *function);
+    static uint8_t _currentTaskId();
+    void _printBytes(Print &stream, const uint8_t *header, size_t headerLength, const uint8_t *data, size_t length, const char *task);
+    void _formatHex(char *buffer, size_t size, const uint8_t *data, size_t length);
+    size_t _formatFields(char *buffer, size_t size, const uint8_t *fields, size_t length, LogDumpFormat format);
+    void _printRecord(Print &stream, const uint8_t *frame, size_t frameSize, const char *timestamp, const char *task, LogDumpFormat format);
+    void _printJsonString(Print &stream, const char *string, size_t length);
     void _logPrint(const char *format, const char *function, LogLevel logLevel, ...);
-    void _save(const char *messageFormatted);
+    void _save(LogFrameType type, const uint8_t *body, size_t bodyLength, const uint8_t *data, size_t dataLength, LogLevel logLevel, uint64_t monotonicUs, uint64_t wallUs, uint8_t taskId);
+    void _encodeFrame(uint8_t *frame, LogFrameType type, const uint8_t *body, size_t bodyLength, const uint8_t *data, size_t dataLength, uint32_t now, uint64_t monotonicUs, uint8_t taskId);
+    uint8_t *_reserveFrame(int tier, size_t frameSize, uint32_t recordTime);
+    void _commitFrame(int tier);
+    void _saveBacktrace(int taskId);
+    void _updateMinLevel();
+    void _recoverPanicBuffer();
+    void _lock();
+    void _unlock();
+    void _scheduleFlush(uint32_t delay);
+    void _flushAll();
+    void _flushTier(int tier);
+    static void _flushTask(void *parameter);
+    void _queueCallback(time_t second, const char *timestamp, LogLevel logLevel, const char *function, const char *message);
+    void _checkCallbackDeadline();
+    static void _callbackTask(void *parameter);
+    bool _advanceCursor(LogTierCursor &cursor, uint32_t fromTime, uint32_t toTime);
+    uint64_t _recordTime(const uint8_t *frame);
+    uint64_t _wallClockUs(uint64_t monotonicUs);
+    void _loadBootTimes();
+    void _saveBootTimes();
+    size_t _loadTaskNames(std::vector<LogTaskName> &names);
+    void _pruneTaskNames();
+    void _saveTaskName(uint8_t taskId);
+    void _loadSegments();
+    void _importLegacyLog();
+    String _segmentPath(int tier, int slot);
+    int _oldestSegment(int tier);
+    int _segmentsInOrder(int tier, int *order);
+    bool _openNewSegment(int tier);
+    void _closeSegment(int tier, int slot);
+    void _removeSegment(int tier, int slot);
+    void _enforceRetention(int tier, uint32_t now = 0);
+    bool _trimSegment(int tier, int slot, size_t linesToKeep);
+    void _recoverTail(const String &path);
+    bool _commitTempFile(const String &path);
+    bool _loadConfig();
     bool _setConfigFromSpiffs();
     void _saveConfigToSpiffs();
+    bool _isLoadingConfig = false;
 
     LogLevel _charToLogLevel(const char *logLevelStr);
 
     const char *_timestampFormat = DEFAULT_TIMESTAMP_FORMAT;
     String _getTimestamp();
+    void _formatTimestamp(time_t seconds, char *buffer, size_t size);
     
     bool _invalidPath = false;
     bool _invalidTimestampFormat = false;
     bool _isValidPath(const char *path);
     bool _isValidTimestampFormat(const char *format);
 
-    String _formatMillis(unsigned long millis);
+    String _formatMillis(uint64_t millis);
 
-    LogCallback _callback = nullptr;
+    LogCallback _callback = nullptr; // Guarded by the lock
+    std::atomic<bool> _hasCallback{false}; // Read without the lock by the logging methods
+    uint32_t _callbackVersion = 0; // Incremented by setCallback(), so that the callback task knows when to copy _callback again
 };
 
+/**
+ * @brief Logs the record with its fields.
+ */
+inline LogRecordBuilder::~LogRecordBuilder()
+{
+    if (_logger == nullptr) return;
+
+    logFramePutU16(_fields, (uint16_t)(_fieldsLength - LOG_FIELDS_HEADER_SIZE));
+    _logger->_log(_message, _function, _logLevel, _fields, _fieldsLength);
+}
+
+/**
+ * @brief Pushes a context entry for the lifetime of the scope.
+ *
+ * Usage: LogContextScope scope("request", requestId);
+ */
+class LogContextScope : public LogContext
+{
+public:
+    template <typename Value>
+    LogContextScope(const char *key, const Value &value) : LogContext(key, value) { AdvancedLogger::pushContext(*this); }
+    ~LogContextScope() { AdvancedLogger::popContext(); }
+};
+
+/**
+ * @brief Logs how long a scope took, if it took at least a threshold.
+ *
+ * Usage: LOG_SCOPED_TIMER(logger, LogLevel::DEBUG, "publish", 5000);
+ * logs "[mqttLoop] publish us=7312 line=42" when the rest of the scope takes
+ * 5 ms or more. The time is read with esp_timer_get_time(), as the cycle
+ * counter of the ESP32 is per core and wraps every few seconds. Nothing is
+ * allocated: a scope whose level is filtered out costs a single comparison,
+ * and a scope below the threshold reading the timer twice, without formatting.
+ */
+class LogScopedTimer
+{
+public:
+    [[gnu::always_inline]] inline LogScopedTimer(AdvancedLogger &logger, LogLevel logLevel, const char *function, const char *label, uint32_t thresholdUs = 0, int line = 0)
+        : _logger(logger._isEnabled(logLevel) ? &logger : nullptr), _logLevel(logLevel), _function(function), _label(label), _thresholdUs(thresholdUs), _line(line),
+          _startUs(_logger != nullptr ? esp_timer_get_time() : 0) {}
+    LogScopedTimer(const LogScopedTimer &) = delete;
+    LogScopedTimer &operator=(const LogScopedTimer &) = delete;
+
+    [[gnu::always_inline]] inline ~LogScopedTimer()
+    {
+        if (_logger == nullptr) return;
+
+        uint64_t durationUs = (uint64_t)(esp_timer_get_time() - _startUs);
+        if (durationUs >= _thresholdUs) _logger->_logDuration(_logLevel, _function, _label, durationUs, _line);
+    }
+
+private:
+    AdvancedLogger *_logger; // nullptr if the level is filtered out
+    LogLevel _logLevel;
+    const char *_function;
+    const char *_label;
+    uint32_t _thresholdUs;
+    int _line;
+    int64_t _startUs;
+};
+
+#define LOG_SCOPED_TIMER_CONCAT(a, b) a##b
+#define LOG_SCOPED_TIMER_NAME(line) LOG_SCOPED_TIMER_CONCAT(_logScopedTimer, line)
+// Times the rest of the enclosing scope, logged with the name of the enclosing function and the line of the timer
+#define LOG_SCOPED_TIMER(logger, logLevel, label, thresholdUs) \
+    LogScopedTimer LOG_SCOPED_TIMER_NAME(__LINE__)((logger), (logLevel), __func__, (label), (thresholdUs), __LINE__)
+
+/**
+ * @brief Traces a span of time, from its construction to the end of its scope.
+ *
+ * Usage: LOG_SPAN(logger, LogLevel::DEBUG, "mqtt::publish");
+ * A SPAN record is logged when the span begins, and another one with its
+ * duration when it ends, through the same path as the other records, so
+ * they are printed, saved and dumped as "span begin id=12 parent=3" and
+ * "span end id=12 parent=3 us=7312". Spans are nested per task: the parent
+ * is the innermost span of the same task. extras/logToTrace.cpp converts
+ * the log into a trace for the Chrome or Perfetto trace viewers. A span
+ * whose level is filtered out costs a single comparison.
+ */
+class LogSpan
+{
+public:
+    [[gnu::always_inline]] inline LogSpan(AdvancedLogger &logger, LogLevel logLevel, const char *name)
+        : _logger(logger._isEnabled(logLevel) ? &logger : nullptr), _logLevel(logLevel), _name(name)
+    {
+        if (_logger == nullptr) return;
+
+        _span.phase = LogSpanPhase::BEGIN;
+        _span.id = AdvancedLogger::_spanCount.fetch_add(1, std::memory_order_relaxed) + 1;
+        _span.parent = AdvancedLogger::_spanId;
+        _span.durationUs = 0;
+        AdvancedLogger::_spanId = _span.id;
+        _startUs = esp_timer_get_time();
+        _logger->_logSpan(_logLevel, _name, _span, _startUs);
+    }
+    LogSpan(const LogSpan &) = delete;
+    LogSpan &operator=(const LogSpan &) = delete;
+
+    [[gnu::always_inline]] inline ~LogSpan()
+    {
+        if (_logger == nullptr) return;
+
+        uint64_t endUs = esp_timer_get_time();
+        _span.phase = LogSpanPhase::END;
+        _span.durationUs = endUs - _startUs;
+        AdvancedLogger::_spanId = _span.parent;
+        _logger->_logSpan(_logLevel, _name, _span, endUs);
+    }
+
+private:
+    AdvancedLogger *_logger; // nullptr if the level is filtered out
+    LogLevel _logLevel;
+    const char *_name;
+    LogFrameSpan _span;
+    uint64_t _startUs = 0;
+};
+
+#define LOG_SPAN(logger, logLevel, name) LogSpan LOG_SCOPED_TIMER_NAME(__LINE__)((logger), (logLevel), (name))
+
 #endif
\ No newline at end of file
@@ -0,0 +1,241 @@
+/*
+ * File: LogBacktrace.h
+ * --------------------
+ * This file defines the in-memory ring in which AdvancedLogger keeps the verbose records it
+ * does not save, so that the ones which led to an error can still be saved along with it.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C and C++ standard libraries, so that it can also be
+ * built and tested on the host.
+ *
+ * Each record is kept as the frame it would have been saved as (see LogFrame.h), behind a
+ * small header holding its length, its level and the id of its task. The frames are stored
+ * contiguously, the ring wrapping to its start rather than splitting a frame, so that a frame
+ * is encoded in place when it is logged and copied with a single memcpy when it is saved.
+ * A new record simply overwrites the oldest ones.
+ *
+ * When a record triggers the backtrace, take() hands over the last records of its task (or of
+ * all the tasks), oldest first, and marks them as taken, so that they are never saved twice.
+ * The older records of the same task are dropped as well, as saving them later would put them
+ * after the newer ones. takeInOrder() also drops the records older than the newest one already
+ * saved to their tier, so that each tier of the log stays in chronological order.
+ *
+ * The ring is not thread-safe: AdvancedLogger only uses it with its lock held.
+ */
+
+#ifndef LOGBACKTRACE_H
+#define LOGBACKTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "LogFrame.h"
+
+constexpr size_t LOG_BACKTRACE_HEADER_SIZE = 4; // Frame size (uint16), level and task id of a record
+constexpr uint8_t LOG_BACKTRACE_TAKEN = 0xFF; // Level of a record already taken
+constexpr int LOG_BACKTRACE_ALL_TASKS = -1;
+
+class LogBacktraceRing
+{
+public:
+    LogBacktraceRing() {}
+    ~LogBacktraceRing() { free(_data); }
+
+    LogBacktraceRing(const LogBacktraceRing &) = delete;
+    LogBacktraceRing &operator=(const LogBacktraceRing &) = delete;
+
+    /**
+     * @brief Allocates the ring.
+     *
+     * This is the only allocation done by the ring. Calling it again after
+     * a successful call does nothing.
+     *
+     * @param capacity Size of the ring in bytes.
+     * @return bool True if the ring is allocated.
+     */
+    bool begin(size_t capacity)
+    {
+        if (_data != nullptr) return true;
+        if (capacity < LOG_BACKTRACE_HEADER_SIZE * 4) return false;
+
+        _data = (uint8_t *)malloc(capacity);
+        if (_data == nullptr) return false;
+        _capacity = capacity;
+        return true;
+    }
+
+    bool active() const { return _data != nullptr; }
+
+    size_t count() const { return _count; }
+
+    /**
+     * @brief Drops all the records.
+     */
+    void clear()
+    {
+        _head = 0;
+        _tail = 0;
+        _count = 0;
+        _wrapped = false;
+    }
+
+    /**
+     * @brief Reserves room for a frame, overwriting the oldest records if needed.
+     *
+     * A frame larger than a quarter of the ring is not kept, so that a single
+     * record never wipes out the whole backtrace.
+     *
+     * @param frameSize Size of the frame.
+     * @param level Level of the record.
+     * @param taskId Id of the task of the record.
+     * @return uint8_t* Where the frame must be written, or nullptr if it is not kept.
+     */
+    uint8_t *reserve(size_t frameSize, uint8_t level, uint8_t taskId)
+    {
+        size_t size = LOG_BACKTRACE_HEADER_SIZE + frameSize;
+        if (_data == nullptr || size > _capacity / 4) return nullptr;
+
+        while (true)
+        {
+            if (_count == 0) clear();
+            if (!_wrapped)
+            {
+                if (_capacity - _head >= size) break;
+                // The end of the ring is left unused, and the records continue from its start
+                _end = _head;
+                _head = 0;
+                _wrapped = true;
+                continue;
+            }
+            if (_tail - _head >= size) break;
+            _dropOldest();
+        }
+
+        uint8_t *entry = _data + _head;
+        entry[0] = (uint8_t)frameSize;
+        entry[1] = (uint8_t)(frameSize >> 8);
+        entry[2] = level;
+        entry[3] = taskId;
+        _head += size;
+        _count++;
+        return entry + LOG_BACKTRACE_HEADER_SIZE;
+    }
+
+    /**
+     * @brief Takes the last records of a task, or of all the tasks.
+     *
+     * The visitor is called for each record taken, oldest first, as
+     * visit(level, taskId, frame, frameSize). The records of the task
+     * older than the ones taken are dropped.
+     *
+     * @param taskId Id of the task, or LOG_BACKTRACE_ALL_TASKS.
+     * @param maxRecords Maximum number of records to take.
+     * @param visit Visitor of the records taken.
+     * @return size_t Number of records taken.
+     */
+    template <typename Visitor>
+    size_t take(int taskId, size_t maxRecords, Visitor visit)
+    {
+        size_t matching = 0;
+        size_t position = _tail;
+        for (size_t i = 0; i < _count; i++, position = _next(position))
+        {
+            if (_matches(position, taskId)) matching++;
+        }
+
+        size_t skipped = matching > maxRecords ? matching - maxRecords : 0;
+        position = _tail;
+        for (size_t i = 0; i < _count; i++, position = _next(position))
+        {
+            if (!_matches(position, taskId)) continue;
+            uint8_t *entry = _data + position;
+            if (skipped > 0) skipped--;
+            else visit(entry[2], entry[3], entry + LOG_BACKTRACE_HEADER_SIZE, _frameSize(position));
+            entry[2] = LOG_BACKTRACE_TAKEN;
+        }
+
+        // The records taken at the tail give their room back right away
+        while (_count > 0 && _data[_tail + 2] == LOG_BACKTRACE_TAKEN) _dropOldest();
+        return matching < maxRecords ? matching : maxRecords;
+    }
+
+    /**
+     * @brief Takes the last records of a task, or of all the tasks, keeping each tier in order.
+     *
+     * As take(), but the records are handed over to be saved to their tier
+     * as save(tier, taskId, frame, frameSize), which returns whether the
+     * record was saved. A record older than the newest one saved to its
+     * tier is dropped instead, and the newest time of a tier, given by
+     * tierTime(tier), is advanced by each record saved. The time of a
+     * record is the monotonic time of its frame (see LogFrame.h).
+     *
+     * @param taskId Id of the task, or LOG_BACKTRACE_ALL_TASKS.
+     * @param maxRecords Maximum number of records to take.
+     * @param tierOf Gives the tier of a record from its level.
+     * @param tierTime Gives a reference to the monotonic time of the newest record saved to a tier.
+     * @param save Saves a record to its tier.
+     * @return size_t Number of records saved.
+     */
+    template <typename TierOf, typename TierTime, typename Saver>
+    size_t takeInOrder(int taskId, size_t maxRecords, TierOf tierOf, TierTime tierTime, Saver save)
+    {
+        size_t saved = 0;
+        take(taskId, maxRecords, [&](uint8_t level, uint8_t recordTaskId, const uint8_t *frame, size_t frameSize) {
+            int tier = tierOf(level);
+            uint64_t monotonicUs = logFrameGetU64(frame + LOG_FRAME_HEADER_SIZE + 8);
+            uint64_t &newestUs = tierTime(tier);
+            if (monotonicUs < newestUs || !save(tier, recordTaskId, frame, frameSize)) return;
+            newestUs = monotonicUs;
+            saved++;
+        });
+        return saved;
+    }
+
+private:
+    uint8_t *_data = nullptr;
+    size_t _capacity = 0;
+    size_t _head = 0; // End of the newest record
+    size_t _tail = 0; // Start of the oldest record
+    size_t _end = 0; // End of the records before the ring wrapped
+    size_t _count = 0;
+    bool _wrapped = false; // Whether the records run from _tail to _end, then from the start to _head
+
+    size_t _frameSize(size_t position) const
+    {
+        return _data[position] | (_data[position + 1] << 8);
+    }
+
+    size_t _next(size_t position) const
+    {
+        position += LOG_BACKTRACE_HEADER_SIZE + _frameSize(position);
+        return _wrapped && position == _end ? 0 : position;
+    }
+
+    bool _matches(size_t position, int taskId) const
+    {
+        const uint8_t *entry = _data + position;
+        return entry[2] != LOG_BACKTRACE_TAKEN && (taskId == LOG_BACKTRACE_ALL_TASKS || entry[3] == taskId);
+    }
+
+    void _dropOldest()
+    {
+        size_t next = _tail + LOG_BACKTRACE_HEADER_SIZE + _frameSize(_tail);
+        _count--;
+        if (_wrapped && next == _end)
+        {
+            _tail = 0;
+            _wrapped = false;
+        }
+        else
+        {
+            _tail = next;
+        }
+    }
+};
+
+#endif
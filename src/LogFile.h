@@ -0,0 +1,417 @@
+/*
+ * File: LogFile.h
+ * ---------------
+ * This file defines the operations done by AdvancedLogger on the files of frames (see
+ * LogFrame.h) it keeps on the filesystem: reading their frames, walking them backwards,
+ * rewriting them through a temporary file, and recovering them after a reset.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C++ standard library. The functions are templates over the
+ * file and the filesystem, so that AdvancedLogger runs them on SPIFFS while the host tests
+ * (see extras/frameFaultTest.cpp) run the very same code on files in memory. As the Arduino
+ * File, a file must provide size(), position(), available(), seek(), read(), write(), close()
+ * and a conversion to bool, and as the Arduino FS, a filesystem must provide exists(), open(),
+ * remove() and rename(), the latter failing if the destination exists.
+ *
+ * A file is never rewritten in place: the new content is written to a temporary file next to
+ * it, which then replaces it. As SPIFFS cannot rename over an existing file, the original is
+ * removed first, so a reset between the two steps leaves only the temporary file, which is
+ * then complete. logFileRecoverRotation() relies on this to either keep the original or
+ * finish the replacement, and logFileRecoverTail() drops the record torn by a reset during
+ * an append.
+ *
+ * A segment that is no longer written to ends with a SUMMARY frame, read back by
+ * logFileReadSegmentSummary(), so that its records are only counted by logFileScanRecords()
+ * once.
+ */
+
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "LogFrame.h"
+
+constexpr const char* LOG_TEMP_FILE_SUFFIX = ".tmp";
+constexpr size_t LOG_RECOVERY_WINDOW_SIZE = 2 * LOG_FRAME_MAX_SIZE; // Always holds the torn frame and the valid one before it
+constexpr size_t LOG_COPY_CHUNK_SIZE = 512;
+constexpr int LOG_READ_MAX_RESYNCS = 10000; // Invalid spots skipped by a single logFileReadFrame()
+
+enum class LogTailRecovery {
+    INTACT,         // The file ends with a valid record
+    RECOVERED,      // The torn records were dropped
+    OPEN_FAILED,    // The file could not be opened
+    CREATE_FAILED,  // The temporary file could not be created
+    COPY_FAILED,    // The valid records could not be copied, the file is left untouched
+    RENAME_FAILED   // The temporary file could not replace the file, it is recovered at the next begin()
+};
+
+struct LogSegmentSummary {
+    uint32_t lines = 0;
+    uint32_t minTime = 0; // Unix time of the oldest record with a valid time, 0 if none
+    uint32_t maxTime = 0; // Unix time of the newest record with a valid time, 0 if none
+    bool undated = false; // Whether it holds records logged before the clock was set
+};
+
+/**
+ * @brief Reads the next valid frame from a file.
+ *
+ * Invalid bytes (such as a torn record) are skipped by resynchronizing
+ * on the next sync byte.
+ *
+ * @param file File opened for reading.
+ * @param frame Buffer of at least LOG_FRAME_MAX_SIZE bytes.
+ * @return size_t Size of the frame read, or 0 if no more frames are available.
+ */
+template <typename LogFile>
+size_t logFileReadFrame(LogFile &file, uint8_t *frame)
+{
+    int loopCount = 0;
+    while (file.available() && loopCount < LOG_READ_MAX_RESYNCS)
+    {
+        loopCount++;
+        size_t position = file.position();
+
+        if (file.read(frame, LOG_FRAME_HEADER_SIZE) < LOG_FRAME_HEADER_SIZE) return 0;
+        if (logFrameHeaderPlausible(frame))
+        {
+            size_t remaining = logFrameGetU16(frame + 2) + LOG_FRAME_TRAILER_SIZE;
+            if (file.read(frame + LOG_FRAME_HEADER_SIZE, remaining) == remaining)
+            {
+                size_t frameSize = logFrameValidate(frame, LOG_FRAME_HEADER_SIZE + remaining);
+                if (frameSize > 0) return frameSize;
+            }
+        }
+
+        file.seek(position + 1);
+        size_t scanned = file.read(frame, LOG_FRAME_HEADER_SIZE * 8);
+        const uint8_t *sync = (const uint8_t *)memchr(frame, LOG_FRAME_SYNC, scanned);
+        file.seek(position + 1 + (sync ? sync - frame : scanned));
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the end of the last valid record in a file.
+ *
+ * Only the last LOG_RECOVERY_WINDOW_SIZE bytes are read. In the common case
+ * the trailer of the last record points to a valid frame and the whole
+ * file is valid. Otherwise the window is scanned for chains of valid
+ * frames, and the end of the furthest one is returned.
+ *
+ * @param file File opened for reading.
+ * @return size_t Offset right after the last valid record.
+ */
+template <typename LogFile>
+size_t logFileFindValidEnd(LogFile &file)
+{
+    size_t size = file.size();
+    if (size < LOG_FRAME_OVERHEAD) return 0;
+
+    size_t windowStart = size > LOG_RECOVERY_WINDOW_SIZE ? size - LOG_RECOVERY_WINDOW_SIZE : 0;
+    size_t windowLength = size - windowStart;
+    std::vector<uint8_t> window(windowLength);
+
+    file.seek(windowStart);
+    if (file.read(window.data(), windowLength) != windowLength) return size;
+
+    // The frame the trailer points to must also end with the file, or a torn tail could point to any earlier frame
+    size_t lastLength = logFrameGetU16(&window[windowLength - LOG_FRAME_TRAILER_SIZE]);
+    if (lastLength + LOG_FRAME_OVERHEAD <= windowLength &&
+        logFrameValidate(&window[windowLength - lastLength - LOG_FRAME_OVERHEAD], lastLength + LOG_FRAME_OVERHEAD) == lastLength + LOG_FRAME_OVERHEAD)
+    {
+        return size;
+    }
+
+    bool found = false;
+    size_t validEnd = 0;
+    size_t position = 0;
+    while (position < windowLength)
+    {
+        size_t frameSize = logFrameValidate(&window[position], windowLength - position);
+        if (frameSize == 0)
+        {
+            position++;
+            continue;
+        }
+        found = true;
+        position += frameSize;
+        validEnd = position;
+    }
+
+    // If nothing in the window can be recognized the file is left untouched, as the readers skip invalid bytes anyway
+    return found ? windowStart + validEnd : size;
+}
+
+/**
+ * @brief Finds the byte offset from which the latest records start.
+ *
+ * Walks the frames backwards from the end of the file using their trailing
+ * length, reading only the header and trailer of each record. The walk stops
+ * early at the start of the file or at any inconsistent frame, in which case
+ * the older (unreadable) part of the file is dropped.
+ *
+ * @param file File opened for reading.
+ * @param end Offset right after the last record (e.g. before the summary of a segment).
+ * @param linesToKeep Number of records to keep.
+ * @param minOffset Offset before which the walk never goes (e.g. to preserve the segment header).
+ * @param linesKept Set to the number of records actually found after the cut.
+ * @return size_t Offset of the first record to keep.
+ */
+template <typename LogFile>
+size_t logFileFindCutOffset(LogFile &file, size_t end, size_t linesToKeep, size_t minOffset, size_t &linesKept)
+{
+    uint8_t header[LOG_FRAME_HEADER_SIZE];
+    uint8_t trailer[LOG_FRAME_TRAILER_SIZE];
+    size_t offset = end;
+
+    linesKept = 0;
+    while (linesKept < linesToKeep && offset >= minOffset + LOG_FRAME_OVERHEAD)
+    {
+        if (!file.seek(offset - LOG_FRAME_TRAILER_SIZE) || file.read(trailer, sizeof(trailer)) != sizeof(trailer)) break;
+
+        size_t length = logFrameGetU16(trailer);
+        if (length + LOG_FRAME_OVERHEAD > offset - minOffset) break;
+
+        size_t start = offset - length - LOG_FRAME_OVERHEAD;
+        if (!file.seek(start) || file.read(header, sizeof(header)) != sizeof(header)) break;
+        if (!logFrameHeaderPlausible(header) || logFrameGetU16(header + 2) != length) break;
+
+        offset = start;
+        linesKept++;
+    }
+    return offset;
+}
+
+/**
+ * @brief Copies a range of bytes between two files.
+ *
+ * The copy is done in chunks of LOG_COPY_CHUNK_SIZE bytes, without any heap allocation.
+ *
+ * @param source File to copy from.
+ * @param destination File to copy to, at its current position.
+ * @param from Offset of the first byte to copy.
+ * @param to Offset right after the last byte to copy.
+ * @return bool Whether the whole range was copied.
+ */
+template <typename SourceFile, typename DestinationFile>
+bool logFileCopyRange(SourceFile &source, DestinationFile &destination, size_t from, size_t to)
+{
+    uint8_t buffer[LOG_COPY_CHUNK_SIZE];
+    if (!source.seek(from)) return false;
+
+    size_t remaining = to - from;
+    while (remaining > 0)
+    {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        size_t bytesRead = source.read(buffer, chunk);
+        if (bytesRead == 0 || destination.write(buffer, bytesRead) != bytesRead) return false;
+        remaining -= bytesRead;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the header frame of a segment.
+ *
+ * @param file File to write to, at its current position.
+ * @param sequence Sequence number of the segment.
+ * @return bool Whether the header was written.
+ */
+template <typename LogFile>
+bool logFileWriteSegmentHeader(LogFile &file, uint32_t sequence)
+{
+    uint8_t payload[LOG_SEGMENT_PAYLOAD_SIZE];
+    uint8_t frame[LOG_SEGMENT_FRAME_SIZE];
+    logFramePutU32(payload, sequence);
+    size_t frameSize = logFrameEncode(frame, LogFrameType::SEGMENT, payload, sizeof(payload));
+    return file.write(frame, frameSize) == frameSize;
+}
+
+/**
+ * @brief Counts the records of a range of a file and computes their time span.
+ *
+ * Only the header and the unix time of each frame are read, skipping from
+ * one frame to the next using their length. The walk stops at the first
+ * implausible header, so the tail of the file must have been recovered.
+ *
+ * @param file File opened for reading.
+ * @param from Offset of the first frame.
+ * @param to Offset right after the last frame.
+ * @param summary Set to the number of records and their time span.
+ */
+template <typename LogFile>
+void logFileScanRecords(LogFile &file, size_t from, size_t to, LogSegmentSummary &summary)
+{
+    uint8_t buffer[LOG_FRAME_HEADER_SIZE + 4];
+    size_t offset = from;
+
+    summary = LogSegmentSummary();
+    while (offset + LOG_FRAME_OVERHEAD <= to &&
+           file.seek(offset) &&
+           file.read(buffer, sizeof(buffer)) == sizeof(buffer) &&
+           logFrameHeaderPlausible(buffer))
+    {
+        offset += logFrameGetU16(buffer + 2) + LOG_FRAME_OVERHEAD;
+        if (!logFrameIsRecord(buffer[1])) continue;
+
+        summary.lines++;
+        uint32_t recordTime = logFrameGetU32(buffer + LOG_FRAME_HEADER_SIZE);
+        if (recordTime < LOG_MIN_VALID_TIME)
+        {
+            summary.undated = true;
+            continue;
+        }
+        if (summary.minTime == 0 || recordTime < summary.minTime) summary.minTime = recordTime;
+        if (recordTime > summary.maxTime) summary.maxTime = recordTime;
+    }
+}
+
+/**
+ * @brief Writes the summary frame closing a segment.
+ *
+ * @param file File to write to, at its current position.
+ * @param summary Number of records and time span of the segment.
+ * @return bool Whether the summary was written.
+ */
+template <typename LogFile>
+bool logFileWriteSegmentSummary(LogFile &file, const LogSegmentSummary &summary)
+{
+    uint8_t payload[LOG_SUMMARY_PAYLOAD_SIZE];
+    uint8_t frame[LOG_SUMMARY_FRAME_SIZE];
+    logFramePutU32(payload, summary.lines);
+    logFramePutU32(payload + 4, summary.minTime);
+    logFramePutU32(payload + 8, summary.maxTime);
+    payload[12] = summary.undated ? 1 : 0;
+    size_t frameSize = logFrameEncode(frame, LogFrameType::SUMMARY, payload, sizeof(payload));
+    return file.write(frame, frameSize) == frameSize;
+}
+
+/**
+ * @brief Reads the summary frame closing a segment, if any.
+ *
+ * Only the last LOG_SUMMARY_FRAME_SIZE bytes of the file are read.
+ *
+ * @param file File opened for reading.
+ * @param summary Set to the number of records and time span of the segment, if closed.
+ * @return bool Whether the file ends with a valid summary.
+ */
+template <typename LogFile>
+bool logFileReadSegmentSummary(LogFile &file, LogSegmentSummary &summary)
+{
+    uint8_t frame[LOG_SUMMARY_FRAME_SIZE];
+    size_t size = file.size();
+    if (size < LOG_SEGMENT_FRAME_SIZE + LOG_SUMMARY_FRAME_SIZE) return false;
+    if (!file.seek(size - sizeof(frame)) || file.read(frame, sizeof(frame)) != sizeof(frame)) return false;
+    if (logFrameValidate(frame, sizeof(frame)) != sizeof(frame) || frame[1] != (uint8_t)LogFrameType::SUMMARY) return false;
+
+    const uint8_t *payload = frame + LOG_FRAME_HEADER_SIZE;
+    summary.lines = logFrameGetU32(payload);
+    summary.minTime = logFrameGetU32(payload + 4);
+    summary.maxTime = logFrameGetU32(payload + 8);
+    summary.undated = payload[12] != 0;
+    return true;
+}
+
+/**
+ * @brief Replaces a file with its temporary copy.
+ *
+ * The original is removed first, so a reset between the two steps leaves
+ * only the temporary file, which logFileRecoverRotation() renames.
+ *
+ * @param fileSystem Filesystem of the file.
+ * @param path Path of the file to replace. The temporary copy is at path + LOG_TEMP_FILE_SUFFIX.
+ * @return bool Whether the replacement succeeded.
+ */
+template <typename FileSystem, typename Path>
+bool logFileCommitTemp(FileSystem &fileSystem, const Path &path)
+{
+    fileSystem.remove(path);
+    return fileSystem.rename(path + LOG_TEMP_FILE_SUFFIX, path);
+}
+
+/**
+ * @brief Completes or rolls back a replacement interrupted by a reset.
+ *
+ * The temporary file replaces the original only after being fully
+ * written, so if the original is missing the temporary file is complete
+ * and is renamed, while if both exist the temporary file is discarded.
+ *
+ * @param fileSystem Filesystem of the file.
+ * @param path Path of the file that was being replaced.
+ */
+template <typename FileSystem, typename Path>
+void logFileRecoverRotation(FileSystem &fileSystem, const Path &path)
+{
+    Path tempPath = path + LOG_TEMP_FILE_SUFFIX;
+    if (!fileSystem.exists(tempPath)) return;
+
+    if (fileSystem.exists(path))
+    {
+        fileSystem.remove(tempPath);
+    }
+    else
+    {
+        fileSystem.rename(tempPath, path);
+    }
+}
+
+/**
+ * @brief Drops the torn records at the end of a file.
+ *
+ * Looks for the last valid record by reading only the tail of the file,
+ * and if any torn record follows it, replaces the file with a copy of the
+ * valid part.
+ *
+ * @param fileSystem Filesystem of the file.
+ * @param path Path of the file to recover.
+ * @param droppedBytes Set to the number of bytes dropped.
+ * @return LogTailRecovery Outcome of the recovery.
+ */
+template <typename FileSystem, typename Path>
+LogTailRecovery logFileRecoverTail(FileSystem &fileSystem, const Path &path, size_t &droppedBytes)
+{
+    droppedBytes = 0;
+    auto sourceFile = fileSystem.open(path, "r");
+    if (!sourceFile) return LogTailRecovery::OPEN_FAILED;
+
+    size_t size = sourceFile.size();
+    size_t validEnd = logFileFindValidEnd(sourceFile);
+    if (validEnd == size)
+    {
+        sourceFile.close();
+        return LogTailRecovery::INTACT;
+    }
+
+    Path tempPath = path + LOG_TEMP_FILE_SUFFIX;
+    auto tempFile = fileSystem.open(tempPath, "w");
+    if (!tempFile)
+    {
+        sourceFile.close();
+        return LogTailRecovery::CREATE_FAILED;
+    }
+
+    bool copied = logFileCopyRange(sourceFile, tempFile, 0, validEnd);
+    sourceFile.close();
+    tempFile.close();
+
+    if (!copied)
+    {
+        fileSystem.remove(tempPath);
+        return LogTailRecovery::COPY_FAILED;
+    }
+    if (!logFileCommitTemp(fileSystem, path)) return LogTailRecovery::RENAME_FAILED;
+
+    droppedBytes = size - validEnd;
+    return LogTailRecovery::RECOVERED;
+}
+
+#endif
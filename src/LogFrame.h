@@ -0,0 +1,468 @@
+/*
+ * File: LogFrame.h
+ * ----------------
+ * This file defines the on-storage frame used by AdvancedLogger to persist
+ * each log record, together with the CRC32 used to validate it.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C standard library, so that the same definitions
+ * can be used both on the device and by host-side tools reading downloaded logs.
+ *
+ * Frame layout (all multi-byte fields are little-endian):
+ *
+ *   [0]       sync byte (LOG_FRAME_SYNC)
+ *   [1]       frame type (LogFrameType)
+ *   [2..3]    payload length
+ *   [4..7]    CRC32 over the type, the length and the payload
+ *   [8..]     payload
+ *   [last 2]  payload length again, so that frames can be walked backwards from the end of a file
+ *
+ * The payload of a TEXT frame starts with LOG_TEXT_PREFIX_SIZE bytes of metadata:
+ *
+ *   [0..3]    unix time (uint32, seconds), only meaningful if at least LOG_MIN_VALID_TIME
+ *   [4..7]    boot id (uint32), incremented at every begin()
+ *   [8..15]   monotonic time since boot (uint64, microseconds), which never wraps
+ *   [16]      task id (uint8), whose name is recorded once per boot by a TASK frame, 0 if unknown
+ *   [17..19]  reserved, 0
+ *
+ * followed by the formatted line without its timestamp, uptime and task fields, which are rendered
+ * from the metadata when the log is read. A BYTES frame starts with the same metadata, followed by:
+ *
+ *   [20]      log level (uint8)
+ *   [21]      core id (uint8)
+ *   [22]      length of the function name (uint8), at most LOG_BYTES_MAX_FUNCTION_LENGTH
+ *   [23..]    function name, followed by the raw bytes, which are only rendered as hex when read
+ *
+ * A FIELDS frame starts with the same metadata, followed by:
+ *
+ *   [20..21]  length of the fields (uint16)
+ *   [22..]    fields, followed by the formatted line of a TEXT frame
+ *
+ * where each field is made of its type (LogFieldType, uint8), the length of its key (uint8), the key,
+ * and its value: 8 bytes for INT, UINT and FLOAT (IEEE 754 double), 1 byte for BOOL, and the length
+ * (uint8) followed by the characters for STRING.
+ *
+ * A SPAN frame marks the beginning or the end of a traced span of time. It starts with the same
+ * metadata and the same level, core and name (as the function) as a BYTES frame, followed by:
+ *
+ *   [0]       phase (LogSpanPhase, uint8)
+ *   [1..4]    id of the span (uint32), unique during a boot
+ *   [5..8]    id of the span of the same task it is nested in (uint32), 0 if none
+ *   [9..16]   duration of the span (uint64, microseconds), 0 at its beginning
+ *
+ * A TIME frame records when the clock of a boot was set, so that
+ * the records logged before that can be re-stamped when the log is read. A TASK frame records the
+ * name of a task id during a boot.
+ *
+ * A SUMMARY frame is appended to a segment when it is closed, so that the segment does not have to
+ * be walked when the logger starts:
+ *
+ *   [0..3]    number of records (uint32)
+ *   [4..7]    unix time of the oldest record with a valid time (uint32), 0 if none
+ *   [8..11]   unix time of the newest record with a valid time (uint32), 0 if none
+ *   [12]      whether the segment holds records logged before the clock was set (uint8)
+ *
+ * A CONFIG frame is the whole content of the binary configuration file, so that it is loaded with
+ * a single read and checked by the CRC of the frame:
+ *
+ *   [0]       version (uint8), LOG_CONFIG_VERSION
+ *   [1..5]    print, save, critical, sync and deadline levels (uint8 each)
+ *   [6..9]    maximum number of log lines (int32)
+ *   [10..13]  maximum size of the MAIN tier (uint32, bytes)
+ *   [14..17]  maximum size of the CRITICAL tier (uint32, bytes)
+ *   [18..21]  maximum age of the log (uint32, seconds)
+ *   [22..25]  flush deadline (uint32, ms)
+ *   [26..29]  flush interval (uint32, ms)
+ *   [30..33]  callback deadline (uint32, ms)
+ *
+ * Later versions only append settings, so that a payload longer than LOG_CONFIG_PAYLOAD_SIZE is
+ * still read, ignoring the settings it does not know.
+ *
+ * A frame is considered valid only if the sync byte, the CRC and the trailing length all match,
+ * so a record torn by a power loss is always detected and never returned to the reader.
+ */
+
+#ifndef LOGFRAME_H
+#define LOGFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum class LogFrameType : uint8_t {
+    TEXT = 0x01,   // Payload is a formatted log line, without the line terminator
+    SEGMENT = 0x02, // First frame of every segment file. Payload is the segment sequence number (uint32)
+    TIME = 0x03, // Payload is a boot id (uint32), and the monotonic time (uint64, us) at which the unix time (uint64, us) was read
+    BYTES = 0x04, // Payload is a block of raw bytes logged with its metadata
+    FIELDS = 0x05, // Payload is a formatted log line with typed key-value fields
+    TASK = 0x06, // Payload is a boot id (uint32), a task id (uint8) and the name of the task
+    CONFIG = 0x07, // Payload is the configuration of the logger, preceded by its version (uint8)
+    SPAN = 0x08, // Payload is the beginning or the end of a span, with its metadata
+    SUMMARY = 0x09 // Last frame of a closed segment. Payload is the number of records and the time span of the segment
+};
+
+enum class LogSpanPhase : uint8_t {
+    BEGIN = 0x00,
+    END = 0x01
+};
+
+struct LogFrameSpan {
+    LogSpanPhase phase;
+    uint32_t id;
+    uint32_t parent; // 0 if the span is not nested
+    uint64_t durationUs; // 0 at the beginning of the span
+};
+
+enum class LogFieldType : uint8_t {
+    INT = 0x01,
+    UINT = 0x02,
+    FLOAT = 0x03,
+    BOOL = 0x04,
+    STRING = 0x05
+};
+
+struct LogFrameField {
+    LogFieldType type;
+    const char *key;
+    size_t keyLength;
+    uint64_t bits; // Value of INT, UINT (as is), FLOAT (IEEE 754 bits) and BOOL fields
+    const char *string; // Value of STRING fields, not null-terminated
+    size_t stringLength;
+};
+
+constexpr uint8_t LOG_FRAME_SYNC = 0xA5;
+constexpr size_t LOG_FRAME_HEADER_SIZE = 8;
+constexpr size_t LOG_FRAME_TRAILER_SIZE = 2;
+constexpr size_t LOG_FRAME_OVERHEAD = LOG_FRAME_HEADER_SIZE + LOG_FRAME_TRAILER_SIZE;
+constexpr size_t LOG_FRAME_MAX_PAYLOAD = 2048;
+constexpr size_t LOG_FRAME_MAX_SIZE = LOG_FRAME_MAX_PAYLOAD + LOG_FRAME_OVERHEAD;
+constexpr size_t LOG_TEXT_PREFIX_SIZE = 20;
+constexpr uint32_t LOG_MIN_VALID_TIME = 1577836800; // 2020-01-01 00:00:00 UTC
+constexpr size_t LOG_SEGMENT_PAYLOAD_SIZE = 4;
+constexpr size_t LOG_SEGMENT_FRAME_SIZE = LOG_SEGMENT_PAYLOAD_SIZE + LOG_FRAME_OVERHEAD;
+constexpr size_t LOG_SUMMARY_PAYLOAD_SIZE = 13;
+constexpr size_t LOG_SUMMARY_FRAME_SIZE = LOG_SUMMARY_PAYLOAD_SIZE + LOG_FRAME_OVERHEAD;
+constexpr size_t LOG_BYTES_HEADER_SIZE = 3;
+constexpr size_t LOG_BYTES_MAX_FUNCTION_LENGTH = 63;
+constexpr size_t LOG_BYTES_MAX_DATA_SIZE = LOG_FRAME_MAX_PAYLOAD - LOG_TEXT_PREFIX_SIZE - LOG_BYTES_HEADER_SIZE - LOG_BYTES_MAX_FUNCTION_LENGTH;
+constexpr size_t LOG_FIELDS_HEADER_SIZE = 2;
+constexpr size_t LOG_FIELD_HEADER_SIZE = 2;
+constexpr size_t LOG_TASK_PAYLOAD_HEADER_SIZE = 5;
+constexpr size_t LOG_TIME_PAYLOAD_SIZE = 20;
+constexpr size_t LOG_TIME_FRAME_SIZE = LOG_TIME_PAYLOAD_SIZE + LOG_FRAME_OVERHEAD;
+constexpr size_t LOG_SPAN_DATA_SIZE = 17;
+constexpr size_t LOG_SPAN_MESSAGE_SIZE = 80; // Longest message of logFrameFormatSpan(), with its terminator
+constexpr uint8_t LOG_CONFIG_VERSION = 1;
+constexpr size_t LOG_CONFIG_PAYLOAD_SIZE = 34;
+constexpr size_t LOG_CONFIG_FRAME_SIZE = LOG_CONFIG_PAYLOAD_SIZE + LOG_FRAME_OVERHEAD;
+
+/**
+ * @brief Updates a CRC32 (IEEE 802.3, reflected) with the provided bytes.
+ *
+ * A 16-entry nibble table is used to keep the flash footprint small while
+ * still being several times faster than the bitwise implementation.
+ *
+ * @param crc CRC returned by a previous call, or 0 to start a new one.
+ * @param data Bytes to process.
+ * @param length Number of bytes to process.
+ * @return uint32_t Updated CRC.
+ */
+inline uint32_t logFrameCrc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+inline void logFramePutU16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value);
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+inline void logFramePutU32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value);
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
+
+inline void logFramePutU64(uint8_t *buffer, uint64_t value)
+{
+    logFramePutU32(buffer, (uint32_t)value);
+    logFramePutU32(buffer + 4, (uint32_t)(value >> 32));
+}
+
+inline uint16_t logFrameGetU16(const uint8_t *buffer)
+{
+    return (uint16_t)(buffer[0] | (buffer[1] << 8));
+}
+
+inline uint32_t logFrameGetU32(const uint8_t *buffer)
+{
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+inline uint64_t logFrameGetU64(const uint8_t *buffer)
+{
+    return (uint64_t)logFrameGetU32(buffer) | ((uint64_t)logFrameGetU32(buffer + 4) << 32);
+}
+
+/**
+ * @brief Checks whether a frame type holds a log record.
+ *
+ * Record frames all start with LOG_TEXT_PREFIX_SIZE bytes of metadata.
+ *
+ * @param type Frame type, as stored in the header.
+ * @return bool Whether the frame is a log record.
+ */
+inline bool logFrameIsRecord(uint8_t type)
+{
+    return type == (uint8_t)LogFrameType::TEXT || type == (uint8_t)LogFrameType::BYTES || type == (uint8_t)LogFrameType::FIELDS || type == (uint8_t)LogFrameType::SPAN;
+}
+
+/**
+ * @brief Encodes the data of a SPAN frame, which follows its name.
+ *
+ * @param buffer Destination buffer, LOG_SPAN_DATA_SIZE bytes long.
+ * @param span Span to encode.
+ */
+inline void logFramePutSpan(uint8_t *buffer, const LogFrameSpan &span)
+{
+    buffer[0] = (uint8_t)span.phase;
+    logFramePutU32(buffer + 1, span.id);
+    logFramePutU32(buffer + 5, span.parent);
+    logFramePutU64(buffer + 9, span.durationUs);
+}
+
+/**
+ * @brief Decodes the data of a SPAN frame.
+ *
+ * @param data Data following the name of the span.
+ * @param length Length of the data.
+ * @param span Set to the decoded span.
+ * @return bool Whether the data holds a span.
+ */
+inline bool logFrameReadSpan(const uint8_t *data, size_t length, LogFrameSpan &span)
+{
+    if (length < LOG_SPAN_DATA_SIZE || data[0] > (uint8_t)LogSpanPhase::END) return false;
+    span.phase = (LogSpanPhase)data[0];
+    span.id = logFrameGetU32(data + 1);
+    span.parent = logFrameGetU32(data + 5);
+    span.durationUs = logFrameGetU64(data + 9);
+    return true;
+}
+
+/**
+ * @brief Renders a span as the message of its record.
+ *
+ * The message is "span begin id=12 parent=3" or "span end id=12 parent=3 us=7312",
+ * so that the spans can be read back from a text log.
+ *
+ * @param buffer Destination buffer.
+ * @param size Size of the buffer.
+ * @param span Span to render.
+ * @return int Length of the message, as returned by snprintf().
+ */
+inline int logFrameFormatSpan(char *buffer, size_t size, const LogFrameSpan &span)
+{
+    if (span.phase == LogSpanPhase::BEGIN)
+    {
+        return snprintf(buffer, size, "span begin id=%lu parent=%lu", (unsigned long)span.id, (unsigned long)span.parent);
+    }
+    return snprintf(buffer, size, "span end id=%lu parent=%lu us=%llu", (unsigned long)span.id, (unsigned long)span.parent, (unsigned long long)span.durationUs);
+}
+
+/**
+ * @brief Encodes a field of a FIELDS frame.
+ *
+ * The value is made of two parts, so that the length of a STRING can be
+ * written before its characters without copying them first.
+ *
+ * @param buffer Destination buffer.
+ * @param available Number of bytes available in the destination buffer.
+ * @param type Type of the field.
+ * @param key Key of the field, truncated to 255 characters.
+ * @param keyLength Length of the key.
+ * @param value First part of the value.
+ * @param valueLength Length of the first part.
+ * @param extra Second part of the value.
+ * @param extraLength Length of the second part.
+ * @return size_t Size of the encoded field, 0 if it does not fit.
+ */
+inline size_t logFramePutField(uint8_t *buffer, size_t available, LogFieldType type, const char *key, size_t keyLength, const uint8_t *value, size_t valueLength, const uint8_t *extra, size_t extraLength)
+{
+    if (keyLength > 255) keyLength = 255;
+    size_t size = LOG_FIELD_HEADER_SIZE + keyLength + valueLength + extraLength;
+    if (size > available) return 0;
+
+    buffer[0] = (uint8_t)type;
+    buffer[1] = (uint8_t)keyLength;
+    uint8_t *destination = buffer + LOG_FIELD_HEADER_SIZE;
+    for (size_t i = 0; i < keyLength; i++) *destination++ = (uint8_t)key[i];
+    for (size_t i = 0; i < valueLength; i++) *destination++ = value[i];
+    for (size_t i = 0; i < extraLength; i++) *destination++ = extra[i];
+    return size;
+}
+
+/**
+ * @brief Decodes a field of a FIELDS frame.
+ *
+ * @param data First byte of the field.
+ * @param available Number of bytes of fields left.
+ * @param field Decoded field.
+ * @return size_t Size of the encoded field, 0 if it is truncated or of an unknown type.
+ */
+inline size_t logFrameReadField(const uint8_t *data, size_t available, LogFrameField &field)
+{
+    if (available < LOG_FIELD_HEADER_SIZE) return 0;
+
+    field.type = (LogFieldType)data[0];
+    field.keyLength = data[1];
+    field.key = (const char *)data + LOG_FIELD_HEADER_SIZE;
+    field.bits = 0;
+    field.string = nullptr;
+    field.stringLength = 0;
+
+    size_t size = LOG_FIELD_HEADER_SIZE + field.keyLength;
+    if (available < size) return 0;
+    const uint8_t *value = data + size;
+    switch (field.type)
+    {
+    case LogFieldType::INT:
+    case LogFieldType::UINT:
+    case LogFieldType::FLOAT:
+        if (available < size + 8) return 0;
+        field.bits = logFrameGetU64(value);
+        return size + 8;
+    case LogFieldType::BOOL:
+        if (available < size + 1) return 0;
+        field.bits = value[0];
+        return size + 1;
+    case LogFieldType::STRING:
+        if (available < size + 1 || available < size + 1 + value[0]) return 0;
+        field.string = (const char *)value + 1;
+        field.stringLength = value[0];
+        return size + 1 + value[0];
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Computes the CRC stored in a frame header.
+ *
+ * @param header Frame header (only the type and length fields are used).
+ * @param payload Payload of the frame.
+ * @param length Length of the payload.
+ * @return uint32_t CRC of the frame.
+ */
+inline uint32_t logFrameComputeCrc(const uint8_t *header, const uint8_t *payload, size_t length)
+{
+    uint32_t crc = logFrameCrc32(0, header + 1, 3);
+    return logFrameCrc32(crc, payload, length);
+}
+
+/**
+ * @brief Encodes the header of a frame whose payload is made of two parts.
+ *
+ * The payload is not copied, so that it can be written to storage directly
+ * after the header without assembling the whole frame in memory.
+ *
+ * @param header Destination buffer, LOG_FRAME_HEADER_SIZE bytes long.
+ * @param type Type of the frame.
+ * @param prefix First part of the payload.
+ * @param prefixLength Length of the first part.
+ * @param payload Second part of the payload.
+ * @param length Length of the second part. The total must not exceed LOG_FRAME_MAX_PAYLOAD.
+ */
+inline void logFrameEncodeHeader(uint8_t *header, LogFrameType type, const uint8_t *prefix, size_t prefixLength, const uint8_t *payload, size_t length)
+{
+    header[0] = LOG_FRAME_SYNC;
+    header[1] = (uint8_t)type;
+    logFramePutU16(header + 2, (uint16_t)(prefixLength + length));
+    uint32_t crc = logFrameCrc32(0, header + 1, 3);
+    crc = logFrameCrc32(crc, prefix, prefixLength);
+    logFramePutU32(header + 4, logFrameCrc32(crc, payload, length));
+}
+
+/**
+ * @brief Encodes the header of a frame.
+ *
+ * @param header Destination buffer, LOG_FRAME_HEADER_SIZE bytes long.
+ * @param type Type of the frame.
+ * @param payload Payload of the frame.
+ * @param length Length of the payload. Must not exceed LOG_FRAME_MAX_PAYLOAD.
+ */
+inline void logFrameEncodeHeader(uint8_t *header, LogFrameType type, const uint8_t *payload, size_t length)
+{
+    logFrameEncodeHeader(header, type, nullptr, 0, payload, length);
+}
+
+/**
+ * @brief Encodes a whole frame into the provided buffer.
+ *
+ * @param buffer Destination buffer, at least length + LOG_FRAME_OVERHEAD bytes long.
+ * @param type Type of the frame.
+ * @param payload Payload of the frame.
+ * @param length Length of the payload. Must not exceed LOG_FRAME_MAX_PAYLOAD.
+ * @return size_t Total size of the encoded frame.
+ */
+inline size_t logFrameEncode(uint8_t *buffer, LogFrameType type, const uint8_t *payload, size_t length)
+{
+    logFrameEncodeHeader(buffer, type, payload, length);
+    for (size_t i = 0; i < length; i++) buffer[LOG_FRAME_HEADER_SIZE + i] = payload[i];
+    logFramePutU16(buffer + LOG_FRAME_HEADER_SIZE + length, (uint16_t)length);
+    return length + LOG_FRAME_OVERHEAD;
+}
+
+/**
+ * @brief Checks whether a header looks like the start of a frame.
+ *
+ * This is a cheap pre-check done before reading the payload: it only
+ * validates the sync byte and the length bound.
+ *
+ * @param header Frame header (LOG_FRAME_HEADER_SIZE bytes).
+ * @return bool Whether the header is plausible.
+ */
+inline bool logFrameHeaderPlausible(const uint8_t *header)
+{
+    return header[0] == LOG_FRAME_SYNC && logFrameGetU16(header + 2) <= LOG_FRAME_MAX_PAYLOAD;
+}
+
+/**
+ * @brief Validates a complete frame held in memory.
+ *
+ * @param frame Pointer to the first byte of the frame.
+ * @param available Number of bytes readable from frame.
+ * @return size_t Size of the frame if valid, 0 otherwise.
+ */
+inline size_t logFrameValidate(const uint8_t *frame, size_t available)
+{
+    if (available < LOG_FRAME_OVERHEAD || !logFrameHeaderPlausible(frame)) return 0;
+
+    size_t length = logFrameGetU16(frame + 2);
+    if (available < length + LOG_FRAME_OVERHEAD) return 0;
+    if (logFrameGetU16(frame + LOG_FRAME_HEADER_SIZE + length) != length) return 0;
+    if (logFrameGetU32(frame + 4) != logFrameComputeCrc(frame, frame + LOG_FRAME_HEADER_SIZE, length)) return 0;
+
+    return length + LOG_FRAME_OVERHEAD;
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * File: LogLiveRing.h
+ * -------------------
+ * This file defines the in-memory ring through which AdvancedLogger streams the records
+ * it logs to any number of live subscribers, such as TCP consoles or web clients.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C and C++ standard libraries, so that it can also be
+ * built and tested on the host (see extras/liveBenchmark.cpp).
+ *
+ * Each record is stored once, as its length and sequence number followed by its text, at a
+ * byte position which only grows (modulo 2^32, which the power-of-two capacity divides).
+ * Each subscriber only holds a cursor, made of the position and the sequence number of the
+ * next record it expects, so that the producers neither know about the subscribers nor wait
+ * for them: a new record simply overwrites the oldest ones.
+ * The readers take no lock: like a seqlock, a reader copies a record and only then checks
+ * that the writer did not reach it in the meantime. A subscriber which fell behind by more
+ * than the capacity of the ring is moved to the oldest record, and told how many records it
+ * missed through the gap in the sequence numbers.
+ *
+ * The writes must be serialized by the caller (AdvancedLogger writes with its lock held),
+ * while any number of readers can read concurrently with them.
+ */
+
+#ifndef LOGLIVERING_H
+#define LOGLIVERING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+constexpr size_t LOG_LIVE_HEADER_SIZE = 6; // Length (uint16) and sequence number (uint32) of a record
+
+struct LogLiveCursor {
+    uint32_t position = 0; // Byte position of the next record
+    uint32_t sequence = 0; // Sequence number of the next record
+    bool synced = false; // Whether sequence is known, or must be taken from the next record
+};
+
+class LogLiveRing
+{
+public:
+    LogLiveRing() {}
+    ~LogLiveRing() { free(_data); }
+
+    LogLiveRing(const LogLiveRing &) = delete;
+    LogLiveRing &operator=(const LogLiveRing &) = delete;
+
+    /**
+     * @brief Allocates the ring.
+     *
+     * This is the only allocation done by the ring. Calling it again after
+     * a successful call does nothing.
+     *
+     * @param capacity Size of the ring in bytes, rounded down to a power of two.
+     * @return bool Whether the ring was allocated.
+     */
+    bool begin(size_t capacity)
+    {
+        if (_data != nullptr) return true;
+        if (capacity < 8 * LOG_LIVE_HEADER_SIZE) return false;
+        while (capacity & (capacity - 1)) capacity &= capacity - 1;
+        _data = (uint8_t *)malloc(capacity);
+        if (_data == nullptr) return false;
+        _capacity = capacity;
+        return true;
+    }
+
+    bool active() const { return _data != nullptr; }
+
+    /**
+     * @brief Appends a record, overwriting the oldest ones if needed.
+     *
+     * Records longer than a quarter of the ring (or 65535 bytes) are
+     * truncated, so that the ring always holds a few of them.
+     *
+     * @param text Text of the record.
+     * @param length Length of the text.
+     * @param suffix Text appended to the record, such as its fields, or nullptr.
+     * @param suffixLength Length of the suffix.
+     */
+    void write(const char *text, size_t length, const char *suffix = nullptr, size_t suffixLength = 0)
+    {
+        if (_data == nullptr) return;
+        if (length > _maxLength()) length = _maxLength();
+        if (suffixLength > _maxLength() - length) suffixLength = _maxLength() - length;
+
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        uint32_t end = head + LOG_LIVE_HEADER_SIZE + length + suffixLength;
+
+        // The records about to be overwritten are dropped first, so that no reader starts one of them
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        while (end - tail > (uint32_t)_capacity)
+        {
+            uint8_t lengthBytes[2];
+            _copyOut(tail, lengthBytes, 2);
+            tail += LOG_LIVE_HEADER_SIZE + (lengthBytes[0] | (lengthBytes[1] << 8));
+        }
+        _tail.store(tail, std::memory_order_release);
+        _reserved.store(end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint8_t header[LOG_LIVE_HEADER_SIZE];
+        header[0] = (uint8_t)(length + suffixLength);
+        header[1] = (uint8_t)((length + suffixLength) >> 8);
+        for (int i = 0; i < 4; i++) header[2 + i] = (uint8_t)(_sequence >> (8 * i));
+        _copyIn(head, header, LOG_LIVE_HEADER_SIZE);
+        _copyIn(head + LOG_LIVE_HEADER_SIZE, (const uint8_t *)text, length);
+        if (suffixLength > 0) _copyIn(head + LOG_LIVE_HEADER_SIZE + length, (const uint8_t *)suffix, suffixLength);
+        _sequence++;
+
+        _head.store(end, std::memory_order_release);
+    }
+
+    /**
+     * @brief Gets a cursor for a new subscriber.
+     *
+     * Must be serialized with the writes, so that a subscriber starting from
+     * the next record knows its sequence number, and is told about the
+     * records it misses from the start.
+     *
+     * @param fromOldest Whether to start from the oldest record in the ring, or from the next one written.
+     * @return LogLiveCursor Cursor of the subscriber.
+     */
+    LogLiveCursor subscribe(bool fromOldest) const
+    {
+        LogLiveCursor cursor;
+        if (fromOldest)
+        {
+            cursor.position = _tail.load(std::memory_order_acquire);
+        }
+        else
+        {
+            cursor.position = _head.load(std::memory_order_acquire);
+            cursor.sequence = _sequence;
+            cursor.synced = true;
+        }
+        return cursor;
+    }
+
+    /**
+     * @brief Reads the next record of a subscriber.
+     *
+     * If records were overwritten before the subscriber could read them,
+     * their number is returned first in skipped, and the record following
+     * them is returned by the next call.
+     *
+     * @param cursor Cursor of the subscriber.
+     * @param buffer Destination of the text of the record, null-terminated and truncated to fit.
+     * @param size Size of the buffer.
+     * @param skipped Set to the number of records missed, 0 if none.
+     * @return size_t Length of the text written to the buffer, 0 if there is no new record or records were missed.
+     */
+    size_t read(LogLiveCursor &cursor, char *buffer, size_t size, uint32_t &skipped) const
+    {
+        skipped = 0;
+        if (_data == nullptr || size == 0) return 0;
+
+        while (true)
+        {
+            uint32_t tail = _tail.load(std::memory_order_acquire);
+            if ((int32_t)(cursor.position - tail) < 0) cursor.position = tail;
+            if ((int32_t)(cursor.position - _head.load(std::memory_order_acquire)) >= 0) return 0;
+
+            uint8_t header[LOG_LIVE_HEADER_SIZE];
+            _copyOut(cursor.position, header, LOG_LIVE_HEADER_SIZE);
+            size_t length = header[0] | (header[1] << 8);
+            uint32_t sequence = header[2] | (header[3] << 8) | (header[4] << 16) | ((uint32_t)header[5] << 24);
+            // A torn header may hold any length, which must not make the copy overflow the ring
+            size_t copied = length < size - 1 ? length : size - 1;
+            if (copied > _maxLength()) copied = _maxLength();
+            _copyOut(cursor.position + LOG_LIVE_HEADER_SIZE, (uint8_t *)buffer, copied);
+
+            // If the writer reached the record while it was copied, the copy may be torn
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_reserved.load(std::memory_order_relaxed) - cursor.position > (uint32_t)_capacity) continue;
+
+            if (cursor.synced && sequence != cursor.sequence)
+            {
+                skipped = sequence - cursor.sequence;
+                cursor.sequence = sequence;
+                return 0;
+            }
+            cursor.position += LOG_LIVE_HEADER_SIZE + length;
+            cursor.sequence = sequence + 1;
+            cursor.synced = true;
+            buffer[copied] = '\0';
+            return copied;
+        }
+    }
+
+private:
+    uint8_t *_data = nullptr;
+    size_t _capacity = 0;
+    uint32_t _sequence = 0; // Of the next record written
+    std::atomic<uint32_t> _head{0}; // End of the last record written
+    std::atomic<uint32_t> _tail{0}; // Start of the oldest record not overwritten
+    std::atomic<uint32_t> _reserved{0}; // End of the record being written, which may already overwrite older ones
+
+    size_t _maxLength() const
+    {
+        size_t maxLength = _capacity / 4 - LOG_LIVE_HEADER_SIZE;
+        return maxLength < 0xFFFF ? maxLength : 0xFFFF;
+    }
+
+    void _copyIn(uint32_t position, const uint8_t *source, size_t length)
+    {
+        size_t offset = position & (_capacity - 1);
+        size_t first = length < _capacity - offset ? length : _capacity - offset;
+        memcpy(_data + offset, source, first);
+        memcpy(_data, source + first, length - first);
+    }
+
+    void _copyOut(uint32_t position, uint8_t *destination, size_t length) const
+    {
+        size_t offset = position & (_capacity - 1);
+        size_t first = length < _capacity - offset ? length : _capacity - offset;
+        memcpy(destination, _data + offset, first);
+        memcpy(destination + first, _data, length - first);
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * File: LogMerge.h
+ * ----------------
+ * This file defines the heap used to merge several chronologically ordered streams of
+ * records into one, such as the tiers of the log in dump(), or the logs of several devices.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C++ standard library, so that it can also be used by host
+ * tools (see extras/logMerge.cpp).
+ *
+ * The heap holds one entry per input which still has records: the index of the input and the
+ * key of its next record. The caller reads the record of the top input, then either replaces
+ * the key of the top with the one of the next record of that input, which costs a single
+ * sift-down instead of a pop and a push, or pops the input once it has no more records. The
+ * memory is one entry per input, whatever the number of records. Equal keys come out in the
+ * order of the inputs, so that the merge is deterministic.
+ */
+
+#ifndef LOGMERGE_H
+#define LOGMERGE_H
+
+#include <stddef.h>
+
+#include <utility>
+#include <vector>
+
+template <typename Key>
+class LogMergeHeap
+{
+public:
+    /**
+     * @brief Reserves the entries of the inputs, so that the merge does not allocate.
+     *
+     * @param inputCount Number of inputs.
+     */
+    void reserve(size_t inputCount) { _entries.reserve(inputCount); }
+
+    void clear() { _entries.clear(); }
+    bool empty() const { return _entries.empty(); }
+    size_t size() const { return _entries.size(); }
+
+    /**
+     * @brief Adds an input.
+     *
+     * @param input Index of the input.
+     * @param key Key of the first record of the input.
+     */
+    void push(size_t input, const Key &key)
+    {
+        _entries.push_back({key, input});
+        size_t position = _entries.size() - 1;
+        while (position > 0)
+        {
+            size_t parent = (position - 1) / 2;
+            if (!_before(_entries[position], _entries[parent])) break;
+            std::swap(_entries[position], _entries[parent]);
+            position = parent;
+        }
+    }
+
+    /**
+     * @brief Gets the input whose next record comes first.
+     *
+     * @return size_t Index of the input. The heap must not be empty.
+     */
+    size_t top() const { return _entries[0].input; }
+
+    const Key &topKey() const { return _entries[0].key; }
+
+    /**
+     * @brief Sets the key of the top input, after its record was read.
+     *
+     * @param key Key of the next record of the top input.
+     */
+    void replaceTop(const Key &key)
+    {
+        _entries[0].key = key;
+        _siftDown(0);
+    }
+
+    /**
+     * @brief Removes the top input, after its last record was read.
+     */
+    void pop()
+    {
+        _entries[0] = _entries.back();
+        _entries.pop_back();
+        if (!_entries.empty()) _siftDown(0);
+    }
+
+private:
+    struct Entry {
+        Key key;
+        size_t input;
+    };
+
+    std::vector<Entry> _entries;
+
+    static bool _before(const Entry &a, const Entry &b)
+    {
+        if (a.key < b.key) return true;
+        if (b.key < a.key) return false;
+        return a.input < b.input;
+    }
+
+    void _siftDown(size_t position)
+    {
+        size_t count = _entries.size();
+        while (true)
+        {
+            size_t first = position;
+            size_t left = 2 * position + 1;
+            if (left < count && _before(_entries[left], _entries[first])) first = left;
+            if (left + 1 < count && _before(_entries[left + 1], _entries[first])) first = left + 1;
+            if (first == position) return;
+            std::swap(_entries[position], _entries[first]);
+            position = first;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * File: LogRecordPool.h
+ * ---------------------
+ * This file defines the pool of fixed-size blocks used by AdvancedLogger
+ * to hold the records it queues, so that no heap allocation is done per record.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C and C++ standard libraries, so that it can also be
+ * built and benchmarked on the host (see extras/poolBenchmark.cpp).
+ *
+ * The pool is made of LOG_POOL_CLASS_COUNT size classes, each one a single slab of
+ * equally sized blocks allocated once by begin(). The free blocks of each class form
+ * a lock-free stack, whose head packs the index of the first free block with a tag
+ * incremented at every change, so that acquire() and release() are O(1) and can be
+ * called concurrently from both cores without taking any lock.
+ */
+
+#ifndef LOGRECORDPOOL_H
+#define LOGRECORDPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+constexpr int LOG_POOL_CLASS_COUNT = 3;
+constexpr size_t LOG_POOL_BLOCK_SIZES[LOG_POOL_CLASS_COUNT] = {128, 512, 1280}; // The largest holds a record of MAX_LOG_LENGTH with its metadata
+constexpr uint16_t LOG_POOL_BLOCK_COUNTS[LOG_POOL_CLASS_COUNT] = {16, 4, 2};
+constexpr uint16_t LOG_POOL_EMPTY = 0xFFFF;
+
+struct LogPoolClassStats {
+    size_t blockSize = 0;
+    size_t blockCount = 0;
+    size_t inUse = 0;
+    size_t highWater = 0; // Highest number of blocks in use at the same time
+    size_t failures = 0; // Acquisitions which found this class and all the larger ones empty
+};
+
+struct LogPoolStats {
+    LogPoolClassStats classes[LOG_POOL_CLASS_COUNT];
+};
+
+class LogRecordPool
+{
+public:
+    LogRecordPool() {}
+    ~LogRecordPool() { free(_memory); }
+
+    LogRecordPool(const LogRecordPool &) = delete;
+    LogRecordPool &operator=(const LogRecordPool &) = delete;
+
+    /**
+     * @brief Allocates the slabs of the pool.
+     *
+     * This is the only allocation done by the pool. Calling it again after
+     * a successful call does nothing.
+     *
+     * @param blockCounts Number of blocks of each size class, less than LOG_POOL_EMPTY each.
+     * @return bool Whether the slabs were allocated.
+     */
+    bool begin(const uint16_t *blockCounts = LOG_POOL_BLOCK_COUNTS)
+    {
+        if (_memory != nullptr) return true;
+
+        size_t total = 0;
+        for (int i = 0; i < LOG_POOL_CLASS_COUNT; i++)
+        {
+            total += blockCounts[i] * (LOG_POOL_BLOCK_SIZES[i] + sizeof(std::atomic<uint16_t>));
+        }
+        _memory = (uint8_t *)malloc(total);
+        if (_memory == nullptr) return false;
+
+        // The slabs come first, as their block sizes keep them aligned, followed by the free lists
+        uint8_t *slab = _memory;
+        std::atomic<uint16_t> *next = nullptr;
+        for (int i = 0; i < LOG_POOL_CLASS_COUNT; i++)
+        {
+            _classes[i].slab = slab;
+            _classes[i].blockCount = blockCounts[i];
+            slab += blockCounts[i] * LOG_POOL_BLOCK_SIZES[i];
+        }
+        next = reinterpret_cast<std::atomic<uint16_t> *>(slab);
+        for (int i = 0; i < LOG_POOL_CLASS_COUNT; i++)
+        {
+            SizeClass &sizeClass = _classes[i];
+            sizeClass.next = next;
+            for (uint16_t block = 0; block < sizeClass.blockCount; block++)
+            {
+                new (&sizeClass.next[block]) std::atomic<uint16_t>(block + 1 < sizeClass.blockCount ? block + 1 : LOG_POOL_EMPTY);
+            }
+            sizeClass.head.store(sizeClass.blockCount > 0 ? 0 : LOG_POOL_EMPTY);
+            next += sizeClass.blockCount;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Acquires a block of at least the requested size.
+     *
+     * The smallest class that fits is tried first, then the larger ones.
+     *
+     * @param size Number of bytes needed.
+     * @return void* Block, or nullptr if none is free.
+     */
+    void *acquire(size_t size)
+    {
+        int first = 0;
+        while (first < LOG_POOL_CLASS_COUNT && LOG_POOL_BLOCK_SIZES[first] < size) first++;
+
+        for (int i = first; i < LOG_POOL_CLASS_COUNT; i++)
+        {
+            void *block = _pop(i);
+            if (block != nullptr) return block;
+        }
+        if (first < LOG_POOL_CLASS_COUNT) _classes[first].failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    /**
+     * @brief Releases a block acquired from this pool.
+     *
+     * @param block Block to release. nullptr is ignored.
+     */
+    void release(void *block)
+    {
+        uint8_t *pointer = static_cast<uint8_t *>(block);
+        for (int i = 0; i < LOG_POOL_CLASS_COUNT; i++)
+        {
+            SizeClass &sizeClass = _classes[i];
+            if (pointer >= sizeClass.slab && pointer < sizeClass.slab + sizeClass.blockCount * LOG_POOL_BLOCK_SIZES[i])
+            {
+                _push(i, (uint16_t)((pointer - sizeClass.slab) / LOG_POOL_BLOCK_SIZES[i]));
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Gets the occupancy of each size class.
+     *
+     * @return LogPoolStats Statistics of the pool.
+     */
+    LogPoolStats getStats() const
+    {
+        LogPoolStats stats;
+        for (int i = 0; i < LOG_POOL_CLASS_COUNT; i++)
+        {
+            stats.classes[i].blockSize = LOG_POOL_BLOCK_SIZES[i];
+            stats.classes[i].blockCount = _classes[i].blockCount;
+            stats.classes[i].inUse = _classes[i].inUse.load(std::memory_order_relaxed);
+            stats.classes[i].highWater = _classes[i].highWater.load(std::memory_order_relaxed);
+            stats.classes[i].failures = _classes[i].failures.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+private:
+    struct SizeClass {
+        uint8_t *slab = nullptr;
+        uint16_t blockCount = 0;
+        std::atomic<uint16_t> *next = nullptr; // Index of the next free block, for each block
+        std::atomic<uint32_t> head{LOG_POOL_EMPTY}; // Tag in the upper 16 bits, index of the first free block in the lower 16
+        std::atomic<uint32_t> inUse{0};
+        std::atomic<uint32_t> highWater{0};
+        std::atomic<uint32_t> failures{0};
+    };
+
+    uint8_t *_memory = nullptr;
+    SizeClass _classes[LOG_POOL_CLASS_COUNT];
+
+    void *_pop(int classIndex)
+    {
+        SizeClass &sizeClass = _classes[classIndex];
+        uint32_t head = sizeClass.head.load(std::memory_order_acquire);
+        uint16_t index;
+        do
+        {
+            index = (uint16_t)head;
+            if (index == LOG_POOL_EMPTY) return nullptr;
+            // The tag makes the exchange fail if the block was popped and pushed back in between
+            uint32_t next = sizeClass.next[index].load(std::memory_order_relaxed);
+            if (sizeClass.head.compare_exchange_weak(head, ((head & 0xFFFF0000) + 0x10000) | next, std::memory_order_acquire, std::memory_order_acquire)) break;
+        } while (true);
+
+        uint32_t inUse = sizeClass.inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t highWater = sizeClass.highWater.load(std::memory_order_relaxed);
+        while (inUse > highWater && !sizeClass.highWater.compare_exchange_weak(highWater, inUse, std::memory_order_relaxed)) {}
+
+        return sizeClass.slab + index * LOG_POOL_BLOCK_SIZES[classIndex];
+    }
+
+    void _push(int classIndex, uint16_t index)
+    {
+        SizeClass &sizeClass = _classes[classIndex];
+        sizeClass.inUse.fetch_sub(1, std::memory_order_relaxed);
+
+        uint32_t head = sizeClass.head.load(std::memory_order_relaxed);
+        do
+        {
+            sizeClass.next[index].store((uint16_t)head, std::memory_order_relaxed);
+        } while (!sizeClass.head.compare_exchange_weak(head, ((head & 0xFFFF0000) + 0x10000) | index, std::memory_order_release, std::memory_order_relaxed));
+    }
+};
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * File: LogStats.h
+ * ----------------
+ * This file defines the in-RAM statistics kept by AdvancedLogger on the records it logs:
+ * counts per level and per function over rolling windows, answered without reading the log.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C and C++ standard libraries, so that it can also be
+ * built and tested on the host.
+ *
+ * Each count is kept since boot and in two rings of LOG_STATS_BUCKET_COUNT buckets, one for
+ * the last minute and one for the last hour, so that the windows roll with the uptime without
+ * keeping any timestamp per record. The functions are tracked with a space-saving sketch of
+ * LOG_STATS_FUNCTION_COUNT (function, level) pairs: when a new pair arrives and the sketch is
+ * full, it replaces the pair with the lowest count since boot and inherits that count as its
+ * error. The pairs logged more often than 1/LOG_STATS_FUNCTION_COUNT of all the records are
+ * then guaranteed to be in the sketch, with their count since boot overestimated by at most
+ * their error, in fixed memory whatever the number of functions.
+ *
+ * The class is not thread-safe: AdvancedLogger updates and queries it with its lock held.
+ */
+
+#ifndef LOGSTATS_H
+#define LOGSTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+constexpr int LOG_STATS_LEVEL_COUNT = 6;
+constexpr int LOG_STATS_FUNCTION_COUNT = 16; // (function, level) pairs tracked by the sketch
+constexpr size_t LOG_STATS_FUNCTION_SIZE = 32; // Longer function names are truncated
+constexpr int LOG_STATS_BUCKET_COUNT = 6;
+constexpr uint32_t LOG_STATS_MINUTE_BUCKET = 60 / LOG_STATS_BUCKET_COUNT; // s
+constexpr uint32_t LOG_STATS_HOUR_BUCKET = 3600 / LOG_STATS_BUCKET_COUNT; // s
+
+enum class LogStatsWindow : int {
+    LAST_MINUTE, // Between the last 50 and 60 s, as the oldest bucket is dropped as a whole
+    LAST_HOUR, // Between the last 50 and 60 min
+    SINCE_BOOT
+};
+
+/**
+ * @brief Counts events since boot and over the last minute and hour.
+ */
+struct LogWindowCount {
+    uint32_t total = 0;
+    uint32_t minute[LOG_STATS_BUCKET_COUNT] = {};
+    uint32_t hour[LOG_STATS_BUCKET_COUNT] = {};
+    uint32_t minuteBucket = 0; // Uptime of the last event in LOG_STATS_MINUTE_BUCKET units
+    uint32_t hourBucket = 0; // Uptime of the last event in LOG_STATS_HOUR_BUCKET units
+
+    void add(uint32_t second)
+    {
+        total++;
+        _advance(minute, minuteBucket, second / LOG_STATS_MINUTE_BUCKET)++;
+        _advance(hour, hourBucket, second / LOG_STATS_HOUR_BUCKET)++;
+    }
+
+    uint32_t get(LogStatsWindow window, uint32_t second) const
+    {
+        switch (window)
+        {
+            case LogStatsWindow::LAST_MINUTE: return _sum(minute, minuteBucket, second / LOG_STATS_MINUTE_BUCKET);
+            case LogStatsWindow::LAST_HOUR:   return _sum(hour, hourBucket, second / LOG_STATS_HOUR_BUCKET);
+            default:                          return total;
+        }
+    }
+
+private:
+    // Clears the buckets skipped since the last event, and returns the current one
+    static uint32_t &_advance(uint32_t *buckets, uint32_t &last, uint32_t current)
+    {
+        if (current != last)
+        {
+            uint32_t skipped = current - last < (uint32_t)LOG_STATS_BUCKET_COUNT ? current - last : LOG_STATS_BUCKET_COUNT;
+            for (uint32_t i = 1; i <= skipped; i++) buckets[(last + i) % LOG_STATS_BUCKET_COUNT] = 0;
+            last = current;
+        }
+        return buckets[current % LOG_STATS_BUCKET_COUNT];
+    }
+
+    // Sums the buckets of the last event which are still in the window ending at the current one
+    static uint32_t _sum(const uint32_t *buckets, uint32_t last, uint32_t current)
+    {
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < (uint32_t)LOG_STATS_BUCKET_COUNT && i <= last; i++)
+        {
+            if (current - (last - i) < (uint32_t)LOG_STATS_BUCKET_COUNT) sum += buckets[(last - i) % LOG_STATS_BUCKET_COUNT];
+        }
+        return sum;
+    }
+};
+
+struct LogStatsEntry {
+    char function[LOG_STATS_FUNCTION_SIZE] = "";
+    uint32_t hash = 0;
+    uint8_t level = 0;
+    uint32_t error = 0; // Maximum overestimation of the count since boot
+    LogWindowCount count; // The windows only count the records since the pair entered the sketch
+};
+
+class LogStats
+{
+public:
+    /**
+     * @brief Counts a record.
+     *
+     * @param level Level of the record, less than LOG_STATS_LEVEL_COUNT.
+     * @param function Function of the record.
+     * @param second Uptime of the record in seconds.
+     */
+    void add(uint8_t level, const char *function, uint32_t second)
+    {
+        if (level >= LOG_STATS_LEVEL_COUNT) return;
+        _levels[level].add(second);
+
+        size_t length = strnlen(function, LOG_STATS_FUNCTION_SIZE - 1);
+        uint32_t hash = _hash(function, length, level);
+        int lowest = 0;
+        for (int i = 0; i < _entryCount; i++)
+        {
+            LogStatsEntry &entry = _entries[i];
+            if (entry.hash == hash && entry.level == level && strncmp(entry.function, function, length) == 0 && entry.function[length] == '\0')
+            {
+                entry.count.add(second);
+                return;
+            }
+            if (entry.count.total < _entries[lowest].count.total) lowest = i;
+        }
+
+        LogStatsEntry *entry;
+        uint32_t inherited = 0;
+        if (_entryCount < LOG_STATS_FUNCTION_COUNT)
+        {
+            entry = &_entries[_entryCount++];
+        }
+        else
+        {
+            entry = &_entries[lowest];
+            inherited = entry->count.total;
+        }
+        *entry = LogStatsEntry();
+        memcpy(entry->function, function, length);
+        entry->function[length] = '\0';
+        entry->hash = hash;
+        entry->level = level;
+        entry->error = inherited;
+        entry->count.total = inherited;
+        entry->count.add(second);
+    }
+
+    /**
+     * @brief Gets the number of records of a level in a window.
+     *
+     * @param level Level of the records.
+     * @param window Window of the count.
+     * @param second Current uptime in seconds.
+     * @return uint32_t Number of records.
+     */
+    uint32_t count(uint8_t level, LogStatsWindow window, uint32_t second) const
+    {
+        return level < LOG_STATS_LEVEL_COUNT ? _levels[level].get(window, second) : 0;
+    }
+
+    /**
+     * @brief Gets the (function, level) pairs with the most records in a window.
+     *
+     * @param top Destination of the pairs, from the one with the most records.
+     * @param counts Destination of the count of each pair in the window.
+     * @param maxCount Size of top and counts.
+     * @param window Window of the counts.
+     * @param minLevel Lowest level of the pairs returned.
+     * @param second Current uptime in seconds.
+     * @return size_t Number of pairs returned, the ones without records in the window being skipped.
+     */
+    size_t top(const LogStatsEntry **top, uint32_t *counts, size_t maxCount, LogStatsWindow window, uint8_t minLevel, uint32_t second) const
+    {
+        size_t found = 0;
+        for (int i = 0; i < _entryCount; i++)
+        {
+            const LogStatsEntry &entry = _entries[i];
+            uint32_t entryCount = entry.count.get(window, second);
+            if (entry.level < minLevel || entryCount == 0) continue;
+
+            // Insertion in the sorted destination, as it holds a handful of pairs
+            size_t position = found < maxCount ? found++ : maxCount;
+            while (position > 0 && counts[position - 1] < entryCount)
+            {
+                if (position < maxCount)
+                {
+                    top[position] = top[position - 1];
+                    counts[position] = counts[position - 1];
+                }
+                position--;
+            }
+            if (position < maxCount)
+            {
+                top[position] = &entry;
+                counts[position] = entryCount;
+            }
+        }
+        return found;
+    }
+
+    void reset()
+    {
+        for (int i = 0; i < LOG_STATS_LEVEL_COUNT; i++) _levels[i] = LogWindowCount();
+        _entryCount = 0;
+    }
+
+private:
+    LogWindowCount _levels[LOG_STATS_LEVEL_COUNT];
+    LogStatsEntry _entries[LOG_STATS_FUNCTION_COUNT];
+    int _entryCount = 0;
+
+    // FNV-1a, so that most lookups compare a single word per entry
+    static uint32_t _hash(const char *function, size_t length, uint8_t level)
+    {
+        uint32_t hash = 2166136261UL ^ level;
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= (uint8_t)function[i];
+            hash *= 16777619UL;
+        }
+        return hash;
+    }
+};
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ * File: LogWatch.h
+ * ----------------
+ * This file defines the matcher used by AdvancedLogger to find which of the watched
+ * patterns appear in the message of a record, in a single pass over the message.
+ *
+ * Author: Jibril Sharafi, @jibrilsharafi
+ * GitHub repository: https://github.com/jibrilsharafi/AdvancedLogger
+ *
+ * This library is licensed under the MIT License. See the LICENSE file for more information.
+ *
+ * The header only depends on the C and C++ standard libraries, so that it can also be
+ * built and benchmarked on the host (see extras/watchBenchmark.cpp).
+ *
+ * A pattern is a substring to find anywhere in the message, in which '*' matches any
+ * sequence of characters, so that "timeout*ms" matches "timeout after 500 ms". The pieces
+ * between the '*' of all the patterns are compiled into a single Aho-Corasick automaton,
+ * and the message is scanned once whatever the number of patterns: a pattern matches when
+ * its pieces are found in order without overlapping. The automaton is rebuilt on the first
+ * match after a pattern is added or removed, which is the only time it allocates.
+ *
+ * The transitions of the root are a direct table, as most characters of a message lead
+ * back to it, while the other nodes keep their few transitions in a sorted array, so that
+ * the automaton stays small enough for the ESP32 with a hundred patterns.
+ *
+ * The class is not thread-safe: AdvancedLogger adds, removes and matches with its lock held.
+ */
+
+#ifndef LOGWATCH_H
+#define LOGWATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+constexpr int LOG_WATCH_MAX_PATTERNS = 128;
+constexpr size_t LOG_WATCH_MAX_PATTERN_LENGTH = 64;
+constexpr char LOG_WATCH_WILDCARD = '*';
+constexpr uint16_t LOG_WATCH_NONE = 0xFFFF;
+
+class LogWatchMatcher
+{
+public:
+    /**
+     * @brief Adds a pattern.
+     *
+     * @param pattern Substring to find, in which '*' matches any sequence of characters.
+     * @return int Id of the pattern, or -1 if it is empty, too long or all the ids are used.
+     */
+    int add(const char *pattern)
+    {
+        size_t length = strlen(pattern);
+        if (length == 0 || length > LOG_WATCH_MAX_PATTERN_LENGTH) return -1;
+        if (strspn(pattern, "*") == length) return -1; // Would match every message
+
+        size_t id = 0;
+        while (id < _patterns.size() && _patterns[id].active) id++;
+        if (id == (size_t)LOG_WATCH_MAX_PATTERNS) return -1;
+        if (id == _patterns.size()) _patterns.emplace_back();
+
+        _patterns[id].text.assign(pattern, length);
+        _patterns[id].active = true;
+        _dirty = true;
+        return (int)id;
+    }
+
+    /**
+     * @brief Removes a pattern, whose id can then be reused.
+     *
+     * @param id Id of the pattern.
+     * @return bool Whether the pattern existed.
+     */
+    bool remove(int id)
+    {
+        if (id < 0 || (size_t)id >= _patterns.size() || !_patterns[id].active) return false;
+        _patterns[id].active = false;
+        _patterns[id].text.clear();
+        _dirty = true;
+        return true;
+    }
+
+    /**
+     * @brief Gets the number of patterns.
+     *
+     * @return size_t Number of patterns added and not removed.
+     */
+    size_t count() const
+    {
+        size_t active = 0;
+        for (const Pattern &pattern : _patterns) active += pattern.active;
+        return active;
+    }
+
+    /**
+     * @brief Finds the patterns appearing in a text.
+     *
+     * @param text Text to scan.
+     * @param length Length of the text.
+     * @param matched Destination of the ids of the patterns found, in the order in which they complete.
+     * @param maxMatched Size of matched.
+     * @return size_t Number of ids written to matched.
+     */
+    size_t match(const char *text, size_t length, uint16_t *matched, size_t maxMatched)
+    {
+        return match(text, length, matched, maxMatched, [](uint16_t) { return true; });
+    }
+
+    /**
+     * @brief Finds the patterns appearing in a text and accepted by a filter.
+     *
+     * The patterns rejected by the filter do not take room in matched, so
+     * that they can never hide the ones accepted.
+     *
+     * @param text Text to scan.
+     * @param length Length of the text.
+     * @param matched Destination of the ids of the patterns found, in the order in which they complete.
+     * @param maxMatched Size of matched.
+     * @param accept Called as accept(id) for each pattern found, returning whether to keep it.
+     * @return size_t Number of ids written to matched.
+     */
+    template <typename Filter>
+    size_t match(const char *text, size_t length, uint16_t *matched, size_t maxMatched, Filter accept)
+    {
+        if (_dirty) _build();
+        if (_nodes.empty() || maxMatched == 0) return 0;
+
+        // The state of each pattern is only valid for the current scan, so that nothing is cleared per scan
+        if (++_scan == 0)
+        {
+            std::fill(_states.begin(), _states.end(), PatternState());
+            _scan = 1;
+        }
+
+        size_t found = 0;
+        uint16_t node = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            // Most characters are read at the root, and most of them lead back to it
+            if (node == 0)
+            {
+                node = _root[(uint8_t)text[i]];
+                if (node == 0) continue;
+            }
+            else
+            {
+                node = _next(node, (uint8_t)text[i]);
+            }
+            for (uint16_t output = _nodes[node].outputCount > 0 ? node : _nodes[node].outputLink; output != LOG_WATCH_NONE; output = _nodes[output].outputLink)
+            {
+                const Node &outputNode = _nodes[output];
+                for (uint16_t k = 0; k < outputNode.outputCount; k++)
+                {
+                    const Piece &piece = _pieces[_outputs[outputNode.firstOutput + k]];
+                    PatternState &state = _states[piece.pattern];
+                    if (state.scan != _scan)
+                    {
+                        state.scan = _scan;
+                        state.progress = 0;
+                        state.end = 0;
+                    }
+                    if (state.progress != piece.index || i + 1 - piece.length < state.end) continue;
+
+                    state.progress++;
+                    state.end = (uint32_t)(i + 1);
+                    if (state.progress == _patterns[piece.pattern].pieceCount && accept(piece.pattern))
+                    {
+                        matched[found++] = piece.pattern;
+                        if (found == maxMatched) return found;
+                    }
+                }
+            }
+        }
+        return found;
+    }
+
+private:
+    struct Pattern {
+        std::string text;
+        bool active = false;
+        uint8_t pieceCount = 0;
+    };
+
+    struct Piece {
+        uint16_t pattern = 0;
+        uint8_t index = 0; // Position of the piece in its pattern
+        uint8_t length = 0;
+    };
+
+    struct PatternState {
+        uint32_t scan = 0;
+        uint8_t progress = 0; // Pieces found so far
+        uint32_t end = 0; // End of the last piece found, where the next one may start
+    };
+
+    struct Node {
+        uint16_t firstEdge = 0;
+        uint16_t edgeCount = 0;
+        uint16_t fail = 0;
+        uint16_t outputLink = LOG_WATCH_NONE; // Nearest node on the fail chain with outputs
+        uint16_t firstOutput = 0;
+        uint16_t outputCount = 0;
+    };
+
+    struct Edge {
+        uint8_t character;
+        uint16_t target;
+    };
+
+    std::vector<Pattern> _patterns;
+    std::vector<Piece> _pieces;
+    std::vector<PatternState> _states;
+    std::vector<Node> _nodes;
+    std::vector<Edge> _edges; // Sorted by character for each node
+    std::vector<uint16_t> _outputs; // Pieces ending at each node
+    uint16_t _root[256] = {};
+    uint32_t _scan = 0;
+    bool _dirty = false;
+
+    uint16_t _child(uint16_t node, uint8_t character) const
+    {
+        const Node &current = _nodes[node];
+        const Edge *first = _edges.data() + current.firstEdge;
+        const Edge *last = first + current.edgeCount;
+        const Edge *edge = std::lower_bound(first, last, character, [](const Edge &e, uint8_t c) { return e.character < c; });
+        return (edge != last && edge->character == character) ? edge->target : LOG_WATCH_NONE;
+    }
+
+    uint16_t _next(uint16_t node, uint8_t character) const
+    {
+        while (node != 0)
+        {
+            uint16_t child = _child(node, character);
+            if (child != LOG_WATCH_NONE) return child;
+            node = _nodes[node].fail;
+        }
+        return _root[character];
+    }
+
+    void _build()
+    {
+        _dirty = false;
+        _pieces.clear();
+        _nodes.clear();
+        _edges.clear();
+        _outputs.clear();
+        _states.assign(_patterns.size(), PatternState());
+        _scan = 0;
+        memset(_root, 0, sizeof(_root));
+
+        // Trie of the pieces, with the children of each node in a temporary list
+        std::vector<std::vector<Edge>> children(1);
+        std::vector<std::vector<uint16_t>> outputs(1);
+        for (size_t id = 0; id < _patterns.size(); id++)
+        {
+            Pattern &pattern = _patterns[id];
+            pattern.pieceCount = 0;
+            if (!pattern.active) continue;
+
+            const char *cursor = pattern.text.c_str();
+            while (*cursor != '\0')
+            {
+                size_t length = strcspn(cursor, "*");
+                if (length > 0)
+                {
+                    uint16_t node = 0;
+                    for (size_t i = 0; i < length; i++)
+                    {
+                        uint8_t character = (uint8_t)cursor[i];
+                        auto edge = std::find_if(children[node].begin(), children[node].end(), [character](const Edge &e) { return e.character == character; });
+                        if (edge != children[node].end())
+                        {
+                            node = edge->target;
+                            continue;
+                        }
+                        uint16_t child = (uint16_t)children.size();
+                        children[node].push_back({character, child});
+                        children.emplace_back();
+                        outputs.emplace_back();
+                        node = child;
+                    }
+                    Piece piece;
+                    piece.pattern = (uint16_t)id;
+                    piece.index = pattern.pieceCount++;
+                    piece.length = (uint8_t)length;
+                    outputs[node].push_back((uint16_t)_pieces.size());
+                    _pieces.push_back(piece);
+                }
+                cursor += length;
+                if (*cursor == LOG_WATCH_WILDCARD) cursor++;
+            }
+        }
+        if (_pieces.empty()) return;
+
+        _nodes.resize(children.size());
+        for (size_t node = 0; node < children.size(); node++)
+        {
+            std::sort(children[node].begin(), children[node].end(), [](const Edge &a, const Edge &b) { return a.character < b.character; });
+            _nodes[node].firstEdge = (uint16_t)_edges.size();
+            _nodes[node].edgeCount = (uint16_t)children[node].size();
+            _edges.insert(_edges.end(), children[node].begin(), children[node].end());
+            _nodes[node].firstOutput = (uint16_t)_outputs.size();
+            _nodes[node].outputCount = (uint16_t)outputs[node].size();
+            _outputs.insert(_outputs.end(), outputs[node].begin(), outputs[node].end());
+        }
+
+        // Fail and output links, breadth first so that the links of the shallower nodes are set first
+        std::vector<uint16_t> queue;
+        for (const Edge &edge : children[0])
+        {
+            _root[edge.character] = edge.target;
+            queue.push_back(edge.target);
+        }
+        for (size_t head = 0; head < queue.size(); head++)
+        {
+            uint16_t node = queue[head];
+            for (const Edge &edge : children[node])
+            {
+                Node &child = _nodes[edge.target];
+                child.fail = _next(_nodes[node].fail, edge.character);
+                child.outputLink = _nodes[child.fail].outputCount > 0 ? child.fail : _nodes[child.fail].outputLink;
+                queue.push_back(edge.target);
+            }
+        }
+    }
+};
+
+#endif